@@ -0,0 +1,98 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AudioSink.h"
+#include "PortAudio.h"
+#include "NullSink.h"
+#include "WavFileSink.h"
+#include "OggFileSink.h"
+
+#include <unistd.h>
+#include <sstream>
+#include <cstring>
+#include <chrono>
+#include <log4cxx/logger.h>
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorAsLog(log4cxx::Logger::getLogger("kolibre.narrator.audiosink"));
+
+bool AudioSink::isValid(const std::string &sink)
+{
+    return sink == "" || sink == "portaudio" || sink == "null" || sink == "null-realtime" ||
+        (sink.compare(0, 4, "wav:") == 0 && sink.size() > 4) ||
+        (sink.compare(0, 4, "ogg:") == 0 && sink.size() > 4);
+}
+
+std::string AudioSink::indexedPath(const std::string &path, int index)
+{
+    if(index <= 0) return path;
+
+    std::ostringstream name;
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+        name << path.substr(0, dot) << "-" << index << path.substr(dot);
+    else
+        name << path << "-" << index;
+    return name.str();
+}
+
+AudioSink *AudioSink::create(const std::string &sink)
+{
+    if(sink == "" || sink == "portaudio") return new PortAudio;
+    if(sink == "null") return new NullSink(false);
+    if(sink == "null-realtime") return new NullSink(true);
+    if(sink.compare(0, 4, "wav:") == 0 && sink.size() > 4) return new WavFileSink(sink.substr(4));
+    if(sink.compare(0, 4, "ogg:") == 0 && sink.size() > 4) return new OggFileSink(sink.substr(4));
+
+    LOG4CXX_ERROR(narratorAsLog, "Unknown audio sink '" << sink << "'");
+    return NULL;
+}
+
+long AudioSink::waitForPlayback(long maxms)
+{
+    long remaining = getRemainingms();
+
+    while(remaining > 0 && maxms > 0) {
+        // Sleep no longer than one buffer so the end is noticed in time
+        long sleepms = remaining;
+        if(sleepms > getBufferms()) sleepms = getBufferms();
+        if(sleepms > maxms) sleepms = maxms;
+        usleep(sleepms * 1000);
+        maxms -= sleepms;
+
+        remaining = getRemainingms();
+    }
+
+    return remaining;
+}
+
+int AudioSink::getPlayedTime(long long position, long long &timeus)
+{
+    timeus = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    return 1;
+}
+
+void AudioSink::getStats(Narrator::OutputStats &stats)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.latencyms = getOutputLatency();
+    stats.underruns = getUnderruns();
+}
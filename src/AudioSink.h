@@ -0,0 +1,111 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOSINK_H
+#define _AUDIOSINK_H
+
+#include <string>
+#include "Narrator.h"
+
+class Mixer;
+
+// Destination for the audio produced by the playback thread.
+// Samples are counted in frames (1 sample contains data from all channels)
+class AudioSink
+{
+    public:
+        virtual ~AudioSink() {}
+
+        // Creates a sink from a description, "portaudio", "null", "null-realtime", "wav:/path/to/file.wav"
+        // or "ogg:/path/to/file.ogg".
+        // Returns NULL if the description is not recognized
+        static AudioSink *create(const std::string &sink);
+
+        // Checks if create understands the description
+        static bool isValid(const std::string &sink);
+
+        // Returns path with index appended before the extension, used by file sinks when the format changes
+        static std::string indexedPath(const std::string &path, int index);
+
+        // Opens the sink for rate and channels, reuses the current setup in case they match
+        virtual bool open(long rate, int channels) = 0;
+        // Stops output and discards audio not yet played
+        virtual long stop() = 0;
+        virtual bool close() = 0;
+
+        virtual long getRate() = 0;
+        virtual int getChannels() = 0;
+
+        // Blocks until data can be written, returns the number of elements (samples * channels) which can be written
+        virtual unsigned int getWriteAvailable() = 0;
+
+        // Writes no more than getWriteAvailable samples
+        virtual bool write(float *buffer, unsigned int samples) = 0;
+
+        // Return remaining audio not yet played (ms)
+        virtual long getRemainingms() = 0;
+
+        // Position of the next sample written, counted from when the sink was created
+        virtual long long getWritePosition() { return 0; }
+
+        // Checks if the samples before position have been played. Returns 1 and sets timeus to the
+        // steady_clock time (us) the last of them reaches the listener, 0 while they are on their way,
+        // -1 if they were dropped. Sinks without a clock of their own play what they are given at once
+        virtual int getPlayedTime(long long position, long long &timeus);
+
+        // Sinks with internal buffers may let the caller write into them directly,
+        // returns 0 if not possible and write() should be used
+        virtual unsigned int getWriteRegions(unsigned int samples, float **data1, unsigned int *samples1, float **data2, unsigned int *samples2)
+        { *samples1 = *samples2 = 0; return 0; }
+        virtual bool commitWrite(unsigned int samples) { return false; }
+
+        // Tells that all audio has been written
+        virtual void endOfData() {}
+
+        // May be called from any thread. Fades out and drops buffered audio at the output
+        // without waiting for the writer, which must still call stop() when it notices
+        virtual void requestStop() {}
+
+        // Fades out and drops audio not yet played like stop(), but keeps the output running
+        // so that the writer can go on right away
+        virtual void drop() { stop(); }
+
+        // Lets the sink add the inputs of mixer to its output as it plays, so they are not held up
+        // by the audio written before them. Returns false if it can not, the writer mixes them in then.
+        // A sink which mixes starts its output on endOfData() while the mixer has work
+        virtual bool setMixer(Mixer *mixer) { return false; }
+
+        virtual void setStandby(bool standby) {}
+        virtual bool getStandby() { return false; }
+        virtual void setLatencyProfile(Narrator::LatencyProfile profile) {}
+
+        virtual long getOutputLatency() { return 0; }
+        virtual long getUnderruns() { return 0; }
+
+        // Fills in output statistics, sinks without a device only report latency and underruns
+        virtual void getStats(Narrator::OutputStats &stats);
+
+        // Return how often the sink consumes data (ms)
+        virtual long getBufferms() { return 10; }
+
+        // Sleeps until the written audio has been played or maxms has passed, returns remaining ms
+        virtual long waitForPlayback(long maxms);
+};
+
+#endif
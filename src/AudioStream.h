@@ -30,6 +30,8 @@ class AudioStream
         virtual bool open(const MessageAudio &) = 0;
         virtual bool open(string) = 0;
         virtual long read(float* buffer, int bytes) = 0;
+        // Moves to frame (1 frame contains data from all channels), returns false if not possible
+        virtual bool seek(long frame) = 0;
         virtual bool close() = 0;
 
         virtual long getRate() = 0;
@@ -0,0 +1,215 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _BOUNDEDQUEUE_H
+#define _BOUNDEDQUEUE_H
+
+#include <cstddef>
+#include <atomic>
+#include <utility>
+
+// Size of a cache line, the producer and consumer positions are kept on separate lines
+#define BOUNDEDQUEUE_CACHELINE 64
+
+// Lock-free queue with a fixed number of preallocated slots, for any number of producers and one consumer.
+// Each slot carries a sequence number telling whose turn it is, so producers only contend on
+// claiming a position and never wait for each other or for the consumer (D. Vyukov's bounded queue)
+template <typename T>
+class BoundedQueue {
+    public:
+        // Allocates at least size slots, rounded up to a power of two
+        BoundedQueue(size_t size);
+        ~BoundedQueue();
+
+        // Moves item into the queue, returns false and leaves item alone if the queue is full (any thread)
+        bool push(T &item);
+
+        // Moves count items into consecutive positions with a single claim, so no other producer's items come
+        // in between. Returns false and leaves the items alone if there is no room for all of them (any thread)
+        bool push(T *items, size_t count);
+
+        // Moves the oldest item out of the queue, returns false if the queue is empty (consumer thread only)
+        bool pop(T &item);
+
+        // Returns the oldest item without taking it out, NULL if the queue is empty (consumer thread only)
+        T *front();
+
+        // Returns the number of queued items, which may already have changed when read
+        size_t size();
+
+        // Returns the number of slots
+        size_t capacity() { return mMask + 1; }
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        char padFront[BOUNDEDQUEUE_CACHELINE];
+
+        Slot *mSlots;
+        size_t mMask;
+
+        char padSlots[BOUNDEDQUEUE_CACHELINE];
+
+        // Next position to write, claimed by producers
+        std::atomic<size_t> mEnqueuePos;
+
+        char padEnqueue[BOUNDEDQUEUE_CACHELINE];
+
+        // Next position to read, only changed by the consumer
+        std::atomic<size_t> mDequeuePos;
+
+        char padDequeue[BOUNDEDQUEUE_CACHELINE];
+
+        BoundedQueue(const BoundedQueue&);
+        BoundedQueue &operator=(const BoundedQueue&);
+};
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t size)
+{
+    size_t slots = 2;
+    while(slots < size) slots <<= 1;
+
+    mSlots = new Slot[slots];
+    mMask = slots - 1;
+
+    // A slot is free for the producer of position i when its sequence equals i
+    for(size_t i = 0; i < slots; i++)
+        mSlots[i].sequence.store(i, std::memory_order_relaxed);
+
+    mEnqueuePos.store(0, std::memory_order_relaxed);
+    mDequeuePos.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+BoundedQueue<T>::~BoundedQueue()
+{
+    delete [] mSlots;
+}
+
+template <typename T>
+bool BoundedQueue<T>::push(T &item)
+{
+    Slot *slot;
+    size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+
+    for(;;) {
+        slot = &mSlots[pos & mMask];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        long diff = (long) sequence - (long) pos;
+
+        // The slot is free, try to claim the position
+        if(diff == 0) {
+            if(mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        // The slot still holds an item from the previous lap
+        else if(diff < 0) {
+            return false;
+        }
+        // Another producer got here first
+        else {
+            pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->data = std::move(item);
+
+    // Hand the slot to the consumer
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::push(T *items, size_t count)
+{
+    if(count == 0) return true;
+    if(count > mMask + 1) return false;
+
+    size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+
+    for(;;) {
+        // The consumer frees slots in order, so all of them are free if the last one is
+        Slot *last = &mSlots[(pos + count - 1) & mMask];
+        size_t sequence = last->sequence.load(std::memory_order_acquire);
+        long diff = (long) sequence - (long) (pos + count - 1);
+
+        if(diff == 0) {
+            if(mEnqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                break;
+        }
+        else if(diff < 0) {
+            return false;
+        }
+        else {
+            pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // The consumer may take the first items while the rest are being written
+    for(size_t i = 0; i < count; i++) {
+        Slot *slot = &mSlots[(pos + i) & mMask];
+        slot->data = std::move(items[i]);
+        slot->sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::pop(T &item)
+{
+    size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+    Slot *slot = &mSlots[pos & mMask];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+    // Empty, or the producer of this position has not finished writing yet
+    if((long) sequence - (long) (pos + 1) < 0) return false;
+
+    mDequeuePos.store(pos + 1, std::memory_order_relaxed);
+    item = std::move(slot->data);
+
+    // Hand the slot back to producers for the next lap
+    slot->sequence.store(pos + mMask + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+T *BoundedQueue<T>::front()
+{
+    size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+    Slot *slot = &mSlots[pos & mMask];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+    if((long) sequence - (long) (pos + 1) < 0) return NULL;
+    return &slot->data;
+}
+
+template <typename T>
+size_t BoundedQueue<T>::size()
+{
+    size_t dequeued = mDequeuePos.load(std::memory_order_acquire);
+    size_t enqueued = mEnqueuePos.load(std::memory_order_acquire);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+#endif
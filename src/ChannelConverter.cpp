@@ -0,0 +1,98 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ChannelConverter.h"
+
+#include <log4cxx/logger.h>
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorCcLog(log4cxx::Logger::getLogger("kolibre.narrator.channelconverter"));
+
+ChannelConverter::ChannelConverter()
+{
+    mInChannels = 0;
+    mOutChannels = 0;
+    pBuffer = NULL;
+    mBufferFrames = 0;
+}
+
+ChannelConverter::~ChannelConverter()
+{
+    if(pBuffer != NULL) delete [] pBuffer;
+}
+
+bool ChannelConverter::open(int inChannels, int outChannels)
+{
+    if(inChannels <= 0 || outChannels <= 0) {
+        LOG4CXX_ERROR(narratorCcLog, "Invalid channel layout " << inChannels << " -> " << outChannels);
+        return false;
+    }
+
+    if(mInChannels != inChannels || mOutChannels != outChannels) {
+        LOG4CXX_DEBUG(narratorCcLog, "Converting " << inChannels << " channel(s) to " << outChannels << " channel(s)");
+        mInChannels = inChannels;
+        mOutChannels = outChannels;
+    }
+    return true;
+}
+
+float *ChannelConverter::convert(float *buffer, unsigned int frames)
+{
+    if(mInChannels == mOutChannels || mInChannels == 0)
+        return buffer;
+
+    // Grow the output buffer if needed, it is kept between calls
+    if(frames > mBufferFrames) {
+        if(pBuffer != NULL) delete [] pBuffer;
+        pBuffer = new float[frames * mOutChannels];
+        mBufferFrames = frames;
+    }
+
+    const float *in = buffer;
+    float *out = pBuffer;
+
+    if(mInChannels == 1) {
+        // Duplicate mono into all output channels
+        for(unsigned int i = 0; i < frames; i++) {
+            for(int c = 0; c < mOutChannels; c++)
+                *out++ = *in;
+            in++;
+        }
+    }
+    else if(mOutChannels == 1) {
+        // Average all input channels down to mono
+        float scale = 1.0f / mInChannels;
+        for(unsigned int i = 0; i < frames; i++) {
+            float sum = 0;
+            for(int c = 0; c < mInChannels; c++)
+                sum += *in++;
+            *out++ = sum * scale;
+        }
+    }
+    else {
+        // Map channels one to one, wrapping around if there are fewer input channels
+        for(unsigned int i = 0; i < frames; i++) {
+            for(int c = 0; c < mOutChannels; c++)
+                *out++ = in[c % mInChannels];
+            in += mInChannels;
+        }
+    }
+
+    return pBuffer;
+}
@@ -0,0 +1,50 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CHANNELCONVERTER_H
+#define _CHANNELCONVERTER_H
+
+#include <cstddef>
+
+// Converts interleaved samples between channel layouts, mono is duplicated
+// into all output channels and multiple channels are averaged down to mono
+class ChannelConverter {
+    public:
+        ChannelConverter();
+        ~ChannelConverter();
+
+        // Sets the channel layout of incoming and outgoing samples
+        bool open(int inChannels, int outChannels);
+
+        int getInChannels() { return mInChannels; };
+        int getOutChannels() { return mOutChannels; };
+
+        // Converts frames (1 frame contains data from all channels) from buffer,
+        // returns buffer itself if no conversion is needed
+        float *convert(float *buffer, unsigned int frames);
+
+    private:
+        int mInChannels;
+        int mOutChannels;
+
+        float *pBuffer;
+        size_t mBufferFrames;
+};
+
+#endif
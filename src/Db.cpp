@@ -21,6 +21,8 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #include <cstdlib>
 #include <cstdio>
 #include <unistd.h>
+#include <map>
+#include <mutex>
 #include <log4cxx/logger.h>
 
 #ifdef WIN32
@@ -36,6 +38,10 @@ using namespace std;
 
 namespace narrator {
 
+// Whether the messageaudio table of each database has the trim columns, looked up once
+static std::map<string, bool> trimColumns;
+static std::mutex trimColumnsMutex;
+
 int busyHandler(void *pArg1, int iPriorCalls)
 {
     LOG4CXX_WARN(narratorDbLog, "!! DB busyHandler " << iPriorCalls);
@@ -102,6 +108,12 @@ DB::~DB()
 
 bool DB::verifyDBStructure()
 {
+    // The structure may change below, look the columns up again afterwards
+    {
+        std::lock_guard<std::mutex> lock(trimColumnsMutex);
+        trimColumns.erase(mDatabase);
+    }
+
     if(!prepare("create table if not exists message \
                 (string TEXT, class TEXT, UNIQUE(string, class))")) {
         LOG4CXX_ERROR(narratorDbLog, "Could not create/open message table: ' " << getLasterror() << "'");
@@ -137,7 +149,7 @@ bool DB::verifyDBStructure()
     }
 
     if(!prepare("create table if not exists messageaudio \
-                (translation_id INT, tagid INT, text TEXT, size INT, length INT, encoding TEXT, data BLOB, md5 TEXT)")) {
+                (translation_id INT, tagid INT, text TEXT, size INT, length INT, encoding TEXT, data BLOB, md5 TEXT, trimstart INT, trimend INT)")) {
         LOG4CXX_ERROR(narratorDbLog, "Could not create/open messageaudio table: '" << getLasterror() << "'");
         return false;
     }
@@ -147,6 +159,79 @@ bool DB::verifyDBStructure()
         return false;
     }
 
+    // Databases created before trim offsets were stored lack these columns,
+    // rows in them are analyzed when they are first played
+    if(!addColumn("messageaudio", "trimstart", "INT") ||
+            !addColumn("messageaudio", "trimend", "INT")) {
+        return false;
+    }
+
+    return true;
+}
+
+bool DB::hasColumn(const char *table, const char *column, bool &found)
+{
+    found = false;
+
+    string query = string("pragma table_info(") + table + ")";
+    if(!prepare(query.c_str())) {
+        LOG4CXX_ERROR(narratorDbLog, "Could not read structure of table " << table << ": '" << getLasterror() << "'");
+        return false;
+    }
+
+    // The result is finalized on return, so that the table can be altered afterwards
+    DBResult result;
+    if(!perform(&result)) {
+        LOG4CXX_ERROR(narratorDbLog, "Could not read structure of table " << table << ": '" << getLasterror() << "'");
+        return false;
+    }
+
+    while(result.loadRow()) {
+        const char *name = result.getText(1);
+        if(name != NULL && string(name) == column) found = true;
+    }
+    return true;
+}
+
+bool DB::hasTrimColumns()
+{
+    {
+        std::lock_guard<std::mutex> lock(trimColumnsMutex);
+        std::map<string, bool>::iterator it = trimColumns.find(mDatabase);
+        if(it != trimColumns.end()) return it->second;
+    }
+
+    bool start, end;
+    if(!hasColumn("messageaudio", "trimstart", start) || !hasColumn("messageaudio", "trimend", end))
+        return false;
+
+    if(!start || !end)
+        LOG4CXX_WARN(narratorDbLog, "Database " << mDatabase << " has no trim columns, silence is skipped while playing");
+
+    std::lock_guard<std::mutex> lock(trimColumnsMutex);
+    trimColumns[mDatabase] = start && end;
+    return start && end;
+}
+
+bool DB::addColumn(const char *table, const char *column, const char *type)
+{
+    bool found;
+    if(!hasColumn(table, column, found)) return false;
+    if(found) return true;
+
+    LOG4CXX_INFO(narratorDbLog, "Adding column " << column << " to table " << table);
+
+    string query = string("alter table ") + table + " add column " + column + " " + type;
+    if(!prepare(query.c_str())) {
+        LOG4CXX_ERROR(narratorDbLog, "Could not add column " << column << ": '" << getLasterror() << "'");
+        return false;
+    }
+
+    if(!perform()) {
+        LOG4CXX_ERROR(narratorDbLog, "Add column " << column << " failed '" << getLasterror() << "'");
+        return false;
+    }
+
     return true;
 }
 
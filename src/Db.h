@@ -73,7 +73,17 @@ class DB {
         string getLasterror() { return mLastquery + ":" + mLasterror; };
         bool verifyDBStructure();
 
+        // returns true if messageaudio has the trim columns, which an old database
+        // that could not be altered lacks. Looked up once per database
+        bool hasTrimColumns();
+
     private:
+        // sets found if the table has the column, returns false if the structure could not be read
+        bool hasColumn(const char *table, const char *column, bool &found);
+
+        // adds a column to a table unless it already exists
+        bool addColumn(const char *table, const char *column, const char *type);
+
         sqlite3 *pDBHandle;
         sqlite3_stmt *pStatement;
         string mLasterror;
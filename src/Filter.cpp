@@ -34,6 +34,7 @@ Filter::Filter()
     mGain = 1.0;
     mRate = 0;
     mChannels = 0;
+    mOutputRate = 0;
 
     setTempo(mTempo);
     setPitch(mPitch);
@@ -54,10 +55,19 @@ bool Filter::open(long rate, int channels)
         setSampleRate(mRate);
         mChannels = channels;
         setChannels(mChannels);
+        if(mOutputRate > 0) setRate((double) mRate / mOutputRate);
     }
     return true;
 }
 
+void Filter::setOutputRate(long rate)
+{
+    if(rate == mOutputRate) return;
+    mOutputRate = rate;
+    // Applied by open if no input rate is known yet
+    if(mRate > 0) setRate(mOutputRate > 0 ? (double) mRate / mOutputRate : 1.0);
+}
+
 bool Filter::write(float *buffer, unsigned int samples)
 {
     putSamples(buffer, samples); // One sample contains data from all channels
@@ -67,18 +77,16 @@ bool Filter::write(float *buffer, unsigned int samples)
 unsigned int Filter::read(float *buffer, unsigned int bytes)
 {
     bytes = receiveSamples(buffer, bytes);
-    applyGain(buffer, bytes);
+    applyGain(buffer, bytes * mChannels); // One sample contains data from all channels
     return bytes;
 }
 
 void Filter::applyGain(float *buffer, unsigned int samples)
 {
-    // Change the gain on the buffer
-    static unsigned int i;
-
+    // Change the gain on the buffer, each thread has filters of its own so no state is shared
     if(mGain == 1.0) return;
 
-    for(i = 0; i < samples; i++) {
+    for(unsigned int i = 0; i < samples; i++) {
         buffer[i] = buffer[i] * mGain;
     }
 }
@@ -86,9 +94,8 @@ void Filter::applyGain(float *buffer, unsigned int samples)
 void Filter::fadeout(float *buffer, unsigned int bytes)
 {
     // Linear fadeout on the samples in the buffer
-    static unsigned int i;
     float val = 1;
-    for(i = 0; i < bytes; i++) {
+    for(unsigned int i = 0; i < bytes; i++) {
         val = (bytes - i) / bytes;
         buffer[i] = buffer[i] * val;
     }
@@ -40,6 +40,9 @@ class Filter : public soundtouch::SoundTouch {
 
         void setGain(double gain) { mGain = gain; };
 
+        // Resamples to rate by changing the playback rate, 0 leaves the rate of the input
+        void setOutputRate(long rate);
+
         void fadeout(float *buffer, unsigned int bytes);
 
     private:
@@ -49,6 +52,7 @@ class Filter : public soundtouch::SoundTouch {
 
         long mRate;
         int mChannels;
+        long mOutputRate;
 
         void applyGain(float *buffer, unsigned int samples);
 };
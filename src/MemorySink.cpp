@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "MemorySink.h"
+
+#include <log4cxx/logger.h>
+
+// Elements accepted per write
+#define MEMORYSINK_CHUNK 4096
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorMsLog(log4cxx::Logger::getLogger("kolibre.narrator.memorysink"));
+
+MemorySink::MemorySink()
+{
+    mRate = 0;
+    mChannels = 0;
+}
+
+bool MemorySink::open(long rate, int channels)
+{
+    if(rate <= 0 || channels <= 0) return false;
+
+    // Samples of different formats can not be mixed in one buffer
+    if(mRate != 0 && (mRate != rate || mChannels != channels)) {
+        LOG4CXX_WARN(narratorMsLog, "Format change to channels: " << channels << ", rate: " << rate << " not supported");
+        return false;
+    }
+
+    mRate = rate;
+    mChannels = channels;
+    return true;
+}
+
+long MemorySink::stop()
+{
+    return 0;
+}
+
+bool MemorySink::close()
+{
+    return true;
+}
+
+long MemorySink::getRate()
+{
+    return mRate;
+}
+
+int MemorySink::getChannels()
+{
+    return mChannels;
+}
+
+std::vector<float> &MemorySink::getSamples()
+{
+    return mSamples;
+}
+
+unsigned int MemorySink::getWriteAvailable()
+{
+    if(mRate == 0) return 0;
+    return MEMORYSINK_CHUNK;
+}
+
+bool MemorySink::write(float *buffer, unsigned int samples)
+{
+    if(mRate == 0) return false;
+
+    mSamples.insert(mSamples.end(), buffer, buffer + samples * mChannels);
+    return true;
+}
+
+long MemorySink::getRemainingms()
+{
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _MEMORYSINK_H
+#define _MEMORYSINK_H
+
+#include "AudioSink.h"
+#include <vector>
+
+// Sink which collects all audio in memory as interleaved samples.
+// All audio must have the same format, open fails if the rate or channels change
+class MemorySink : public AudioSink {
+    public:
+        MemorySink();
+
+        bool open(long rate, int channels);
+        long stop();
+        bool close();
+
+        long getRate();
+        int getChannels();
+
+        unsigned int getWriteAvailable();
+        bool write(float *buffer, unsigned int samples);
+        long getRemainingms();
+
+        // Returns the collected interleaved samples
+        std::vector<float> &getSamples();
+
+    private:
+        std::vector<float> mSamples;
+        long mRate;
+        int mChannels;
+};
+
+#endif
@@ -201,7 +201,11 @@ bool Message::load(string identifier, string cls)
     }
 
 
-    if(!db->prepare("select rowid, tagid, text, size, length, encoding, md5 from messageaudio where translation_id=? order by tagid")) {
+    // Without the trim columns every audio is reported as not analyzed
+    const char *query = db->hasTrimColumns() ?
+        "select rowid, tagid, text, size, length, encoding, md5, coalesce(trimstart, -1), coalesce(trimend, -1) from messageaudio where translation_id=? order by tagid" :
+        "select rowid, tagid, text, size, length, encoding, md5, -1, -1 from messageaudio where translation_id=? order by tagid";
+    if(!db->prepare(query)) {
         LOG4CXX_ERROR(narratorMsgLog, "Query failed '" << db->getLasterror() << "'");
         return false;
     }
@@ -228,6 +232,7 @@ bool Message::load(string identifier, string cls)
         ma->setLength(result4.getInt(4));
         ma->setEncoding(result4.getText(5));
         ma->setMd5(result4.getText(6));
+        ma->setTrim(result4.getInt(7), result4.getInt(8));
 
         // Set the db where messageaudio can find data
         LOG4CXX_TRACE(narratorMsgLog, "Adding audio translation " << ma->getAudioid() << ": " << ma->getText());
@@ -981,6 +986,8 @@ MessageAudio::MessageAudio()
     mEncoding = "";
     mTagid = 0;
     mAudioid = 0;
+    mTrimStart = -1;
+    mTrimEnd = -1;
     mCurrentPos = 0;
     pAudioData = NULL;
     pDBHandle = NULL;
@@ -1010,6 +1017,17 @@ void MessageAudio::print() const
 
 size_t MessageAudio::read(void *ptr, size_t size, size_t nmemb)
 {
+    // Audio which has not been stored yet is read from memory
+    if(pAudioData != NULL) {
+        size_t bytes_left = mSize - mCurrentPos;
+        size_t bytes_to_read = size * nmemb;
+        if(bytes_to_read > bytes_left) bytes_to_read = bytes_left;
+
+        memcpy(ptr, pAudioData + mCurrentPos, bytes_to_read);
+        mCurrentPos += bytes_to_read;
+        return bytes_to_read;
+    }
+
     // Open db blob for read if it's not already open
     int rc = 0;
     if(pBlob == NULL) {
@@ -1074,28 +1092,29 @@ int MessageAudio::close()
     return 0;
 }
 
+// Behaves like fseek, the blob does not need to be open since only the position is changed.
+// Being seekable lets vorbisfile seek to a frame, which is used to skip leading silence
 int MessageAudio::seek(long offset, int whence)
 {
-    int seekpos = -1;
-    if(pBlob != NULL) {
-        switch(whence) {
-            case SEEK_SET:
-                mCurrentPos = offset;
-                break;
+    long seekpos = -1;
+    switch(whence) {
+        case SEEK_SET:
+            seekpos = offset;
+            break;
 
-            case SEEK_END:
-                mCurrentPos = mSize + 1 - offset;
-                if((size_t)mCurrentPos > mSize) mCurrentPos = mSize + 1;
-                break;
+        case SEEK_END:
+            seekpos = mSize + offset;
+            break;
 
-            case SEEK_CUR:
-                mCurrentPos = mCurrentPos + offset;
-                break;
-        }
-        seekpos = mCurrentPos;
+        case SEEK_CUR:
+            seekpos = mCurrentPos + offset;
+            break;
     }
 
-    return seekpos;
+    if(seekpos < 0 || (size_t)seekpos > mSize) return -1;
+
+    mCurrentPos = seekpos;
+    return 0;
 }
 
 size_t MessageAudio_read(void *ptr, size_t size, size_t nmemb, void *datasource)
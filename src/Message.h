@@ -76,13 +76,19 @@ class MessageAudio {
         void setEncoding(string encoding) { mEncoding = encoding; };
         const string getEncoding() const { return mEncoding; };
 
+        // Range of frames to play without leading and trailing silence, -1 if not analyzed
+        void setTrim(long start, long end) { mTrimStart = start; mTrimEnd = end; };
+        long getTrimStart() const { return mTrimStart; };
+        long getTrimEnd() const { return mTrimEnd; };
+        bool isTrimmed() const { return mTrimEnd > 0; };
+
         void setAudioData(const char *source, size_t num);
         const char *getAudioData() const { return pAudioData; };
         bool isAudioDataNil() const { return pAudioData == NULL ? true : false; };
 
         //bool setDatabase(const string &db) { mDatabase = db; };
 
-        // vorbisfile interface functions.
+        // vorbisfile interface functions, reads audio data if set, otherwise from the database
         size_t read(void *ptr, size_t size, size_t nmemb);
         int close();
         int seek(long offset, int whence);
@@ -100,6 +106,8 @@ class MessageAudio {
         string mUri;
         size_t mSize;
         string mMd5;
+        long mTrimStart;
+        long mTrimEnd;
         char *pAudioData;
 
         // Read variables
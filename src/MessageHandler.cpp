@@ -21,6 +21,7 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 
 #include "MessageHandler.h"
+#include "SilenceDetector.h"
 #include "Narrator.h"
 
 #include <cstring>
@@ -535,7 +536,10 @@ long MessageHandler::updateAudio_with_id(long audioid, const MessageAudio &ma)
         return -1;
     }
 
-    if(!db->prepare("UPDATE messageaudio SET tagid=?, text=?, length=?, encoding=?, data=?, size=?, md5=? WHERE rowid=?")) {
+    long trimstart, trimend;
+    analyzeAudio(ma, trimstart, trimend);
+
+    if(!db->prepare("UPDATE messageaudio SET tagid=?, text=?, length=?, encoding=?, data=?, size=?, md5=?, trimstart=?, trimend=? WHERE rowid=?")) {
         LOG4CXX_ERROR(narratorMsgHlrLog, "Query failed '" << db->getLasterror() << "'");
         return -1;
     }
@@ -547,7 +551,9 @@ long MessageHandler::updateAudio_with_id(long audioid, const MessageAudio &ma)
             !db->bind(5, ma.getAudioData(), ma.getSize()) ||
             !db->bind(6, (long)ma.getSize()) ||
             !db->bind(7, ma.getMd5(), 32, NULL) ||
-            !db->bind(8, audioid)) {
+            !db->bind(8, trimstart) ||
+            !db->bind(9, trimend) ||
+            !db->bind(10, audioid)) {
         LOG4CXX_ERROR(narratorMsgHlrLog, "Bind failed '" << db->getLasterror() << "'");
         return -1;
     }
@@ -625,7 +631,10 @@ long MessageHandler::insertAudio(long translationid, const MessageAudio &ma)
         return -1;
     }
 
-    if(!db->prepare("INSERT INTO messageaudio (translation_id, tagid, text, length, encoding, data, size, md5) VALUES (?, ?, ?, ?, ?, ?, ?, ?)")) {
+    long trimstart, trimend;
+    analyzeAudio(ma, trimstart, trimend);
+
+    if(!db->prepare("INSERT INTO messageaudio (translation_id, tagid, text, length, encoding, data, size, md5, trimstart, trimend) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)")) {
         LOG4CXX_ERROR(narratorMsgHlrLog, "Query failed '" << db->getLasterror() << "'");
         return -1;
     }
@@ -637,7 +646,9 @@ long MessageHandler::insertAudio(long translationid, const MessageAudio &ma)
             !db->bind(5, ma.getEncoding().c_str()) ||
             !db->bind(6, ma.getAudioData(), ma.getSize()) ||
             !db->bind(7, (long)ma.getSize()) ||
-            !db->bind(8, ma.getMd5(), 32, NULL)) {
+            !db->bind(8, ma.getMd5(), 32, NULL) ||
+            !db->bind(9, trimstart) ||
+            !db->bind(10, trimend)) {
         LOG4CXX_ERROR(narratorMsgHlrLog, "Bind failed '" << db->getLasterror() << "'");
         return -1;
     }
@@ -652,3 +663,41 @@ long MessageHandler::insertAudio(long translationid, const MessageAudio &ma)
 
     return audioid;
 }
+
+// Update the range of frames to play for an audio
+long MessageHandler::updateAudioTrim(long audioid, long start, long end)
+{
+    LOG4CXX_DEBUG(narratorMsgHlrLog, "Updating trim offsets " << start << "-" << end << " for audio with id " << audioid);
+
+    // An old database which could not be altered is left alone
+    if(!db->hasTrimColumns()) return -1;
+
+    if(!db->prepare("UPDATE messageaudio SET trimstart=?, trimend=? WHERE rowid=?")) {
+        LOG4CXX_ERROR(narratorMsgHlrLog, "Query failed '" << db->getLasterror() << "'");
+        return -1;
+    }
+
+    if(!db->bind(1, start) ||
+            !db->bind(2, end) ||
+            !db->bind(3, audioid)) {
+        LOG4CXX_ERROR(narratorMsgHlrLog, "Bind failed '" << db->getLasterror() << "'");
+        return -1;
+    }
+
+    if(!db->perform()) {
+        LOG4CXX_ERROR(narratorMsgHlrLog, "Query failed '" << db->getLasterror() << "'");
+        return -1;
+    }
+
+    return audioid;
+}
+
+void MessageHandler::analyzeAudio(const MessageAudio &ma, long &start, long &end)
+{
+    SilenceDetector detector;
+    if(!detector.analyze(ma, start, end)) {
+        LOG4CXX_WARN(narratorMsgHlrLog, "Could not find silence in audio '" << ma.getText() << "', it will be analyzed when played");
+        start = -1;
+        end = -1;
+    }
+}
@@ -36,6 +36,9 @@ class MessageHandler
         // finds a message in database, returns id if success -1 if not
         long findMessage(const Message &msg);
 
+        // stores the range of frames to play for an audio, returns id if success -1 if not
+        long updateAudioTrim(long audioid, long start, long end);
+
     private:
         narrator::DB *db;
 
@@ -68,6 +71,9 @@ class MessageHandler
         long checkAudio(long translationid, const MessageAudio &mt);
         long updateAudio_with_id(long audioid, const MessageAudio &mt);
         long insertAudio(long translationid, const MessageAudio &mt);
+
+        // finds the audible range of audio data, start and end are -1 if it could not be analyzed
+        void analyzeAudio(const MessageAudio &ma, long &start, long &end);
 };
 
 #endif
@@ -0,0 +1,359 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "Mixer.h"
+
+#include <time.h>
+#include <cerrno>
+#include <chrono>
+#include <log4cxx/logger.h>
+
+// How long a writer waits for the mixer before checking again
+#define MIXER_WAIT_MS 100
+
+// How long stop waits for the mixer to drop the input
+#define MIXER_STOP_WAIT_MS 200
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorMxLog(log4cxx::Logger::getLogger("kolibre.narrator.mixer"));
+
+static long long nowus()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Kept free of dependencies between iterations so that the compiler can vectorize it
+static inline void addScaled(float *output, const float *input, size_t elements, float gain)
+{
+    for(size_t i = 0; i < elements; i++)
+        output[i] += input[i] * gain;
+}
+
+MixerInput::MixerInput(int channels):
+    mRing(MIXER_INPUT_SIZE)
+{
+    mChannels = channels;
+    mRate = 0;
+    mMixRate = MIXER_RATE;
+    mGain = 1.0;
+    mAudibleus = 0;
+    mWritten = 0;
+    mMixSeq = 0;
+    mTaken = 0;
+    mMixed = 0;
+    mDropFrom = 0;
+    mDropTo = 0;
+    mStopRequests = 0;
+    mStopsHandled = 0;
+    mWaiting = false;
+    sem_init(&mMixedSem, 0, 0);
+}
+
+MixerInput::~MixerInput()
+{
+    sem_destroy(&mMixedSem);
+}
+
+bool MixerInput::open(long rate, int channels)
+{
+    if(channels != mChannels) {
+        LOG4CXX_WARN(narratorMxLog, "Mixer input has " << mChannels << " channels, can not open with " << channels);
+        return false;
+    }
+
+    mRate = rate;
+    return true;
+}
+
+long MixerInput::stop()
+{
+    // Also drops what was written after an earlier request
+    requestStop();
+
+    long waitms = MIXER_STOP_WAIT_MS;
+    while(mStopsHandled != mStopRequests && waitms > 0) {
+        waitForMixer(10);
+        waitms -= 10;
+    }
+
+    if(mStopsHandled != mStopRequests)
+        LOG4CXX_DEBUG(narratorMxLog, "Mixer has not dropped the input yet");
+    return 0;
+}
+
+bool MixerInput::close()
+{
+    stop();
+    mRate = 0;
+    return true;
+}
+
+long MixerInput::getRate()
+{
+    return mRate;
+}
+
+int MixerInput::getChannels()
+{
+    return mChannels;
+}
+
+unsigned int MixerInput::getWriteAvailable()
+{
+    if(mRing.getWriteAvailable() == 0) waitForMixer(MIXER_WAIT_MS);
+    return mRing.getWriteAvailable();
+}
+
+bool MixerInput::write(float *buffer, unsigned int samples)
+{
+    size_t elements = mRing.writeElements(buffer, samples * mChannels);
+    mWritten += elements / mChannels;
+    return elements == samples * mChannels;
+}
+
+long MixerInput::getRemainingms()
+{
+    long long outputus = mAudibleus - nowus();
+    if(outputus < 0) outputus = 0;
+    return (long) (mRing.getReadAvailable() / mChannels * 1000 / mMixRate + outputus / 1000);
+}
+
+unsigned int MixerInput::getWriteRegions(unsigned int samples, float **data1, unsigned int *samples1, float **data2, unsigned int *samples2)
+{
+    float *elemData1, *elemData2;
+    size_t elements1, elements2;
+
+    *samples1 = *samples2 = 0;
+    mRing.getWriteRegions(samples * mChannels, &elemData1, &elements1, &elemData2, &elements2);
+
+    // Only whole samples can be handed out, a sample split around the end ends the regions
+    *data1 = elemData1;
+    *samples1 = elements1 / mChannels;
+    if(elements1 % mChannels == 0) {
+        *data2 = elemData2;
+        *samples2 = elements2 / mChannels;
+    }
+
+    return *samples1 + *samples2;
+}
+
+bool MixerInput::commitWrite(unsigned int samples)
+{
+    mRing.commitWrite(samples * mChannels);
+    mWritten += samples;
+    return true;
+}
+
+long long MixerInput::getWritePosition()
+{
+    return mWritten;
+}
+
+int MixerInput::getPlayedTime(long long position, long long &timeus)
+{
+    long long taken, mixed, audibleus, dropFrom, dropTo;
+    unsigned int seq;
+
+    do {
+        seq = mMixSeq;
+        taken = mTaken;
+        mixed = mMixed;
+        audibleus = mAudibleus;
+        dropFrom = mDropFrom;
+        dropTo = mDropTo;
+    } while((seq & 1) || seq != mMixSeq);
+
+    if(position > dropFrom && position <= dropTo) return -1;
+    if(position > taken) return 0;
+
+    // Taken samples are only on their way until the time they are heard
+    timeus = audibleus - (mixed - position) * 1000000 / mMixRate;
+    if(timeus > nowus()) return 0;
+    return 1;
+}
+
+void MixerInput::requestStop()
+{
+    mStopRequests++;
+}
+
+void MixerInput::setGain(float gain)
+{
+    mGain = gain;
+}
+
+float MixerInput::getGain()
+{
+    return mGain;
+}
+
+size_t MixerInput::mixInto(float *buffer, size_t elements, long long audibleus)
+{
+    size_t mixed = 0;
+
+    // Drop everything written before the last stop request
+    unsigned int requests = mStopRequests;
+    if(requests != mStopsHandled) {
+        size_t dropped = mRing.getReadAvailable();
+        mRing.commitRead(dropped);
+        mStopsHandled = requests;
+
+        if(dropped > 0) {
+            long long taken = mTaken;
+            mMixSeq++;
+            if(taken > mDropTo || taken < mDropFrom) mDropFrom = taken;
+            mDropTo = taken + dropped / mChannels;
+            mTaken = taken + dropped / mChannels;
+            mMixSeq++;
+        }
+    } else {
+        float gain = mGain;
+        float *data1, *data2;
+        size_t size1, size2;
+
+        mixed = mRing.getReadRegions(elements, &data1, &size1, &data2, &size2);
+        if(mixed == 0) return 0;
+
+        addScaled(buffer, data1, size1, gain);
+        if(size2 > 0) addScaled(buffer + size1, data2, size2, gain);
+        mRing.commitRead(mixed);
+
+        long long taken = mTaken + mixed / mChannels;
+        mMixSeq++;
+        mTaken = taken;
+        mMixed = taken;
+        mAudibleus = audibleus + (long long) (mixed / mChannels) * 1000000 / mMixRate;
+        mMixSeq++;
+    }
+
+    // Pairs with waitForMixer, either the writer sees the change or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(mWaiting && mWaiting.exchange(false))
+        sem_post(&mMixedSem);
+
+    return mixed;
+}
+
+bool MixerInput::hasWork()
+{
+    return mRing.getReadAvailable() > 0 || mStopsHandled != mStopRequests;
+}
+
+bool MixerInput::waitForMixer(long timeoutms)
+{
+    // Drop wakeups left over from earlier waits
+    while(sem_trywait(&mMixedSem) == 0);
+
+    // Announce the wait before checking again, so the mixer reading in between is not missed
+    mWaiting = true;
+    if(mRing.getWriteAvailable() > 0 && mStopsHandled == mStopRequests) {
+        mWaiting = false;
+        return true;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutms / 1000;
+    deadline.tv_nsec += (timeoutms % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    int result;
+    while((result = sem_timedwait(&mMixedSem, &deadline)) == -1 && errno == EINTR);
+
+    mWaiting = false;
+    return result == 0;
+}
+
+Mixer::Mixer(int inputs, int channels)
+{
+    mRate = MIXER_RATE;
+    mLatencyms = 0;
+    for(int i = 0; i < inputs; i++)
+        mInputs.push_back(new MixerInput(channels));
+}
+
+Mixer::~Mixer()
+{
+    for(size_t i = 0; i < mInputs.size(); i++)
+        delete mInputs[i];
+}
+
+MixerInput *Mixer::getInput(int input)
+{
+    if(input < 0 || input >= (int) mInputs.size()) return NULL;
+    return mInputs[input];
+}
+
+int Mixer::getInputs()
+{
+    return mInputs.size();
+}
+
+void Mixer::setRate(long rate)
+{
+    if(rate <= 0 || rate == mRate) return;
+
+    LOG4CXX_DEBUG(narratorMxLog, "Mixing at " << rate << " Hz");
+    mRate = rate;
+    for(size_t i = 0; i < mInputs.size(); i++)
+        mInputs[i]->mMixRate = rate;
+}
+
+long Mixer::getRate()
+{
+    return mRate;
+}
+
+void Mixer::setLatency(long ms)
+{
+    mLatencyms = ms;
+}
+
+bool Mixer::hasWork()
+{
+    for(size_t i = 0; i < mInputs.size(); i++)
+        if(mInputs[i]->hasWork()) return true;
+    return false;
+}
+
+long Mixer::getRemainingms()
+{
+    long remaining = 0;
+    for(size_t i = 0; i < mInputs.size(); i++) {
+        long ms = mInputs[i]->getRemainingms();
+        if(ms > remaining) remaining = ms;
+    }
+    return remaining;
+}
+
+size_t Mixer::mix(float *buffer, size_t elements)
+{
+    size_t mixed = 0;
+    long long audibleus = nowus() + (long long) mLatencyms * 1000;
+    for(size_t i = 0; i < mInputs.size(); i++) {
+        size_t elementsMixed = mInputs[i]->mixInto(buffer, elements, audibleus);
+        if(elementsMixed > mixed) mixed = elementsMixed;
+    }
+    return mixed;
+}
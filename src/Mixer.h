@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _MIXER_H
+#define _MIXER_H
+
+#include <vector>
+#include <atomic>
+#include <semaphore.h>
+#include "AudioSink.h"
+#include "RingBuffer.h"
+
+// Audio buffered in each mixer input (elements)
+#define MIXER_INPUT_SIZE 8192
+
+// Rate the inputs are mixed at until an output has been opened
+#define MIXER_RATE 44100
+
+// Sink for one voice, written by the thread playing the voice and emptied by the mixer.
+// The filter of the voice resamples to the mix rate, so any rate can be opened
+class MixerInput : public AudioSink {
+    public:
+        MixerInput(int channels);
+        ~MixerInput();
+
+        bool open(long rate, int channels);
+        // Drops what has not been mixed yet, waits until the mixer has done so
+        long stop();
+        bool close();
+
+        long getRate();
+        int getChannels();
+
+        // Blocks until data can be written or a while has passed, returns the number of elements which can be written
+        unsigned int getWriteAvailable();
+        bool write(float *buffer, unsigned int samples);
+        // Includes the time until the audio mixed last is heard
+        long getRemainingms();
+
+        // Positions are counted in samples written, they are played once the mixer has taken them
+        long long getWritePosition();
+        int getPlayedTime(long long position, long long &timeus);
+
+        unsigned int getWriteRegions(unsigned int samples, float **data1, unsigned int *samples1, float **data2, unsigned int *samples2);
+        bool commitWrite(unsigned int samples);
+
+        // Makes the mixer drop what has been written so far, safe to call from any thread
+        void requestStop();
+
+        // Gain applied when mixing, safe to call from any thread
+        void setGain(float gain);
+        float getGain();
+
+    private:
+        friend class Mixer;
+
+        // Adds up to elements scaled by the gain into buffer, returns the number of elements added (mixing thread only).
+        // Audio added is heard at audibleus
+        size_t mixInto(float *buffer, size_t elements, long long audibleus);
+
+        bool hasWork();
+
+        // Waits until the mixer has read something or timeoutms has passed, returns false on timeout
+        bool waitForMixer(long timeoutms);
+
+        RingBuffer mRing;
+        int mChannels;
+        long mRate;
+        std::atomic<long> mMixRate;
+        std::atomic<float> mGain;
+        std::atomic<long long> mAudibleus;
+
+        // Samples written (writer only) and taken by the mixer. The mixer updates the others under
+        // mMixSeq: the last sample mixed is heard at mAudibleus, samples after mDropFrom up to
+        // mDropTo were dropped by the last stop
+        long long mWritten;
+        std::atomic<unsigned int> mMixSeq;
+        std::atomic<long long> mTaken;
+        std::atomic<long long> mMixed;
+        std::atomic<long long> mDropFrom;
+        std::atomic<long long> mDropTo;
+
+        // Stop requests, handled by the mixer
+        std::atomic<unsigned int> mStopRequests;
+        std::atomic<unsigned int> mStopsHandled;
+
+        // Posted by the mixer when it has read while the writer waits
+        sem_t mMixedSem;
+        std::atomic<bool> mWaiting;
+};
+
+// Adds the audio of several inputs into one output, so that all voices share one output stream.
+// Each input has a single writer, the mixing is done without locking by the audio callback of the
+// output, or on the thread writing the output for sinks without a callback
+class Mixer {
+    public:
+        Mixer(int inputs, int channels);
+        ~Mixer();
+
+        MixerInput *getInput(int input);
+        int getInputs();
+
+        // Rate of the output, the inputs are resampled to it
+        void setRate(long rate);
+        long getRate();
+
+        // How long the output buffers audio before it is heard
+        void setLatency(long ms);
+
+        // Returns true if an input has audio or a stop waiting for the mixer
+        bool hasWork();
+
+        // Time until the audio of the input which is furthest behind has been heard (ms)
+        long getRemainingms();
+
+        // Adds audio from every input into buffer, which holds elements interleaved samples.
+        // Returns the number of elements added by the fullest input (mixing thread only)
+        size_t mix(float *buffer, size_t elements);
+
+    private:
+        std::vector<MixerInput *> mInputs;
+        std::atomic<long> mRate;
+        std::atomic<long> mLatencyms;
+};
+
+#endif
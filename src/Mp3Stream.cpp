@@ -156,6 +156,18 @@ long Mp3Stream::read(float* buffer, int bytes)
     return done/(sizeof(short) * mChannels);
 }
 
+bool Mp3Stream::seek(long frame)
+{
+    if(!isOpen) return false;
+
+    off_t result = mpg123_seek(mh, frame, SEEK_SET);
+    if(result < 0) {
+        LOG4CXX_WARN(narratorMP3StreamLog, "Could not seek to frame " << frame << ": " << mpg123_strerror(mh));
+        return false;
+    }
+    return true;
+}
+
 bool Mp3Stream::close()
 {
     if (openTmpFile)
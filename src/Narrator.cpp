@@ -34,17 +34,62 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
+#include <chrono>
+#include <set>
+#include <cerrno>
+#include <time.h>
+#ifndef _WIN32
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 using namespace std;
 
 #define BUFFERSIZE 1024
 
+// Items that can be queued for playback in each priority before play() starts dropping them
+#define PLAYLIST_SIZE 1024
+
+// Fade in when an interrupted clip continues in the middle
+#define RESUME_FADE_MS 8
+
+// Items that can be queued for each of the other voices
+#define VOICE_PLAYLIST_SIZE 64
+
+// Prompts waiting to be looked up by the resolver thread, prompts queued beyond this are looked up when played
+#define RESOLVE_QUEUE_SIZE 1024
+
+// Prompts looked up ahead of playback unless setLookahead says otherwise
+#define DEFAULT_LOOKAHEAD 4
+
+// Catalog queries and writes that can wait for the database thread
+#define DATABASE_QUEUE_SIZE 64
+
+// Events that can wait for the dispatcher thread before new ones are dropped
+#define EVENT_QUEUE_SIZE 1024
+
+// The output stream is always opened with this many channels, audio with
+// another layout is converted before it reaches the filter
+#define OUTPUT_CHANNELS 2
+
 #include "Narrator.h"
 #include "OggStream.h"
 #include "Mp3Stream.h"
-#include "PortAudio.h"
+#include "AudioSink.h"
+#include "MemorySink.h"
+#include "OggFileSink.h"
 #include "Filter.h"
+#include "ChannelConverter.h"
+#include "SilenceDetector.h"
+#include "BoundedQueue.h"
+#include "Mixer.h"
 #include "Message.h"
 #include "MessageHandler.h"
 #include <cmath>
@@ -64,6 +109,203 @@ log4cxx::LoggerPtr narratorLog(log4cxx::Logger::getLogger("kolibre.narrator.narr
 Narrator * Narrator::pinstance = 0;
 
 void *narrator_thread(void *narrator) ;
+void *voice_thread(void *voice);
+void *resolver_thread(void *narrator);
+void *database_thread(void *narrator);
+void *dispatcher_thread(void *narrator);
+
+// Priority settings for prompts queued from the current thread, see setPriority
+static thread_local Narrator::Priority threadPriority = Narrator::PRIORITY_NORMAL;
+static thread_local Narrator::Preemption threadPreemption = Narrator::PREEMPT_CLIP;
+static thread_local bool threadResume = true;
+static thread_local int threadVoice = 0;
+
+// Decode buffer of the playback and voice threads. It is kept from clip to clip, so that it is
+// allocated and faulted in once when the thread starts instead of while playing
+static thread_local vector<soundtouch::SAMPLETYPE> threadScratch;
+
+static soundtouch::SAMPLETYPE *scratchBuffer(size_t samples)
+{
+    // resize writes the new samples, which faults their pages in
+    if(threadScratch.size() < samples) threadScratch.resize(samples);
+    return &threadScratch[0];
+}
+
+// The audio of an interrupted item is kept, so it continues without being looked up or decoded again
+struct Narrator::ResumePoint {
+    vector <MessageAudio> mAudio;
+    size_t mClip;           // Clip to continue with
+    long mFrame;            // Frame to continue from, 0 plays the clip from the start
+    AudioStream *mStream;   // Stream of the clip if it was cut off in the middle
+
+    ResumePoint(vector <MessageAudio> &audio, size_t clip, long frame, AudioStream *stream):
+        mClip(clip), mFrame(frame), mStream(stream) { mAudio.swap(audio); }
+
+    ~ResumePoint()
+    {
+        if(mStream == NULL) return;
+        mStream->close();
+        delete mStream;
+    }
+};
+
+struct Narrator::Voice {
+    Narrator *mNarrator;
+    int mIndex;
+    BoundedQueue <PlaylistItem> mPlaylist;
+    std::atomic<unsigned int> mGeneration;  // Items from before the last stopVoice() are dropped
+    std::atomic<float> mTempo;
+    std::atomic<bool> bResetFlag;
+    std::atomic<bool> bPlaying;
+    MixerInput *mInput;                     // Owned by the mixer, the gain of the voice is applied there
+    deque <StageMark> mMarks;               // Stages waiting for the mixer input, voice thread only
+    pthread_t mThread;
+
+    // Signalled with narratorMutex held like mWorkCond
+    pthread_cond_t mCond;
+    std::atomic<bool> bSleeping;
+
+    Voice(Narrator *narrator, int index, MixerInput *input):
+        mNarrator(narrator), mIndex(index), mPlaylist(VOICE_PLAYLIST_SIZE), mInput(input)
+    {
+        mGeneration = 0;
+        mTempo = 1.0;
+        bResetFlag = false;
+        bPlaying = false;
+        bSleeping = false;
+        pthread_cond_init(&mCond, NULL);
+    }
+
+    ~Voice()
+    {
+        pthread_cond_destroy(&mCond);
+    }
+};
+
+struct Narrator::Resolution {
+    enum State { QUEUED, RESOLVING, DONE, TAKEN };
+
+    Narrator *mNarrator;
+    Voice *mVoice;                          // NULL for the speech
+    string mIdentifier;
+    string mClass;
+    unsigned int mGeneration;               // Not looked up if stopped before the resolver gets to it
+    std::unique_ptr<Message> mMessage;
+    std::atomic<int> mState;                // Claimed by the resolver or the playback thread, whichever comes first
+    vector <MessageAudio> mAudio;
+    string mLanguage;
+    long long mResolvedus;                  // When the resolver looked it up
+
+    Resolution(Narrator *narrator, Voice *voice, PlaylistItem &pi):
+        mNarrator(narrator), mVoice(voice), mIdentifier(pi.mIdentifier), mClass(pi.mClass),
+        mGeneration(pi.mGeneration), mMessage(std::move(pi.mMessage))
+    {
+        mState = QUEUED;
+    }
+
+    ~Resolution()
+    {
+        // Played or dropped, either way it leaves room to look up the next one
+        if(mState == DONE) {
+            mNarrator->mResolvedAhead--;
+            mNarrator->wakeResolver();
+        }
+    }
+};
+
+struct Narrator::DatabaseJob {
+    std::function<bool ()> mWork;
+    DatabaseCallback mDone;
+    std::promise<bool> mResult;
+};
+
+Narrator::PlaylistItem::PlaylistItem():
+    mId(0)
+{
+}
+
+// Monotonic time used to measure how long items wait in the queue
+static long long nowus()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Item ids are unique within the process, so that a Batch can number its prompts without a narrator
+static std::atomic<Narrator::ItemId> lastItemId(0);
+
+static Narrator::ItemId nextItemId()
+{
+    return ++lastItemId;
+}
+
+struct Narrator::ItemReport : std::enable_shared_from_this<ItemReport> {
+    Narrator *mNarrator;
+    ItemId mId;
+    std::atomic<unsigned int> mReported;    // Bit for each stage reported so far
+    int mParts;                             // Prompts of the item
+    int mPlayed;                            // Prompts played to the end
+    long long mQueuedus;                    // When the item was queued
+    long long mWrittenus;                   // When the first samples were written
+    bool bAudibleMarked;                    // ITEM_AUDIBLE waits for the output
+
+    ItemReport(Narrator *narrator, ItemId id, long long queuedus):
+        mNarrator(narrator), mId(id), mReported(0), mParts(0), mPlayed(0), mQueuedus(queuedus), mWrittenus(0), bAudibleMarked(false) {}
+
+    // The item is over once none of its prompts or marks is left, it has stopped unless the output
+    // played the end. Items left when the narrator is deleted are not reported
+    ~ItemReport()
+    {
+        if(mNarrator->mState == EXIT) return;
+        if(!(mReported & (1u << ITEM_FINISHED))) report(ITEM_STOPPED, nowus());
+    }
+
+    // The queueing thread reports ITEM_ENQUEUED once the item is in the playlist,
+    // unless a later stage gets there first and reports it before itself
+    void report(ItemStage stage, long long timeus)
+    {
+        if(stage != ITEM_ENQUEUED) report(ITEM_ENQUEUED, mQueuedus);
+
+        unsigned int bit = 1u << stage;
+        if(mReported.fetch_or(bit) & bit) return;
+        mNarrator->itemEvent(mId, stage, timeus);
+    }
+
+    // Called before samples are written, the item is audible once the output has played the first of them.
+    // Audio dropped before it was heard is marked again when the item continues
+    void written(AudioSink &sink, bool live, deque <StageMark> &marks)
+    {
+        if(!(mReported & (1u << ITEM_FIRST_WRITTEN))) {
+            mWrittenus = nowus();
+            report(ITEM_FIRST_WRITTEN, mWrittenus);
+        }
+        if(!live || bAudibleMarked || (mReported & (1u << ITEM_AUDIBLE))) return;
+
+        StageMark mark = { shared_from_this(), ITEM_AUDIBLE, sink.getWritePosition() + 1 };
+        marks.push_back(mark);
+        bAudibleMarked = true;
+    }
+
+    // Nothing is reported for an item which never made it into the playlist
+    void discard()
+    {
+        mReported = ~0u;
+    }
+
+    // Called when a prompt has been written to the end, the item is finished once the output
+    // has played the last prompt. A render is finished when it has been written
+    void played(AudioSink &sink, bool live, deque <StageMark> &marks)
+    {
+        if(++mPlayed < mParts) return;
+        if(!live) {
+            report(ITEM_FINISHED, nowus());
+            return;
+        }
+
+        StageMark mark = { shared_from_this(), ITEM_FINISHED, sink.getWritePosition() };
+        marks.push_back(mark);
+    }
+};
 
 std::string getFileExtension(const std::string& filename)
 {
@@ -98,6 +340,19 @@ Narrator::Narrator()
     narratorMutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
     pthread_mutex_init (narratorMutex, NULL);
 
+    // Timed waits should not jump with the wall clock
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+#ifndef _WIN32
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&mWorkCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_cond_init(&mResolveCond, NULL);
+    pthread_cond_init(&mResolvedCond, NULL);
+    pthread_cond_init(&mDatabaseCond, NULL);
+    pthread_cond_init(&mEventCond, NULL);
+
     mVolumeGain = 1.0;
     mPitch = 1.0;
     mTempo = 1.0;
@@ -106,7 +361,63 @@ Narrator::Narrator()
     mDatabasePath = "";
     bPushCommandFinished = true;
     bResetFlag = false;
-    nextMessage = NULL;
+    mSink = NULL;
+    mStandbyms = 0;
+    mLatencyProfile = LATENCY_SAFE;
+    memset(&mOutputStats, 0, sizeof(mOutputStats));
+    bRendering = false;
+    bSleeping = false;
+    for(int priority = PRIORITY_NORMAL; priority <= PRIORITY_URGENT; priority++)
+        mPlaylist[priority] = new BoundedQueue<PlaylistItem>(PLAYLIST_SIZE);
+    mGeneration = 0;
+    bDropStale = false;
+    mPreemptNow = -1;
+    mMixer = new Mixer(NARRATOR_VOICES - 1, OUTPUT_CHANNELS);
+    bOutputMixes = false;
+    bMixing = false;
+    for(int voice = 0; voice < NARRATOR_VOICES; voice++)
+        mVoices[voice] = NULL;
+    mResolveQueue = new BoundedQueue< std::shared_ptr<Resolution> >(RESOLVE_QUEUE_SIZE);
+    mLookahead = DEFAULT_LOOKAHEAD;
+    mResolvedAhead = 0;
+    bResolverSleeping = false;
+    mDatabaseQueue = new BoundedQueue<DatabaseJob>(DATABASE_QUEUE_SIZE);
+    bDatabaseStarted = false;
+    bDatabaseSleeping = false;
+    bMemoryLocked = false;
+    bItemEvents = false;
+    mEventQueue = new BoundedQueue<Event>(EVENT_QUEUE_SIZE);
+    bDispatcherStarted = false;
+    bDispatcherSleeping = false;
+    bCoalesceEvents = false;
+    mFinishedPending = 0;
+    mFinishedOverflow = 0;
+    mPollQueue = new BoundedQueue<Event>(EVENT_QUEUE_SIZE);
+    mEventFd = -1;
+    mEventWriteFd = -1;
+    bEventSignalled = false;
+    bPollOverflow = false;
+    mPollFinished = 0;
+    mPollState = -1;
+    mPollStateus = 0;
+    pthread_mutex_init(&mPollMutex, NULL);
+
+    // Allow the latency profile to be picked per board without rebuilding
+    const char *latency = getenv("NARRATOR_LATENCY");
+    if(latency != NULL) {
+        string profile = latency;
+        if(profile == "low") mLatencyProfile = LATENCY_LOW;
+        else if(profile == "balanced") mLatencyProfile = LATENCY_BALANCED;
+        else if(profile == "safe") mLatencyProfile = LATENCY_SAFE;
+        else LOG4CXX_WARN(narratorLog, "Unknown NARRATOR_LATENCY '" << profile << "', using safe");
+    }
+
+    mAudioSink = "portaudio";
+    const char *sink = getenv("NARRATOR_AUDIO_SINK");
+    if(sink != NULL) {
+        if(AudioSink::isValid(sink)) mAudioSink = sink;
+        else LOG4CXX_WARN(narratorLog, "Unknown NARRATOR_AUDIO_SINK '" << sink << "', using portaudio");
+    }
 
     pthread_mutex_lock(narratorMutex);
     pthread_mutex_unlock(narratorMutex);
@@ -115,6 +426,31 @@ Narrator::Narrator()
         LOG4CXX_ERROR(narratorLog, "Failed to initialize thread");
     }
 
+    // Real-time settings of the playback thread are only used when asked for
+    const char *scheduling = getenv("NARRATOR_SCHEDULING");
+    if(scheduling != NULL) {
+        string value = scheduling;
+        size_t colon = value.find(':');
+        string policy = value.substr(0, colon);
+        int priority = colon == string::npos ? 0 : atoi(value.c_str() + colon + 1);
+        if(policy == "fifo") setPlaybackScheduling(SCHEDULING_FIFO, priority);
+        else if(policy == "rr") setPlaybackScheduling(SCHEDULING_RR, priority);
+        else if(policy != "default") LOG4CXX_WARN(narratorLog, "Unknown NARRATOR_SCHEDULING '" << value << "', using default");
+    }
+
+    const char *affinity = getenv("NARRATOR_AFFINITY");
+    if(affinity != NULL) {
+        vector<int> cpus;
+        stringstream list(affinity);
+        string cpu;
+        while(getline(list, cpu, ','))
+            if(!cpu.empty()) cpus.push_back(atoi(cpu.c_str()));
+        setPlaybackAffinity(cpus);
+    }
+
+    const char *mlock = getenv("NARRATOR_MLOCK");
+    if(mlock != NULL && string(mlock) == "1") setMemoryLocked(true);
+
 }
 
 /**
@@ -124,13 +460,45 @@ Narrator::~Narrator()
 {
     LOG4CXX_TRACE(narratorLog, "Destructor");
 
-    // Tell the playbackThread to exit
+    // Tell the playbackThread, the voices, the resolver, the database and the dispatcher thread to exit
     pthread_mutex_lock(narratorMutex);
     mState = Narrator::EXIT;
+    pthread_cond_signal(&mWorkCond);
+    pthread_cond_signal(&mResolveCond);
+    pthread_cond_signal(&mDatabaseCond);
+    pthread_cond_signal(&mEventCond);
+    for(int voice = 1; voice < NARRATOR_VOICES; voice++)
+        if(mVoices[voice] != NULL) pthread_cond_signal(&mVoices[voice].load()->mCond);
     pthread_mutex_unlock(narratorMutex);
 
     LOG4CXX_INFO(narratorLog, "Waiting for playbackthread to join");
     pthread_join (playbackThread, NULL);
+    pthread_join (mResolverThread, NULL);
+    if(bDatabaseStarted) pthread_join (mDatabaseThread, NULL);
+    for(int voice = 1; voice < NARRATOR_VOICES; voice++) {
+        if(mVoices[voice] == NULL) continue;
+        pthread_join(mVoices[voice].load()->mThread, NULL);
+        delete mVoices[voice].load();
+    }
+    // Last, so that it delivers what the others have left
+    if(bDispatcherStarted) pthread_join (mDispatcherThread, NULL);
+    delete mMixer;
+    pthread_cond_destroy(&mWorkCond);
+    for(int priority = PRIORITY_NORMAL; priority <= PRIORITY_URGENT; priority++)
+        delete mPlaylist[priority];
+    mInterrupted.clear();
+    delete mResolveQueue;
+    pthread_cond_destroy(&mResolveCond);
+    pthread_cond_destroy(&mResolvedCond);
+    delete mDatabaseQueue;
+    pthread_cond_destroy(&mDatabaseCond);
+    delete mEventQueue;
+    pthread_cond_destroy(&mEventCond);
+    delete mPollQueue;
+    pthread_mutex_destroy(&mPollMutex);
+    if(mEventWriteFd >= 0 && mEventWriteFd != mEventFd) close(mEventWriteFd);
+    if(mEventFd >= 0) close(mEventFd);
+    if(bMemoryLocked) setMemoryLocked(false);
     free(narratorMutex);
 }
 
@@ -254,7 +622,8 @@ string Narrator::getDatabasePath()
  */
 bool Narrator::hasOggAudio(const char *identifier)
 {
-    return hasAudio(identifier, "ogg");
+    string id = identifier;
+    return queueDatabaseJob([this, id]() { return hasAudio(id.c_str(), "ogg"); }, DatabaseCallback(), true).get();
 }
 
 /**
@@ -264,7 +633,34 @@ bool Narrator::hasOggAudio(const char *identifier)
  */
 bool Narrator::hasMp3Audio(const char *identifier)
 {
-    return hasAudio(identifier, "mp3");
+    string id = identifier;
+    return queueDatabaseJob([this, id]() { return hasAudio(id.c_str(), "mp3"); }, DatabaseCallback(), true).get();
+}
+
+/**
+ * Check on the database thread if OGG audio for an identifier exists in database
+ *
+ * @param identifier Identifier of the audio
+ * @param done Called on the database thread with the result
+ * @return Future result, false if the request could not be queued
+ */
+std::future<bool> Narrator::hasOggAudioAsync(const char *identifier, DatabaseCallback done)
+{
+    string id = identifier;
+    return queueDatabaseJob([this, id]() { return hasAudio(id.c_str(), "ogg"); }, done, false);
+}
+
+/**
+ * Check on the database thread if MP3 audio for an identifier exists in database
+ *
+ * @param identifier Identifier of the audio
+ * @param done Called on the database thread with the result
+ * @return Future result, false if the request could not be queued
+ */
+std::future<bool> Narrator::hasMp3AudioAsync(const char *identifier, DatabaseCallback done)
+{
+    string id = identifier;
+    return queueDatabaseJob([this, id]() { return hasAudio(id.c_str(), "mp3"); }, done, false);
 }
 
 bool Narrator::hasAudio(const char *identifier, std::string encoding)
@@ -290,7 +686,9 @@ bool Narrator::hasAudio(const char *identifier, std::string encoding)
  */
 bool Narrator::addOggAudio(const char *identifier, const char *data, int size)
 {
-    return addAudio(identifier, "ogg", data, size);
+    string id = identifier;
+    string lang = getLanguage();
+    return queueDatabaseJob([=]() { return addAudio(id.c_str(), "ogg", lang, data, size); }, DatabaseCallback(), true).get();
 }
 
 /**
@@ -300,10 +698,46 @@ bool Narrator::addOggAudio(const char *identifier, const char *data, int size)
  */
 bool Narrator::addMp3Audio(const char *identifier, const char *data, int size)
 {
-    return addAudio(identifier, "mp3", data, size);
+    string id = identifier;
+    string lang = getLanguage();
+    return queueDatabaseJob([=]() { return addAudio(id.c_str(), "mp3", lang, data, size); }, DatabaseCallback(), true).get();
+}
+
+/**
+ * Add OGG audio with identifier to database on the database thread
+ *
+ * @param identifier Identifier of the audio
+ * @param data Audio data, copied before returning
+ * @param size Size of the data
+ * @param done Called on the database thread with the result
+ * @return Future result, false if the request could not be queued
+ */
+std::future<bool> Narrator::addOggAudioAsync(const char *identifier, const char *data, int size, DatabaseCallback done)
+{
+    string id = identifier;
+    string lang = getLanguage();
+    std::shared_ptr<string> audio = std::make_shared<string>(data, size);
+    return queueDatabaseJob([=]() { return addAudio(id.c_str(), "ogg", lang, audio->data(), size); }, done, false);
+}
+
+/**
+ * Add MP3 audio with identifier to database on the database thread
+ *
+ * @param identifier Identifier of the audio
+ * @param data Audio data, copied before returning
+ * @param size Size of the data
+ * @param done Called on the database thread with the result
+ * @return Future result, false if the request could not be queued
+ */
+std::future<bool> Narrator::addMp3AudioAsync(const char *identifier, const char *data, int size, DatabaseCallback done)
+{
+    string id = identifier;
+    string lang = getLanguage();
+    std::shared_ptr<string> audio = std::make_shared<string>(data, size);
+    return queueDatabaseJob([=]() { return addAudio(id.c_str(), "mp3", lang, audio->data(), size); }, done, false);
 }
 
-bool Narrator::addAudio(const char *identifier, std::string encoding, const char *data, int size)
+bool Narrator::addAudio(const char *identifier, std::string encoding, const string &lang, const char *data, int size)
 {
     LOG4CXX_DEBUG(narratorLog, "Add audio with identifier: '" << identifier << "' and encoding '" << encoding << "'");
 
@@ -320,7 +754,7 @@ bool Narrator::addAudio(const char *identifier, std::string encoding, const char
 
     // create MessageTranslation object
     MessageTranslation messageTranslation;
-    messageTranslation.setLanguage(mLanguage); // use current language
+    messageTranslation.setLanguage(lang); // language when the audio was queued
     messageTranslation.setText(identifier);
     messageTranslation.setAudiotags("[0]");
     messageTranslation.addAudio(messageAudio);
@@ -340,6 +774,73 @@ bool Narrator::addAudio(const char *identifier, std::string encoding, const char
     return false;
 }
 
+/**
+ * Queue work for the database thread, starting the thread the first time
+ *
+ * @param work The query or write, returning its result
+ * @param done Called on the database thread with the result, may be empty
+ * @param runIfFull Run the work on the calling thread if it can not be queued, for callers that wait anyway
+ * @return Future result
+ */
+std::future<bool> Narrator::queueDatabaseJob(std::function<bool ()> work, DatabaseCallback done, bool runIfFull)
+{
+    DatabaseJob job;
+    job.mWork = work;
+    job.mDone = done;
+    std::future<bool> result = job.mResult.get_future();
+
+    if(!bDatabaseStarted) {
+        pthread_mutex_lock(narratorMutex);
+        if(!bDatabaseStarted && mState != EXIT) {
+            LOG4CXX_INFO(narratorLog, "Setting up database thread");
+            if(pthread_create(&mDatabaseThread, NULL, database_thread, this) == 0)
+                bDatabaseStarted = true;
+            else
+                LOG4CXX_ERROR(narratorLog, "Failed to initialize database thread");
+        }
+        pthread_mutex_unlock(narratorMutex);
+    }
+
+    // A callback waiting for a query on the database thread would wait for itself
+    bool onDatabaseThread = bDatabaseStarted && pthread_equal(mDatabaseThread, pthread_self());
+
+    if(onDatabaseThread || !bDatabaseStarted || !mDatabaseQueue->push(job)) {
+        if(!runIfFull) {
+            LOG4CXX_WARN(narratorLog, "Database queue full, dropping request");
+            job.mResult.set_value(false);
+            return result;
+        }
+
+        bool value = job.mWork();
+        if(job.mDone) job.mDone(value);
+        job.mResult.set_value(value);
+        return result;
+    }
+
+    // Pairs with the fence in waitForDatabaseJob like wakeThread
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(bDatabaseSleeping) {
+        pthread_mutex_lock(narratorMutex);
+        pthread_cond_signal(&mDatabaseCond);
+        pthread_mutex_unlock(narratorMutex);
+    }
+    return result;
+}
+
+/**
+ * Called from the database_thread to sleep until there is a query or write
+ */
+void Narrator::waitForDatabaseJob()
+{
+    pthread_mutex_lock(narratorMutex);
+    bDatabaseSleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while(mDatabaseQueue->size() == 0 && mState != EXIT)
+        pthread_cond_wait(&mDatabaseCond, narratorMutex);
+    bDatabaseSleeping = false;
+    pthread_mutex_unlock(narratorMutex);
+}
+
 /**
  * Toggle if Narrator shall send NarratorFinished when done
  *
@@ -367,264 +868,586 @@ bool Narrator::getPushCommandFinished()
 }
 
 /**
- * Adjust the playback volumegain
+ * Set how long the audio output is kept running after playback has finished
  *
- * @param adjustment +/- volumegain
+ * @param ms Standby time in milliseconds, 0 disables standby
  */
-void Narrator::adjustVolumeGain(float adjustment)
+void Narrator::setStandbyTime(long ms)
 {
+    if(ms < 0) ms = 0;
     pthread_mutex_lock(narratorMutex);
-    float value = mVolumeGain + adjustment;
+    mStandbyms = ms;
     pthread_mutex_unlock(narratorMutex);
 
-    return setVolumeGain(value);
+    LOG4CXX_DEBUG(narratorLog, "Setting standby time to: " << ms << " ms");
 }
 
 /**
- * Get the current playback volumegain
+ * Get how long the audio output is kept running after playback has finished
  *
- * @return volumegain
+ * @return Standby time in milliseconds
  */
-float Narrator::getVolumeGain()
+long Narrator::getStandbyTime()
 {
+    long value;
     pthread_mutex_lock(narratorMutex);
-    float volumegain = mVolumeGain;
+    value = mStandbyms;
     pthread_mutex_unlock(narratorMutex);
-
-    return volumegain;
+    return value;
 }
 
 /**
- * Set the playback volumegain
+ * Set how many prompts are looked up in the database ahead of playback
  *
- * @param value volumegain (between MAX_VOLUMEGAIN and MIN_VOLUMEGAIN)
+ * @param items number of prompts, 0 looks up each prompt when it starts playing
  */
-void Narrator::setVolumeGain(float value)
+void Narrator::setLookahead(int items)
 {
-    if(value <= NARRATOR_MIN_VOLUMEGAIN) value = NARRATOR_MIN_VOLUMEGAIN;
-    if(value >= NARRATOR_MAX_VOLUMEGAIN) value = NARRATOR_MAX_VOLUMEGAIN;
-    pthread_mutex_lock(narratorMutex);
-    mVolumeGain = value;
-    pthread_mutex_unlock(narratorMutex);
+    if(items < 0) items = 0;
+    mLookahead = items;
+    wakeResolver();
 
-    LOG4CXX_DEBUG(narratorLog, "Setting volumegain to: " << value);
-    return;
+    LOG4CXX_DEBUG(narratorLog, "Setting lookahead to: " << items << " prompts");
 }
 
 /**
- * Adjust the playback tempo
+ * Get how many prompts are looked up in the database ahead of playback
  *
- * @param adjustment +/- tempo
+ * @return Number of prompts
  */
-void Narrator::adjustTempo(float adjustment)
+int Narrator::getLookahead()
 {
-    pthread_mutex_lock(narratorMutex);
-    float value = mTempo + adjustment;
-    pthread_mutex_unlock(narratorMutex);
-
-    return setTempo(value);
+    return mLookahead;
 }
 
 /**
- * Get the current playback tempo
+ * Set how much audio is buffered for output
  *
- * @return tempo
+ * @param profile Latency profile, used from the next prompt played
  */
-float Narrator::getTempo()
+void Narrator::setLatencyProfile(LatencyProfile profile)
 {
     pthread_mutex_lock(narratorMutex);
-    float tempo = mTempo;
+    mLatencyProfile = profile;
     pthread_mutex_unlock(narratorMutex);
 
-    return tempo;
+    LOG4CXX_DEBUG(narratorLog, "Setting latency profile to: " << profile);
 }
 
 /**
- * Set the playback tempo
+ * Get the current latency profile
  *
- * @param value tempo (between NARRATOR_MAX_TEMPO and NARRATOR_MIN_TEMPO)
+ * @return Latency profile
  */
-void Narrator::setTempo(float value)
+Narrator::LatencyProfile Narrator::getLatencyProfile()
 {
-    if(value <= NARRATOR_MIN_TEMPO) value = NARRATOR_MIN_TEMPO;
-    if(value >= NARRATOR_MAX_TEMPO) value = NARRATOR_MAX_TEMPO;
+    LatencyProfile value;
     pthread_mutex_lock(narratorMutex);
-    mTempo = value;
+    value = mLatencyProfile;
     pthread_mutex_unlock(narratorMutex);
+    return value;
+}
 
-    LOG4CXX_DEBUG(narratorLog, "Setting tempo to: " << value);
-    return;
+static const char *schedulingName(Narrator::SchedulingPolicy policy)
+{
+    switch(policy) {
+        case Narrator::SCHEDULING_FIFO: return "fifo";
+        case Narrator::SCHEDULING_RR: return "rr";
+        default: return "default";
+    }
 }
 
 /**
- * Adjust the playback pitch
+ * Set the scheduling policy and priority of the playback thread
  *
- * @param adjustment +/- pitch
+ * @param policy Scheduling policy
+ * @param priority Priority within the policy, ignored for SCHEDULING_DEFAULT
+ * @return True if the thread runs with the policy and priority asked for
  */
-void Narrator::adjustPitch(float adjustment)
+bool Narrator::setPlaybackScheduling(SchedulingPolicy policy, int priority)
 {
-    pthread_mutex_lock(narratorMutex);
-    float value = mPitch + adjustment;
-    pthread_mutex_unlock(narratorMutex);
+#ifdef _WIN32
+    LOG4CXX_WARN(narratorLog, "Scheduling of the playback thread is not supported on this platform");
+    return policy == SCHEDULING_DEFAULT;
+#else
+    int sched = SCHED_OTHER;
+    if(policy == SCHEDULING_FIFO) sched = SCHED_FIFO;
+    else if(policy == SCHEDULING_RR) sched = SCHED_RR;
+
+    struct sched_param param;
+    param.sched_priority = 0;
+    if(sched != SCHED_OTHER) {
+        int min = sched_get_priority_min(sched);
+        int max = sched_get_priority_max(sched);
+        param.sched_priority = priority < min ? min : priority > max ? max : priority;
+    }
+    int wanted = param.sched_priority;
+
+    int error = pthread_setschedparam(playbackThread, sched, &param);
+    if(error == EPERM && sched != SCHED_OTHER) {
+        // Without CAP_SYS_NICE real-time priorities up to RLIMIT_RTPRIO may still be used
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur > 0 && limit.rlim_cur < (rlim_t) wanted) {
+            LOG4CXX_WARN(narratorLog, "Not allowed to use priority " << wanted << ", trying " << limit.rlim_cur);
+            param.sched_priority = limit.rlim_cur;
+            error = pthread_setschedparam(playbackThread, sched, &param);
+        }
+    }
+    if(error != 0)
+        LOG4CXX_WARN(narratorLog, "Failed to set scheduling " << schedulingName(policy) << ":" << wanted << " for playback thread: " << strerror(error));
 
-    return setPitch(value);
+    int applied = 0;
+    SchedulingPolicy actual = getPlaybackScheduling(&applied);
+    LOG4CXX_INFO(narratorLog, "Playback thread scheduling is " << schedulingName(actual) << ":" << applied);
+    return actual == policy && applied == wanted;
+#endif
 }
 
 /**
- * Get the current playback pitch
+ * Get the scheduling policy the playback thread runs with
  *
- * @return pitch
+ * @param priority Receives the priority within the policy if not NULL
+ * @return Scheduling policy
  */
-float Narrator::getPitch()
+Narrator::SchedulingPolicy Narrator::getPlaybackScheduling(int *priority)
 {
-    pthread_mutex_lock(narratorMutex);
-    float pitch = mPitch;
-    pthread_mutex_unlock(narratorMutex);
-
-    return pitch;
+    if(priority != NULL) *priority = 0;
+#ifndef _WIN32
+    int sched;
+    struct sched_param param;
+    if(pthread_getschedparam(playbackThread, &sched, &param) != 0) return SCHEDULING_DEFAULT;
+
+    if(sched == SCHED_FIFO || sched == SCHED_RR) {
+        if(priority != NULL) *priority = param.sched_priority;
+        return sched == SCHED_FIFO ? SCHEDULING_FIFO : SCHEDULING_RR;
+    }
+#endif
+    return SCHEDULING_DEFAULT;
 }
 
 /**
- * Set the playback pitch
+ * Set the CPUs the playback thread may run on
  *
- * @param value pitch (between MAX_PITCH and MIN_PITCH)
+ * @param cpus CPU numbers, empty allows all CPUs
+ * @return True if the affinity was applied
  */
-void Narrator::setPitch(float value)
+bool Narrator::setPlaybackAffinity(const vector<int> &cpus)
 {
-    if(value <= NARRATOR_MIN_PITCH) value = NARRATOR_MIN_PITCH;
-    if(value >= NARRATOR_MAX_PITCH) value = NARRATOR_MAX_PITCH;
-    pthread_mutex_lock(narratorMutex);
-    mPitch = value;
-    pthread_mutex_unlock(narratorMutex);
+#ifdef _WIN32
+    LOG4CXX_WARN(narratorLog, "Affinity of the playback thread is not supported on this platform");
+    return cpus.empty();
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(cpus.empty()) {
+        long count = sysconf(_SC_NPROCESSORS_CONF);
+        for(long cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &set);
+    }
+    for(size_t i = 0; i < cpus.size(); i++) {
+        if(cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            LOG4CXX_WARN(narratorLog, "Invalid CPU " << cpus[i] << " for playback thread");
+            return false;
+        }
+        CPU_SET(cpus[i], &set);
+    }
 
-    LOG4CXX_DEBUG(narratorLog, "Setting pitch to: " << value);
-    return;
+    int error = pthread_setaffinity_np(playbackThread, sizeof(set), &set);
+    if(error != 0) {
+        LOG4CXX_WARN(narratorLog, "Failed to set affinity of playback thread: " << strerror(error));
+        return false;
+    }
+
+    LOG4CXX_INFO(narratorLog, "Playback thread runs on " << CPU_COUNT(&set) << " CPUs");
+    return true;
+#endif
 }
 
 /**
- * Emitt the audio-finished-playing signal
+ * Get the CPUs the playback thread may run on
+ *
+ * @return CPU numbers
  */
-void Narrator::audioFinishedPlaying()
+vector<int> Narrator::getPlaybackAffinity()
 {
-    if(bPushCommandFinished) {
-        m_signal_audio_finished();
-    }
+    vector<int> cpus;
+#ifndef _WIN32
+    cpu_set_t set;
+    if(pthread_getaffinity_np(playbackThread, sizeof(set), &set) != 0) return cpus;
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if(CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+#endif
+    return cpus;
 }
 
 /**
- * Setup the playback thread
+ * Lock the memory of the process into RAM
  *
- * @return False if it failed, true otherwise.
+ * @param locked True to lock, false to unlock
+ * @return True if the memory is locked or unlocked as asked
  */
-bool Narrator::setupThread() {
-    LOG4CXX_INFO(narratorLog, "Setting up playback thread");
-    if(pthread_create(&playbackThread, NULL, narrator_thread, this)) {
-        usleep(500000);
+bool Narrator::setMemoryLocked(bool locked)
+{
+#ifdef _WIN32
+    LOG4CXX_WARN(narratorLog, "Locking memory is not supported on this platform");
+    return !locked;
+#else
+    if(!locked) {
+        if(bMemoryLocked) munlockall();
+        bMemoryLocked = false;
+        return true;
+    }
+
+    // The ring and scratch buffers are written when they are allocated, so what is mapped now
+    // is resident and stays so, and buffers allocated later are faulted in as they are mapped
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        int error = errno;
+        LOG4CXX_WARN(narratorLog, "Failed to lock memory: " << strerror(error));
         return false;
     }
+
+    LOG4CXX_INFO(narratorLog, "Memory locked");
+    bMemoryLocked = true;
     return true;
+#endif
 }
 
 /**
- * Set integer parameter value for an audio prompt
+ * Check if the memory of the process has been locked by setMemoryLocked
  *
- * @param key Name of the parameter
- * @param value Value for the parameter
+ * @return True if locked
  */
-void Narrator::setParameter(const string &key, int value)
+bool Narrator::getMemoryLocked()
 {
-    LOG4CXX_DEBUG(narratorLog, "Got parameter: " << key << ", with value: " << value);
-    MessageParameter mp(key);
-    mp.setIntValue(value);
-
-    pthread_mutex_lock(narratorMutex);
-    if(nextMessage == NULL)
-        nextMessage = new Message();
-    nextMessage->addParameter(mp);
-    pthread_mutex_unlock(narratorMutex);
+    return bMemoryLocked;
 }
 
 /**
- * Set string parameter value for an audio prompt
+ * Get the output latency reported by the audio device when the stream was last started
  *
- * @param key Name of the parameter
- * @param value Value for the parameter
+ * @return Output latency in milliseconds
  */
-void Narrator::setParameter(const string &key, const string &value)
+long Narrator::getOutputLatency()
 {
-    LOG4CXX_DEBUG(narratorLog, "Got parameter: " << key << ", with value: " << value);
-
+    long value;
     pthread_mutex_lock(narratorMutex);
-    if(nextMessage == NULL)
-        nextMessage = new Message();
-    nextMessage->setParameterValue(key, value);
+    value = mOutputStats.latencyms;
     pthread_mutex_unlock(narratorMutex);
+    return value;
 }
 
 /**
- * Add a prompt onto queue of files to be played if action is CLEAR remove items from playlist and stop playback of the current item
+ * Get the number of times the audio output has run out of data while playing
  *
- * @param identifier Identifier of the audio prompt
+ * @return Number of underruns, including those reported by the device
  */
-void Narrator::play(const char *identifier)
+long Narrator::getUnderruns()
 {
-    PlaylistItem pi;
-
-    pi.mIdentifier = identifier;
-    pi.mClass = "prompt";
-
+    long value;
     pthread_mutex_lock(narratorMutex);
-    if(nextMessage == NULL)
-        nextMessage = new Message();
-    pi.mMessage = nextMessage;
-    nextMessage = NULL;
-    mPlaylist.push(pi);
+    value = mOutputStats.underruns + mOutputStats.underflows;
     pthread_mutex_unlock(narratorMutex);
+    return value;
 }
 
 /**
- * Narrate a file source from a given path
+ * Get statistics from the audio output
  *
- * @param filepath path to file as a string
+ * The counters are kept by the audio callback without locking, so they are
+ * always collected. The narrator copies them after each prompt and while idle.
+ *
+ * @return Output statistics
  */
-void Narrator::playFile(const string filepath)
+Narrator::OutputStats Narrator::getOutputStats()
 {
-    PlaylistItem pi;
-
-    pi.mIdentifier = filepath;
-    pi.mClass = "file";
-
+    OutputStats value;
     pthread_mutex_lock(narratorMutex);
-    if(nextMessage == NULL)
-        nextMessage = new Message();
-
-    pi.mMessage = nextMessage;
-    nextMessage = NULL;
-    mPlaylist.push(pi);
+    value = mOutputStats;
     pthread_mutex_unlock(narratorMutex);
+    return value;
 }
 
 /**
- * Narrate a number based
+ * Select where audio is played
  *
- * @param number the number to be narrated
+ * @param sink "portaudio", "null", "null-realtime" or "wav:" followed by a file path
+ * @return False if the sink is not recognized
  */
-void Narrator::play(int number)
+bool Narrator::setAudioSink(const string &sink)
 {
-    PlaylistItem pi;
-
+    if(!AudioSink::isValid(sink)) {
+        LOG4CXX_ERROR(narratorLog, "Unknown audio sink: " << sink);
+        return false;
+    }
+
+    pthread_mutex_lock(narratorMutex);
+    mAudioSink = sink;
+    pthread_mutex_unlock(narratorMutex);
+
+    LOG4CXX_DEBUG(narratorLog, "Setting audio sink to: " << sink);
+    return true;
+}
+
+/**
+ * Get the selected audio sink
+ *
+ * @return Sink description
+ */
+string Narrator::getAudioSink()
+{
+    pthread_mutex_lock(narratorMutex);
+    string value = mAudioSink;
+    pthread_mutex_unlock(narratorMutex);
+    return value;
+}
+
+void Narrator::updateOutputStats(AudioSink &sink)
+{
+    OutputStats stats;
+    sink.getStats(stats);
+
+    pthread_mutex_lock(narratorMutex);
+    mOutputStats = stats;
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Adjust the playback volumegain
+ *
+ * @param adjustment +/- volumegain
+ */
+void Narrator::adjustVolumeGain(float adjustment)
+{
+    float value = mVolumeGain + adjustment;
+
+    return setVolumeGain(value);
+}
+
+/**
+ * Get the current playback volumegain
+ *
+ * @return volumegain
+ */
+float Narrator::getVolumeGain()
+{
+    return mVolumeGain;
+}
+
+/**
+ * Set the playback volumegain
+ *
+ * @param value volumegain (between MAX_VOLUMEGAIN and MIN_VOLUMEGAIN)
+ */
+void Narrator::setVolumeGain(float value)
+{
+    if(value <= NARRATOR_MIN_VOLUMEGAIN) value = NARRATOR_MIN_VOLUMEGAIN;
+    if(value >= NARRATOR_MAX_VOLUMEGAIN) value = NARRATOR_MAX_VOLUMEGAIN;
+    mVolumeGain = value;
+
+    LOG4CXX_DEBUG(narratorLog, "Setting volumegain to: " << value);
+    return;
+}
+
+/**
+ * Adjust the playback tempo
+ *
+ * @param adjustment +/- tempo
+ */
+void Narrator::adjustTempo(float adjustment)
+{
+    float value = mTempo + adjustment;
+
+    return setTempo(value);
+}
+
+/**
+ * Get the current playback tempo
+ *
+ * @return tempo
+ */
+float Narrator::getTempo()
+{
+    return mTempo;
+}
+
+/**
+ * Set the playback tempo
+ *
+ * @param value tempo (between NARRATOR_MAX_TEMPO and NARRATOR_MIN_TEMPO)
+ */
+void Narrator::setTempo(float value)
+{
+    if(value <= NARRATOR_MIN_TEMPO) value = NARRATOR_MIN_TEMPO;
+    if(value >= NARRATOR_MAX_TEMPO) value = NARRATOR_MAX_TEMPO;
+    mTempo = value;
+
+    LOG4CXX_DEBUG(narratorLog, "Setting tempo to: " << value);
+    return;
+}
+
+/**
+ * Adjust the playback pitch
+ *
+ * @param adjustment +/- pitch
+ */
+void Narrator::adjustPitch(float adjustment)
+{
+    float value = mPitch + adjustment;
+
+    return setPitch(value);
+}
+
+/**
+ * Get the current playback pitch
+ *
+ * @return pitch
+ */
+float Narrator::getPitch()
+{
+    return mPitch;
+}
+
+/**
+ * Set the playback pitch
+ *
+ * @param value pitch (between MAX_PITCH and MIN_PITCH)
+ */
+void Narrator::setPitch(float value)
+{
+    if(value <= NARRATOR_MIN_PITCH) value = NARRATOR_MIN_PITCH;
+    if(value >= NARRATOR_MAX_PITCH) value = NARRATOR_MAX_PITCH;
+    mPitch = value;
+
+    LOG4CXX_DEBUG(narratorLog, "Setting pitch to: " << value);
+    return;
+}
+
+/**
+ * Emitt the audio-finished-playing signal
+ */
+void Narrator::audioFinishedPlaying()
+{
+    if(bPushCommandFinished) {
+        Event event;
+        event.type = EVENT_AUDIO_FINISHED;
+        queueEvent(event);
+    }
+}
+
+/**
+ * Setup the playback thread
+ *
+ * @return False if it failed, true otherwise.
+ */
+bool Narrator::setupThread() {
+    LOG4CXX_INFO(narratorLog, "Setting up playback thread");
+    if(pthread_create(&playbackThread, NULL, narrator_thread, this)) {
+        usleep(500000);
+        return false;
+    }
+
+    LOG4CXX_INFO(narratorLog, "Setting up resolver thread");
+    if(pthread_create(&mResolverThread, NULL, resolver_thread, this)) {
+        usleep(500000);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Set integer parameter value for an audio prompt
+ *
+ * @param key Name of the parameter
+ * @param value Value for the parameter
+ */
+void Narrator::setParameter(const string &key, int value)
+{
+    LOG4CXX_DEBUG(narratorLog, "Got parameter: " << key << ", with value: " << value);
+    MessageParameter mp(key);
+    mp.setIntValue(value);
+
+    pthread_mutex_lock(narratorMutex);
+    if(!nextMessage)
+        nextMessage.reset(new Message());
+    nextMessage->addParameter(mp);
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Set string parameter value for an audio prompt
+ *
+ * @param key Name of the parameter
+ * @param value Value for the parameter
+ */
+void Narrator::setParameter(const string &key, const string &value)
+{
+    LOG4CXX_DEBUG(narratorLog, "Got parameter: " << key << ", with value: " << value);
+
+    pthread_mutex_lock(narratorMutex);
+    if(!nextMessage)
+        nextMessage.reset(new Message());
+    nextMessage->setParameterValue(key, value);
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Add a prompt onto queue of files to be played if action is CLEAR remove items from playlist and stop playback of the current item
+ *
+ * @param identifier Identifier of the audio prompt
+ * @return Id of the item
+ */
+Narrator::ItemId Narrator::play(const char *identifier)
+{
+    PlaylistItem pi;
+
+    pi.mIdentifier = identifier;
+    pi.mClass = "prompt";
+
+    pthread_mutex_lock(narratorMutex);
+    pi.mMessage = std::move(nextMessage);
+    pthread_mutex_unlock(narratorMutex);
+
+    return queueItem(pi);
+}
+
+/**
+ * Narrate a file source from a given path
+ *
+ * @param filepath path to file as a string
+ * @return Id of the item
+ */
+Narrator::ItemId Narrator::playFile(const string filepath)
+{
+    PlaylistItem pi;
+
+    pi.mIdentifier = filepath;
+    pi.mClass = "file";
+
+    pthread_mutex_lock(narratorMutex);
+    pi.mMessage = std::move(nextMessage);
+    pthread_mutex_unlock(narratorMutex);
+
+    return queueItem(pi);
+}
+
+/**
+ * Narrate a number based
+ *
+ * @param number the number to be narrated
+ * @return Id of the item
+ */
+Narrator::ItemId Narrator::play(int number)
+{
+    PlaylistItem pi;
+
     setParameter("number", number);
     pi.mIdentifier = "{number}";
     pi.mClass = "number";
 
     pthread_mutex_lock(narratorMutex);
-    if(nextMessage == NULL)
-        nextMessage = new Message();
-
-    pi.mMessage = nextMessage;
-    nextMessage = NULL;
-    mPlaylist.push(pi);
+    pi.mMessage = std::move(nextMessage);
     pthread_mutex_unlock(narratorMutex);
+
+    return queueItem(pi);
 }
 
 /**
@@ -632,19 +1455,16 @@ void Narrator::play(int number)
  *
  * @param str Identifier of the prompt
  * @param cls Prompt type
- *
+ * @return Id of the item
  */
-void Narrator::playResource(string str, string cls)
+Narrator::ItemId Narrator::playResource(string str, string cls)
 {
     PlaylistItem pi;
 
     pi.mIdentifier = str;
     pi.mClass = cls;
 
-    pthread_mutex_lock(narratorMutex);
-    pi.mMessage = new Message();
-    mPlaylist.push(pi);
-    pthread_mutex_unlock(narratorMutex);
+    return queueItem(pi);
 }
 
 /**
@@ -653,8 +1473,9 @@ void Narrator::playResource(string str, string cls)
  * @param hours Number of hours
  * @param minutes Number of minutes
  * @param seconds Number of seconds
+ * @return Id of the item
  */
-void Narrator::playDuration(int hours, int minutes, int seconds)
+Narrator::ItemId Narrator::playDuration(int hours, int minutes, int seconds)
 {
     //printf("%02d:%02d:%02d\n", hours, minutes, seconds);
     long long totalSeconds = 0;
@@ -667,78 +1488,91 @@ void Narrator::playDuration(int hours, int minutes, int seconds)
     seconds = (int)floor((totalSeconds - (hours * 60 * 60) - (minutes * 60)));
     //printf("Duration: %02d:%02d:%02d\n", hours, minutes, seconds);
 
+    // Queued as one batch so the parts stay together
+    Batch batch;
+    batch.bOneItem = true;
+
     if(hours > 0) {
         if(hours == 1) {
-            play(_N("one hour"));
+            batch.play(_N("one hour"));
         } else {
-            setParameter("2", hours);
-            play(_N("{2} hours"));
+            batch.setParameter("2", hours);
+            batch.play(_N("{2} hours"));
         }
-        if(minutes != 0 || seconds != 0) play(_N("and"));
+        if(minutes != 0 || seconds != 0) batch.play(_N("and"));
     }
 
     if(minutes > 0) {
         if(minutes == 1) {
-            play(_N("one minute"));
+            batch.play(_N("one minute"));
         } else {
-            setParameter("2", minutes);
-            play(_N("{2} minutes"));
+            batch.setParameter("2", minutes);
+            batch.play(_N("{2} minutes"));
         }
-        if(seconds != 0) play(_N("and"));
+        if(seconds != 0) batch.play(_N("and"));
     }
 
     if(seconds > 0) {
         if(seconds == 1) {
-            play(_N("one second"));
+            batch.play(_N("one second"));
         } else {
-            setParameter("2", seconds);
-            play(_N("{2} seconds"));
+            batch.setParameter("2", seconds);
+            batch.play(_N("{2} seconds"));
         }
     }
 
     // If the duration is zero say it
     if(hours == 0 && minutes == 0 && seconds == 0) {
-        setParameter("2", 0);
-        play(_N("{2} seconds"));
+        batch.setParameter("2", 0);
+        batch.play(_N("{2} seconds"));
     }
+
+    return queueOneItem(batch);
 }
 
 /**
  * Narrate a duration
  *
  * @param seconds duration in seconds
+ * @return Id of the item
  */
-void Narrator::playDuration(long seconds)
+Narrator::ItemId Narrator::playDuration(long seconds)
 {
     //printf("Duration in seconds %lld\n", seconds);
     int h = (int)floor(seconds / 60 / 60);
     int m = (int)floor((seconds - (h * 60 * 60)) / 60);
     int s = (int)floor((seconds - (h * 60 * 60) - (m * 60)));
-    playDuration(h, m, s);
+    return playDuration(h, m, s);
 }
 
 /**
  * Keep a long pause
+ *
+ * @return Id of the item
  */
-void Narrator::playLongpause()
+Narrator::ItemId Narrator::playLongpause()
 {
-    play(_N("longpause"));
+    return play(_N("longpause"));
 }
 
 /**
  * Keep a short pause
+ *
+ * @return Id of the item
  */
-void Narrator::playShortpause()
+Narrator::ItemId Narrator::playShortpause()
 {
-    play(_N("shortpause"));
+    return play(_N("shortpause"));
 }
 
 /**
  * Play wait jingle
+ *
+ * @return Id of the item
  */
-void Narrator::playWait()
+Narrator::ItemId Narrator::playWait()
 {
-    play(_N("wait"));
+    return play(_N("wait"));
 }
 
 /**
@@ -748,13 +1582,19 @@ void Narrator::playWait()
  * letters: a-z and A-Z
  * numbers: 0-9
  * symbols: ! # % * + , - . / : ; ? @ _ ~
+ *
+ * @return Id of the item
  */
-void Narrator::spell(string word)
+Narrator::ItemId Narrator::spell(string word)
 {
     // transform each character to upper case
     std::transform(word.begin(), word.end(), word.begin(), ::toupper);
     LOG4CXX_DEBUG(narratorLog, "spelling word '" << word << "'");
 
+    // Queued as one batch so the characters stay together
+    Batch batch;
+    batch.bOneItem = true;
+
     string::iterator it;
     for (it=word.begin(); it<word.end(); it++)
     {
@@ -768,21 +1608,21 @@ void Narrator::spell(string word)
         if(c >= 48 && c <= 57)
         {
             int number = atoi(&c);
-            play(number);
+            batch.play(number);
             LOG4CXX_DEBUG(narratorLog, "number '" << number << "'");
         }
         // char is a letter in range A-Z
         else if(c >= 65 && c <= 90)
         {
             LOG4CXX_DEBUG(narratorLog, "letter '" << c << "'");
-            playResource(s, "letter");
+            batch.playResource(s, "letter");
         }
         else
         {
             switch(c)
             {
                 case 32: // space
-                    playShortpause();
+                    batch.play(_N("shortpause"));
                     break;
                 case 33: // !
                 case 35: // #
@@ -800,7 +1640,7 @@ void Narrator::spell(string word)
                 case 95: // _
                 case 126: // ~
                     LOG4CXX_DEBUG(narratorLog, "symbol '" << c << "'");
-                    playResource(s, "symbol");
+                    batch.playResource(s, "symbol");
                     break;
                 default:
                     LOG4CXX_WARN(narratorLog, "character not supported");
@@ -808,6 +1648,8 @@ void Narrator::spell(string word)
             }
         }
     }
+
+    return queueOneItem(batch);
 }
 
 /**
@@ -816,8 +1658,9 @@ void Narrator::spell(string word)
  * @param day Day of the month
  * @param month Month of the year
  * @param year Year
+ * @return Id of the item
  */
-void Narrator::playDate(int day, int month, int year)
+Narrator::ItemId Narrator::playDate(int day, int month, int year)
 {
     //printf("%02d-%02d-%04d\n", day, month, year);
 
@@ -828,16 +1671,20 @@ void Narrator::playDate(int day, int month, int year)
     if(year < 0) year = 0;
     if(year > 3000) year = 3000;
 
-    setParameter("date", day);
-    setParameter("month", month);
-    setParameter("year", year);
-    setParameter("yearnum", year);
+    // Parameters of their own, so that another thread setting parameters meanwhile is not mixed in
+    Batch batch;
+    batch.bOneItem = true;
+    batch.setParameter("date", day);
+    batch.setParameter("month", month);
+    batch.setParameter("year", year);
+    batch.setParameter("yearnum", year);
 
     // Calculate the day this date occurred (http://users.aol.com/s6sj7gt/mikecal.htm)
     int daynum = (day+=month<3?year--:year-2,23*month/9+day+4+year/4-year/100+year/400)%7;
-    setParameter("dayname", daynum);
+    batch.setParameter("dayname", daynum);
 
-    play(_N("{dayname} {date} of {month} {year} {yearnum}"));
+    batch.play(_N("{dayname} {date} of {month} {year} {yearnum}"));
+    return queueOneItem(batch);
 }
 
 /**
@@ -846,8 +1693,9 @@ void Narrator::playDate(int day, int month, int year)
  * @param hour Hour of the day
  * @param minute Minute of the hour
  * @param second Second of the minute
+ * @return Id of the item
  */
-void Narrator::playTime(int hour, int minute, int second)
+Narrator::ItemId Narrator::playTime(int hour, int minute, int second)
 {
     //printf("%02d:%02d:%02d\n", hour, minute, second);
     int hour12;
@@ -865,53 +1713,1128 @@ void Narrator::playTime(int hour, int minute, int second)
     if(second < 0) second = 0;
     if(second > 59) second = 59;
 
-    setParameter("minute", minute);
-    setParameter("second", second);
-    setParameter("hour", hour);
-    setParameter("hour12", hour12);
+    // Parameters of their own, so that another thread setting parameters meanwhile is not mixed in
+    Batch batch;
+    batch.bOneItem = true;
+    batch.setParameter("minute", minute);
+    batch.setParameter("second", second);
+    batch.setParameter("hour", hour);
+    batch.setParameter("hour12", hour12);
     if(isAm)
-        setParameter("ampm", "am");
+        batch.setParameter("ampm", "am");
     else
-        setParameter("ampm", "pm");
+        batch.setParameter("ampm", "pm");
 
-    play(_N("{hour} {hour12} {minute} {second} {ampm}"));
+    batch.play(_N("{hour} {hour12} {minute} {second} {ampm}"));
+    return queueOneItem(batch);
 }
 
 /**
- * Force narrator to stop speaking
+ * Start rendering prompts on the calling thread
+ *
+ * Prompts queued from this thread are kept until endRender is called, prompts
+ * queued from other threads are played as usual.
+ *
+ * @return False if another thread is already rendering
  */
-void Narrator::stop()
+bool Narrator::beginRender()
 {
-    pthread_mutex_lock (narratorMutex);
-    // Clear the list
-    while(!mPlaylist.empty()) {
-        //LOG4CXX_DEBUG(narratorLog, "Removing :'" << mPlaylist.front());
-        delete(mPlaylist.front().mMessage);
-        mPlaylist.pop();
-    }
-    pthread_mutex_unlock (narratorMutex);
-
-    // Tell the playbackthread to stop playing
+    bool started = false;
     pthread_mutex_lock(narratorMutex);
-    bResetFlag = true;
+    if(!bRendering) {
+        // Producers check the flag without locking, so the thread must be set first
+        mRenderThread = pthread_self();
+        bRendering = true;
+        started = true;
+    }
     pthread_mutex_unlock(narratorMutex);
+
+    if(!started) LOG4CXX_WARN(narratorLog, "Narrator is already rendering");
+    return started;
 }
 
 /**
- * Setter for narrator state
+ * Render the prompts queued since beginRender into memory
  *
- * @param state A narrator thread state
+ * Audio with another rate than the first prompt is resampled to its rate.
+ *
+ * @param samples receives the interleaved samples
+ * @param rate receives the sample rate
+ * @param channels receives the number of channels
+ * @return False if rendering was not started from this thread
  */
-void Narrator::setState(Narrator::threadState state)
+bool Narrator::endRender(vector<float> &samples, long &rate, int &channels)
+{
+    MemorySink sink;
+    if(!render(sink)) return false;
+
+    samples.swap(sink.getSamples());
+    rate = sink.getRate();
+    channels = sink.getRate() != 0 ? sink.getChannels() : OUTPUT_CHANNELS;
+    return true;
+}
+
+/**
+ * Render the prompts queued since beginRender to an Ogg Vorbis file
+ *
+ * Audio with another rate than the first prompt is resampled to its rate.
+ *
+ * @param path file to write
+ * @return False if rendering was not started from this thread or the file could not be written
+ */
+bool Narrator::endRender(const string &path)
+{
+    OggFileSink sink(path);
+    if(!render(sink)) return false;
+
+    if(sink.getRate() == 0) {
+        LOG4CXX_WARN(narratorLog, "Nothing rendered to '" << path << "'");
+        return false;
+    }
+    return sink.close();
+}
+
+/**
+ * Queue an item for playback, or for rendering if called from the rendering thread.
+ * Never waits for the playback thread, if the playlist is full the item is dropped
+ *
+ * @param pi item to queue, moved into the queue
+ * @return Id of the item, 0 if it was dropped
+ */
+Narrator::ItemId Narrator::queueItem(PlaylistItem &pi)
+{
+    if(!pi.mMessage) pi.mMessage.reset(new Message());
+    if(pi.mId == 0) pi.mId = nextItemId();
+    ItemId id = pi.mId;
+
+    if(bRendering && pthread_equal(mRenderThread, pthread_self())) {
+        mRenderlist.push(std::move(pi));
+        return id;
+    }
+
+    // The other voices have a playlist each, without priorities
+    if(threadVoice != 0) {
+        pi.mQueuedus = nowus();
+        vector < std::shared_ptr<ItemReport> > reports;
+        prepareReports(&pi, 1, reports);
+
+        Voice *voice = startVoice(threadVoice);
+        if(voice == NULL) {
+            discardReports(&pi, 1);
+            return 0;
+        }
+
+        pi.mGeneration = voice->mGeneration;
+        pi.mPriority = PRIORITY_NORMAL;
+        pi.bResume = false;
+        std::shared_ptr<Resolution> resolution = prepareLookahead(pi, voice);
+        if(!voice->mPlaylist.push(pi)) {
+            LOG4CXX_WARN(narratorLog, "Playlist of voice " << threadVoice << " full, dropping '" << pi.mIdentifier << "'");
+            discardReports(&pi, 1);
+            return 0;
+        }
+        reportQueued(reports);
+        if(resolution) queueLookahead(&resolution, 1);
+
+        wakeVoice(*voice);
+        return id;
+    }
+
+    pi.mQueuedus = nowus();
+    pi.mGeneration = claimItems(1);
+    pi.mPriority = threadPriority;
+    pi.bResume = threadResume;
+    vector < std::shared_ptr<ItemReport> > reports;
+    prepareReports(&pi, 1, reports);
+    std::shared_ptr<Resolution> resolution = prepareLookahead(pi, NULL);
+    if(!mPlaylist[pi.mPriority]->push(pi)) {
+        LOG4CXX_WARN(narratorLog, "Playlist full, dropping '" << pi.mIdentifier << "'");
+        countItems(pi.mGeneration, -1);
+        discardReports(&pi, 1);
+        return 0;
+    }
+    reportQueued(reports);
+    if(resolution) queueLookahead(&resolution, 1);
+
+    // Raised after the push, so the playback thread finds the item when it sees the request
+    if(threadPreemption == PREEMPT_NOW) {
+        int preempt = mPreemptNow;
+        while(preempt < threadPriority && !mPreemptNow.compare_exchange_weak(preempt, threadPriority));
+    }
+
+    wakeThread();
+    return id;
+}
+
+/**
+ * Queue all items of a batch for playback in one step, or for rendering if called from the rendering thread.
+ * The items claim consecutive positions in the playlist with a single atomic operation however many there are
+ *
+ * @param batch items to queue, emptied if they were queued
+ * @return False if the playlist has no room for all items
+ */
+bool Narrator::queueBatch(Batch &batch)
+{
+    vector <PlaylistItem> &items = batch.mItems;
+    if(items.empty()) return true;
+
+    if(bRendering && pthread_equal(mRenderThread, pthread_self())) {
+        for(size_t i = 0; i < items.size(); i++)
+            mRenderlist.push(std::move(items[i]));
+        batch.clear();
+        return true;
+    }
+
+    // Stamped alike, so a stop() drops either all or none of them
+    long long queuedus = nowus();
+    BoundedQueue <PlaylistItem> *playlist;
+    Voice *voice = NULL;
+    if(threadVoice != 0) {
+        voice = startVoice(threadVoice);
+        if(voice == NULL) return false;
+        playlist = &voice->mPlaylist;
+    } else {
+        playlist = mPlaylist[threadPriority];
+    }
+
+    // The items are counted as queued right away, so that the playback thread does not miss them
+    unsigned int generation = voice != NULL ? voice->mGeneration.load() : claimItems(items.size());
+    vector < std::shared_ptr<Resolution> > resolutions;
+    for(size_t i = 0; i < items.size(); i++) {
+        items[i].mQueuedus = queuedus;
+        items[i].mGeneration = generation;
+        items[i].mPriority = voice != NULL ? PRIORITY_NORMAL : threadPriority;
+        items[i].bResume = voice != NULL ? false : threadResume;
+    }
+    vector < std::shared_ptr<ItemReport> > reports;
+    prepareReports(&items[0], items.size(), reports);
+    for(size_t i = 0; i < items.size(); i++) {
+        std::shared_ptr<Resolution> resolution = prepareLookahead(items[i], voice);
+        if(resolution) resolutions.push_back(resolution);
+    }
+
+    if(!playlist->push(&items[0], items.size())) {
+        LOG4CXX_WARN(narratorLog, "Playlist has no room for " << items.size() << " items, dropping batch starting with '" << items[0].mIdentifier << "'");
+
+        // Left as it was, so that the batch can be queued again with the same ids
+        if(voice == NULL) countItems(generation, -(int) items.size());
+        discardReports(&items[0], items.size());
+        for(size_t i = 0; i < items.size(); i++) {
+            if(!items[i].mResolution) continue;
+            items[i].mMessage = std::move(items[i].mResolution->mMessage);
+            items[i].mResolution.reset();
+        }
+        return false;
+    }
+    reportQueued(reports);
+    batch.clear();
+    if(!resolutions.empty()) queueLookahead(&resolutions[0], resolutions.size());
+
+    if(voice != NULL) {
+        wakeVoice(*voice);
+        return true;
+    }
+
+    if(threadPreemption == PREEMPT_NOW) {
+        int preempt = mPreemptNow;
+        while(preempt < threadPriority && !mPreemptNow.compare_exchange_weak(preempt, threadPriority));
+    }
+
+    wakeThread();
+    return true;
+}
+
+/**
+ * Queue a batch holding the prompts of one item
+ *
+ * @param batch prompts of the item
+ * @return Id of the item, 0 if the batch is empty or did not fit in the playlist
+ */
+Narrator::ItemId Narrator::queueOneItem(Batch &batch)
+{
+    ItemId id = batch.mItems.empty() ? 0 : batch.mItems[0].mId;
+    if(!queueBatch(batch)) return 0;
+    return id;
+}
+
+/**
+ * Number items without an id, and give them a report if item events are connected.
+ * Consecutive prompts with the same id share a report
+ *
+ * @param items items about to be queued
+ * @param count number of items
+ * @param reports filled with the reports, which the items lose when they are moved into the playlist
+ */
+void Narrator::prepareReports(PlaylistItem *items, size_t count, vector < std::shared_ptr<ItemReport> > &reports)
+{
+    for(size_t i = 0; i < count; i++) {
+        if(items[i].mId == 0) items[i].mId = nextItemId();
+        if(!bItemEvents) continue;
+
+        if(i > 0 && items[i].mId == items[i - 1].mId) {
+            items[i].mReport = items[i - 1].mReport;
+        } else {
+            items[i].mReport = std::make_shared<ItemReport>(this, items[i].mId, items[i].mQueuedus);
+            reports.push_back(items[i].mReport);
+        }
+        items[i].mReport->mParts++;
+    }
+}
+
+/**
+ * Report items queued once they are in the playlist. The playback thread may already
+ * have picked them up, then their later stages have reported it first
+ *
+ * @param reports reports from prepareReports
+ */
+void Narrator::reportQueued(const vector < std::shared_ptr<ItemReport> > &reports)
+{
+    for(size_t i = 0; i < reports.size(); i++)
+        reports[i]->report(ITEM_ENQUEUED, reports[i]->mQueuedus);
+}
+
+/**
+ * Drop the reports of items which did not fit in the playlist, without reporting anything
+ *
+ * @param items items from prepareReports
+ * @param count number of items
+ */
+void Narrator::discardReports(PlaylistItem *items, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+        if(!items[i].mReport) continue;
+        items[i].mReport->discard();
+        items[i].mReport.reset();
+    }
+}
+
+/**
+ * Get the stages waiting for the output of a voice
+ *
+ * @param voice the voice, NULL for the speech
+ * @return Stages in the order they were written
+ */
+deque <Narrator::StageMark> &Narrator::stageMarks(Voice *voice)
+{
+    return voice != NULL ? voice->mMarks : mMarks;
+}
+
+/**
+ * Called from the narrator_thread and the voice threads to report the stages the output has played
+ *
+ * @param sink audio sink the stages were written to
+ * @param marks stages waiting for the output
+ * @param settle drop the stages the output has not played, once it has stopped or given up
+ * @return True if no stage is left waiting
+ */
+bool Narrator::reportPlayed(AudioSink &sink, deque <StageMark> &marks, bool settle)
+{
+    while(!marks.empty()) {
+        StageMark &mark = marks.front();
+        long long timeus = 0;
+        int played = sink.getPlayedTime(mark.mPosition, timeus);
+        if(played == 0 && !settle) return false;
+
+        // Sinks which play on write may place the sample before it was written. An item whose
+        // end is dropped reports ITEM_STOPPED once nothing refers to it, one which continues
+        // marks its first sample again
+        if(played > 0) mark.mReport->report(mark.mStage, std::max(timeus, mark.mReport->mWrittenus));
+        else if(mark.mStage == ITEM_AUDIBLE) mark.mReport->bAudibleMarked = false;
+        marks.pop_front();
+    }
+    return true;
+}
+
+Narrator::Batch::Batch():
+    bOneItem(false)
+{
+}
+
+Narrator::Batch::~Batch()
+{
+}
+
+/**
+ * Set integer parameter value for the next prompt in the batch
+ *
+ * @param key Name of the parameter
+ * @param value Value for the parameter
+ */
+void Narrator::Batch::setParameter(const string &key, int value)
+{
+    MessageParameter mp(key);
+    mp.setIntValue(value);
+
+    if(!mNextMessage)
+        mNextMessage.reset(new Message());
+    mNextMessage->addParameter(mp);
+}
+
+/**
+ * Set string parameter value for the next prompt in the batch
+ *
+ * @param key Name of the parameter
+ * @param value Value for the parameter
+ */
+void Narrator::Batch::setParameter(const string &key, const string &value)
+{
+    if(!mNextMessage)
+        mNextMessage.reset(new Message());
+    mNextMessage->setParameterValue(key, value);
+}
+
+/**
+ * Add a prompt to the batch
+ *
+ * @param identifier Identifier of the audio prompt
+ * @return Id of the item
+ */
+Narrator::ItemId Narrator::Batch::play(const char *identifier)
+{
+    return add(identifier, "prompt");
+}
+
+/**
+ * Add a number to the batch
+ *
+ * @param number the number to be narrated
+ * @return Id of the item
+ */
+Narrator::ItemId Narrator::Batch::play(int number)
+{
+    setParameter("number", number);
+    return add("{number}", "number");
+}
+
+/**
+ * Add a file to the batch
+ *
+ * @param filepath path to file as a string
+ * @return Id of the item
+ */
+Narrator::ItemId Narrator::Batch::playFile(const string filepath)
+{
+    return add(filepath, "file");
+}
+
+/**
+ * Add an audio prompt of a given type to the batch
+ *
+ * @param str Identifier of the prompt
+ * @param cls Prompt type
+ * @return Id of the item
+ */
+Narrator::ItemId Narrator::Batch::playResource(string str, string cls)
+{
+    return add(str, cls);
+}
+
+size_t Narrator::Batch::size()
+{
+    return mItems.size();
+}
+
+void Narrator::Batch::clear()
+{
+    mItems.clear();
+    mNextMessage.reset();
+}
+
+Narrator::ItemId Narrator::Batch::add(const string &identifier, const string &cls)
+{
+    PlaylistItem pi;
+    pi.mIdentifier = identifier;
+    pi.mClass = cls;
+    pi.mId = bOneItem && !mItems.empty() ? mItems.back().mId : nextItemId();
+
+    // Allocated here, so that queueing does not have to
+    pi.mMessage = std::move(mNextMessage);
+    if(!pi.mMessage) pi.mMessage.reset(new Message());
+
+    mItems.push_back(std::move(pi));
+    return mItems.back().mId;
+}
+
+/**
+ * Wake the playback thread if it is sleeping in waitForWork
+ */
+void Narrator::wakeThread()
+{
+    // Pairs with the fence in waitForWork, either the thread sees the change or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(bSleeping) {
+        pthread_mutex_lock(narratorMutex);
+        pthread_cond_signal(&mWorkCond);
+        pthread_mutex_unlock(narratorMutex);
+    }
+}
+
+/**
+ * Look up the audio of a message in the database
+ *
+ * @param m message to look up, holding its parameters
+ * @param lang language to look up prompts in
+ * @param identifier identifier of the prompt
+ * @param cls prompt type
+ * @param audio receives the audio to play
+ */
+static void resolveMessage(Message *m, const string &lang, const string &identifier, const string &cls, vector <MessageAudio> &audio)
+{
+    if(m == NULL) {
+        LOG4CXX_ERROR(narratorLog, "Message was null");
+        return;
+    }
+
+    m->setLanguage(lang);
+    m->load(identifier, cls);
+
+    if(!m->compile() || !m->hasAudio()) {
+        LOG4CXX_ERROR(narratorLog, "Narrator translation not found: could not find audio for '" << identifier << "'");
+    } else {
+        audio = m->getAudioQueue();
+    }
+}
+
+/**
+ * Called when queueing a prompt to hand its message over to the resolver thread
+ *
+ * @param pi item about to be queued, stamped with its generation
+ * @param voice the voice it is queued for, NULL for the speech
+ * @return The resolution to pass to queueLookahead once the item is queued, empty if it is looked up when played
+ */
+std::shared_ptr<Narrator::Resolution> Narrator::prepareLookahead(PlaylistItem &pi, Voice *voice)
+{
+    if(mLookahead == 0 || pi.mClass == "file" || !pi.mMessage) return std::shared_ptr<Resolution>();
+
+    pi.mResolution = std::make_shared<Resolution>(this, voice, pi);
+    return pi.mResolution;
+}
+
+/**
+ * Hand queued prompts to the resolver thread, in the order they will be played
+ *
+ * @param resolutions prompts from prepareLookahead
+ * @param count number of prompts
+ */
+void Narrator::queueLookahead(std::shared_ptr<Resolution> *resolutions, size_t count)
+{
+    // If the resolver has fallen this far behind the playback thread looks them up itself
+    if(!mResolveQueue->push(resolutions, count)) {
+        LOG4CXX_DEBUG(narratorLog, "Resolver queue full, " << count << " prompts are looked up when played");
+        return;
+    }
+    wakeResolver();
+}
+
+/**
+ * Called from the resolver_thread to look up a prompt ahead of playback
+ *
+ * @param resolution prompt to look up
+ */
+void Narrator::resolve(Resolution &resolution)
+{
+    // Items dropped by a stop are not worth looking up
+    unsigned int generation = resolution.mVoice != NULL ? resolution.mVoice->mGeneration.load() : this->generation();
+    if(resolution.mGeneration != generation) return;
+
+    // The playback thread may already have taken it
+    int state = Resolution::QUEUED;
+    if(!resolution.mState.compare_exchange_strong(state, Resolution::RESOLVING)) return;
+
+    pthread_mutex_lock(narratorMutex);
+    resolution.mLanguage = mLanguage;
+    pthread_mutex_unlock(narratorMutex);
+
+    resolveMessage(resolution.mMessage.get(), resolution.mLanguage, resolution.mIdentifier, resolution.mClass, resolution.mAudio);
+    resolution.mMessage.reset();
+    resolution.mResolvedus = nowus();
+
+    mResolvedAhead++;
+    resolution.mState = Resolution::DONE;
+
+    pthread_mutex_lock(narratorMutex);
+    pthread_cond_broadcast(&mResolvedCond);
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Called from the narrator_thread and the voice threads to get the audio of a prompt handed to the resolver thread.
+ * Looks it up right away if the resolver has not got to it yet
+ *
+ * @param pi item being played
+ * @param lang language to look up prompts in
+ * @param audio receives the audio to play
+ */
+long long Narrator::takeResolution(PlaylistItem &pi, const string &lang, vector <MessageAudio> &audio)
+{
+    Resolution &resolution = *pi.mResolution;
+    long long resolvedus;
+
+    int state = Resolution::QUEUED;
+    if(resolution.mState.compare_exchange_strong(state, Resolution::TAKEN)) {
+        LOG4CXX_DEBUG(narratorLog, "'" << pi.mIdentifier << "' was not looked up ahead");
+        resolveMessage(resolution.mMessage.get(), lang, pi.mIdentifier, pi.mClass, audio);
+        resolvedus = nowus();
+    } else {
+        pthread_mutex_lock(narratorMutex);
+        while(resolution.mState == Resolution::RESOLVING)
+            pthread_cond_wait(&mResolvedCond, narratorMutex);
+        pthread_mutex_unlock(narratorMutex);
+        audio.swap(resolution.mAudio);
+        resolvedus = resolution.mResolvedus;
+    }
+
+    pi.mResolution.reset();
+    return resolvedus;
+}
+
+/**
+ * Called from the resolver_thread to sleep until there is a prompt to look up and room to look it up
+ */
+void Narrator::waitForResolve()
+{
+    pthread_mutex_lock(narratorMutex);
+    bResolverSleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while((mResolveQueue->size() == 0 || mResolvedAhead >= mLookahead) && mState != EXIT)
+        pthread_cond_wait(&mResolveCond, narratorMutex);
+    bResolverSleeping = false;
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Wake the resolver thread if it is sleeping in waitForResolve
+ */
+void Narrator::wakeResolver()
+{
+    // Pairs with the fence in waitForResolve like wakeThread
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(bResolverSleeping) {
+        pthread_mutex_lock(narratorMutex);
+        pthread_cond_signal(&mResolveCond);
+        pthread_mutex_unlock(narratorMutex);
+    }
+}
+
+/**
+ * Called from the narrator_thread to take the next item to play. The state turns
+ * PLAY before the item leaves the count, so isSpeaking() stays true in between
+ *
+ * @param pi receives the item
+ * @return False if there is no item, or it is still being queued
+ */
+bool Narrator::nextItem(PlaylistItem &pi)
+{
+    // Requests to preempt are settled by picking the highest priority below,
+    // cleared first so that one arriving meanwhile is kept
+    mPreemptNow = -1;
+
+    dropStaleItems();
+    unsigned int generation = this->generation();
+    int resume = mInterrupted.empty() ? -1 : mInterrupted.back().mPriority;
+
+    for(int priority = PRIORITY_URGENT; priority >= PRIORITY_NORMAL; priority--) {
+        // An interrupted item continues before the items queued after it
+        if(priority == resume) {
+            pi = std::move(mInterrupted.back());
+            mInterrupted.pop_back();
+            setState(PLAY);
+            countItems(pi.mGeneration, -1);
+            return true;
+        }
+
+        // Only the playback thread may pop, so stop() leaves old items for it to drop.
+        // Most are gone already, these were queued behind a newer item
+        while(mPlaylist[priority]->pop(pi)) {
+            if(pi.mGeneration == generation) {
+                setState(PLAY);
+                countItems(generation, -1);
+                return true;
+            }
+            LOG4CXX_DEBUG(narratorLog, "Dropping '" << pi.mIdentifier << "' queued before stop");
+        }
+    }
+    return false;
+}
+
+/**
+ * Called from the narrator_thread to drop the items left from before a stop(), up to the
+ * first newer item in each playlist. They are no longer counted, but would take up room
+ */
+void Narrator::dropStaleItems()
+{
+    bDropStale = false;
+    unsigned int generation = this->generation();
+
+    while(!mInterrupted.empty() && mInterrupted.back().mGeneration != generation) {
+        LOG4CXX_DEBUG(narratorLog, "Dropping interrupted '" << mInterrupted.back().mIdentifier << "' after stop");
+        mInterrupted.pop_back();
+    }
+
+    for(int priority = PRIORITY_NORMAL; priority <= PRIORITY_URGENT; priority++) {
+        PlaylistItem *front;
+        while((front = mPlaylist[priority]->front()) != NULL && front->mGeneration != generation) {
+            LOG4CXX_DEBUG(narratorLog, "Dropping '" << front->mIdentifier << "' queued before stop");
+            PlaylistItem pi;
+            mPlaylist[priority]->pop(pi);
+        }
+    }
+}
+
+/**
+ * Get the current generation of the playlist
+ *
+ * @return Generation stamped on items queued now
+ */
+unsigned int Narrator::generation()
+{
+    return mGeneration.load() >> 32;
+}
+
+/**
+ * Count items about to be queued
+ *
+ * @param count number of items
+ * @return Generation to stamp them with
+ */
+unsigned int Narrator::claimItems(size_t count)
+{
+    return mGeneration.fetch_add(count) >> 32;
+}
+
+/**
+ * Change the number of queued items of a generation, items from before the last stop() are not counted
+ *
+ * @param generation generation of the items
+ * @param count items added, negative if removed
+ */
+void Narrator::countItems(unsigned int generation, int count)
+{
+    unsigned long long value = mGeneration.load();
+    while((value >> 32) == generation && !mGeneration.compare_exchange_weak(value, value + count));
+}
+
+/**
+ * Called from the narrator_thread while playing an item to see if a higher priority is waiting
+ *
+ * @param pi item being played
+ * @param now only count items which interrupt right away
+ * @return True if the item should give way
+ */
+bool Narrator::isPreempted(const PlaylistItem &pi, bool now)
+{
+    if(now) return mPreemptNow > pi.mPriority;
+
+    for(int priority = pi.mPriority + 1; priority <= PRIORITY_URGENT; priority++)
+        if(mPlaylist[priority]->size() > 0) return true;
+    return false;
+}
+
+/**
+ * Called from the narrator_thread to sleep until there is something to do
+ *
+ * @param timeoutms longest time to wait, negative waits until woken
+ * @param wakeOnStop also return when stop() has been called, items left from before it wake the thread anyway
+ * @return False if the time ran out
+ */
+bool Narrator::waitForWork(long timeoutms, bool wakeOnStop)
+{
+    struct timespec deadline;
+    if(timeoutms >= 0) {
+#ifdef _WIN32
+        clock_gettime(CLOCK_REALTIME, &deadline);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+#endif
+        deadline.tv_sec += timeoutms / 1000;
+        deadline.tv_nsec += (timeoutms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    bool woken = true;
+    pthread_mutex_lock(narratorMutex);
+    bSleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // While idle the other voices are mixed here too, unless the sink is mixing them already
+    while(numPlaylistItems() == 0 && mState != EXIT && !bDropStale && !(wakeOnStop && bResetFlag) && (wakeOnStop || bMixing || !mMixer->hasWork())) {
+        if(timeoutms < 0) {
+            pthread_cond_wait(&mWorkCond, narratorMutex);
+        } else if(pthread_cond_timedwait(&mWorkCond, narratorMutex, &deadline) == ETIMEDOUT) {
+            woken = false;
+            break;
+        }
+    }
+    bSleeping = false;
+    pthread_mutex_unlock(narratorMutex);
+    return woken;
+}
+
+/**
+ * Decode the items queued for rendering into a sink on the calling thread
+ *
+ * @param sink audio sink to write to
+ * @return False if rendering was not started from this thread
+ */
+bool Narrator::render(AudioSink &sink)
+{
+    queue <PlaylistItem> items;
+
+    pthread_mutex_lock(narratorMutex);
+    if(!bRendering || !pthread_equal(mRenderThread, pthread_self())) {
+        pthread_mutex_unlock(narratorMutex);
+        LOG4CXX_ERROR(narratorLog, "endRender called without beginRender");
+        return false;
+    }
+    bRendering = false;
+    items.swap(mRenderlist);
+    string lang = mLanguage;
+    pthread_mutex_unlock(narratorMutex);
+
+    LOG4CXX_DEBUG(narratorLog, "Rendering " << items.size() << " item(s)");
+
+    // A fresh filter picks up the current gain, tempo and pitch like the playback thread does
+    float gain = 0;
+    float tempo = 0;
+    float pitch = 0;
+    Filter filter;
+    ChannelConverter converter;
+
+    while(!items.empty()) {
+        playItem(this, items.front(), lang, sink, filter, converter, gain, tempo, pitch, false, NULL);
+        items.pop();
+    }
+
+    sink.endOfData();
+    return true;
+}
+
+/**
+ * Force narrator to stop speaking
+ */
+void Narrator::stop()
+{
+    // Clear the list, queued items are no longer counted and are dropped by the playbackthread
+    unsigned long long value = mGeneration.load();
+    while(!mGeneration.compare_exchange_weak(value, ((value >> 32) + 1) << 32));
+    bDropStale = true;
+
+    // Tell the playbackthread to stop playing, the output silences
+    // buffered audio right away instead of waiting for the thread
+    bResetFlag = true;
+    pthread_mutex_lock(narratorMutex);
+    if(mSink != NULL) mSink->requestStop();
+    pthread_mutex_unlock(narratorMutex);
+
+    wakeThread();
+}
+
+/**
+ * Set the priority of prompts queued from the calling thread
+ *
+ * @param priority playlist priority
+ * @param preemption when the prompts interrupt prompts of a lower priority
+ * @param resume if the prompts continue after being interrupted
+ */
+void Narrator::setPriority(Narrator::Priority priority, Narrator::Preemption preemption, bool resume)
+{
+    threadPriority = priority;
+    threadPreemption = preemption;
+    threadResume = resume;
+}
+
+/**
+ * Get the priority of prompts queued from the calling thread
+ *
+ * @return Playlist priority
+ */
+Narrator::Priority Narrator::getPriority()
+{
+    return threadPriority;
+}
+
+/**
+ * Select the voice prompts queued from the calling thread are played on
+ *
+ * @param voice voice number, 0 is the speech
+ */
+void Narrator::setVoice(int voice)
+{
+    if(voice < 0 || voice >= NARRATOR_VOICES) {
+        LOG4CXX_WARN(narratorLog, "No voice " << voice << ", using the speech");
+        voice = 0;
+    }
+    threadVoice = voice;
+}
+
+/**
+ * Get the voice prompts queued from the calling thread are played on
+ *
+ * @return Voice number
+ */
+int Narrator::getVoice()
+{
+    return threadVoice;
+}
+
+/**
+ * Set the gain of a voice
+ *
+ * @param voice voice number
+ * @param gain new gain, 0 mutes the voice
+ */
+void Narrator::setVoiceGain(int voice, float gain)
+{
+    if(voice == 0) return setVolumeGain(gain);
+    if(voice < 0 || voice >= NARRATOR_VOICES) return;
+
+    if(gain <= 0) gain = 0;
+    if(gain >= NARRATOR_MAX_VOLUMEGAIN) gain = NARRATOR_MAX_VOLUMEGAIN;
+    mMixer->getInput(voice - 1)->setGain(gain);
+
+    LOG4CXX_DEBUG(narratorLog, "Setting gain of voice " << voice << " to: " << gain);
+}
+
+/**
+ * Get the gain of a voice
+ *
+ * @param voice voice number
+ * @return Current gain
+ */
+float Narrator::getVoiceGain(int voice)
+{
+    if(voice == 0) return getVolumeGain();
+    if(voice < 0 || voice >= NARRATOR_VOICES) return 0;
+    return mMixer->getInput(voice - 1)->getGain();
+}
+
+/**
+ * Set the tempo of a voice
+ *
+ * @param voice voice number
+ * @param tempo new tempo
+ */
+void Narrator::setVoiceTempo(int voice, float tempo)
+{
+    if(voice == 0) return setTempo(tempo);
+    if(voice < 0 || voice >= NARRATOR_VOICES) return;
+
+    if(tempo <= NARRATOR_MIN_TEMPO) tempo = NARRATOR_MIN_TEMPO;
+    if(tempo >= NARRATOR_MAX_TEMPO) tempo = NARRATOR_MAX_TEMPO;
+    Voice *v = startVoice(voice);
+    if(v == NULL) return;
+    v->mTempo = tempo;
+
+    LOG4CXX_DEBUG(narratorLog, "Setting tempo of voice " << voice << " to: " << tempo);
+}
+
+/**
+ * Get the tempo of a voice
+ *
+ * @param voice voice number
+ * @return Current tempo
+ */
+float Narrator::getVoiceTempo(int voice)
+{
+    if(voice == 0) return getTempo();
+    if(voice < 0 || voice >= NARRATOR_VOICES) return 0;
+
+    Voice *v = mVoices[voice];
+    return v != NULL ? v->mTempo.load() : 1.0;
+}
+
+/**
+ * Stop a voice and drop the prompts queued for it
+ *
+ * @param voice voice number
+ */
+void Narrator::stopVoice(int voice)
 {
+    if(voice == 0) return stop();
+    if(voice < 0 || voice >= NARRATOR_VOICES) return;
+
+    Voice *v = mVoices[voice];
+    if(v == NULL) return;
+
+    // Queued items are dropped by the voice thread, the mixer
+    // drops what has been decoded without waiting for it
+    v->mGeneration++;
+    v->bResetFlag = true;
+    v->mInput->requestStop();
+
+    // The playback thread mixes while idle too
+    wakeThread();
+}
+
+/**
+ * Check if a voice has prompts playing or queued
+ *
+ * @param voice voice number
+ * @return True if the voice is playing
+ */
+bool Narrator::isVoicePlaying(int voice)
+{
+    if(voice == 0) return isSpeaking();
+    if(voice < 0 || voice >= NARRATOR_VOICES) return false;
+
+    Voice *v = mVoices[voice];
+    if(v == NULL) return false;
+    return v->bPlaying || v->mPlaylist.size() > 0 || v->mInput->getRemainingms() > 0;
+}
+
+/**
+ * Get a voice, starting its thread the first time
+ *
+ * @param index voice number, not 0
+ * @return The voice, NULL if its thread could not be started
+ */
+Narrator::Voice *Narrator::startVoice(int index)
+{
+    Voice *voice = mVoices[index];
+    if(voice != NULL) return voice;
 
     pthread_mutex_lock(narratorMutex);
-    if(mState == Narrator::EXIT) {
-        LOG4CXX_INFO(narratorLog, "Narrator in state:" << getState_str(mState) << ", not changing to state: " << getState_str(state));
+    voice = mVoices[index];
+    if(voice == NULL) {
+        LOG4CXX_INFO(narratorLog, "Setting up playback thread for voice " << index);
+        voice = new Voice(this, index, mMixer->getInput(index - 1));
+        if(pthread_create(&voice->mThread, NULL, voice_thread, voice)) {
+            LOG4CXX_ERROR(narratorLog, "Failed to initialize thread for voice " << index);
+            delete voice;
+            voice = NULL;
+        } else {
+            mVoices[index] = voice;
+        }
     }
-    else
-        mState = state;
     pthread_mutex_unlock(narratorMutex);
+
+    return voice;
+}
+
+/**
+ * Wake the thread of a voice if it is sleeping in waitForVoice
+ */
+void Narrator::wakeVoice(Voice &voice)
+{
+    // Pairs with the fence in waitForVoice like wakeThread
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(voice.bSleeping) {
+        pthread_mutex_lock(narratorMutex);
+        pthread_cond_signal(&voice.mCond);
+        pthread_mutex_unlock(narratorMutex);
+    }
+}
+
+/**
+ * Called from a voice thread to sleep until something is queued for the voice
+ */
+void Narrator::waitForVoice(Voice &voice)
+{
+    pthread_mutex_lock(narratorMutex);
+    voice.bSleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while(voice.mPlaylist.size() == 0 && mState != EXIT)
+        pthread_cond_wait(&voice.mCond, narratorMutex);
+    voice.bSleeping = false;
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Called from a voice thread to take the next item to play
+ *
+ * @param voice the voice
+ * @param pi receives the item
+ * @return False if there is no item
+ */
+bool Narrator::nextVoiceItem(Voice &voice, PlaylistItem &pi)
+{
+    while(voice.mPlaylist.pop(pi)) {
+        if(pi.mGeneration == voice.mGeneration) return true;
+        LOG4CXX_DEBUG(narratorLog, "Dropping '" << pi.mIdentifier << "' queued for voice " << voice.mIndex << " before stop");
+    }
+    return false;
+}
+
+/**
+ * Called from the narrator_thread while no speech is queued to play the other voices
+ *
+ * @param sink audio sink to write to
+ * @return False if the voices had nothing to play
+ */
+bool Narrator::mixVoices(AudioSink &sink)
+{
+    if(!mMixer->hasWork()) return false;
+
+    float buffer[BUFFERSIZE * OUTPUT_CHANNELS];
+
+    // Keep the rate the output is open with, the voices are resampled to it
+    if(sink.getRate() == 0 && !sink.open(mMixer->getRate(), OUTPUT_CHANNELS)) {
+        LOG4CXX_ERROR(narratorLog, "error initializing audio sink for the voices, (rate: " << mMixer->getRate() << " channels: " << OUTPUT_CHANNELS << ")");
+        while(mMixer->mix(buffer, BUFFERSIZE * OUTPUT_CHANNELS) > 0);
+        return false;
+    }
+    mMixer->setRate(sink.getRate());
+
+    // The sink mixes the voices as it plays, it only has to be kept running until they are done
+    if(bOutputMixes) {
+        bMixing = true;
+        while(numPlaylistItems() == 0 && mState != EXIT && mMixer->hasWork()) {
+            sink.endOfData();
+            waitForWork(sink.getBufferms(), false);
+            if(bDropStale) dropStaleItems();
+        }
+        bMixing = false;
+        return true;
+    }
+
+    bool written = false;
+    while(numPlaylistItems() == 0 && mState != EXIT && mMixer->hasWork()) {
+        unsigned int samples = sink.getWriteAvailable() / OUTPUT_CHANNELS;
+        if(samples > BUFFERSIZE) samples = BUFFERSIZE;
+
+        memset(buffer, 0, samples * OUTPUT_CHANNELS * sizeof(float));
+        mMixer->setLatency(sink.getRemainingms());
+        samples = mMixer->mix(buffer, samples * OUTPUT_CHANNELS) / OUTPUT_CHANNELS;
+        if(samples == 0) continue;
+
+        LOG4CXX_TRACE(narratorLog, "write " << samples << " mixed samples to audio system");
+        sink.write(buffer, samples);
+        written = true;
+    }
+
+    // Play the end even if it is shorter than what the output buffers before starting
+    if(written) sink.endOfData();
+    return true;
+}
+
+/**
+ * Called while writing to check if live playback of the speech or a voice should go on
+ *
+ * @param voice the voice, NULL for the speech
+ * @return False when stopped
+ */
+bool Narrator::isPlaying(Voice *voice)
+{
+    // The other voices play whatever the speech is doing
+    if(voice != NULL) return getState() != EXIT && !voice->bResetFlag;
+    return getState() == PLAY;
+}
+
+/**
+ * Setter for narrator state
+ *
+ * @param state A narrator thread state
+ */
+void Narrator::setState(Narrator::threadState state)
+{
+    // EXIT is final, so only replace other states
+    Narrator::threadState current = mState;
+    while(current != Narrator::EXIT && !mState.compare_exchange_weak(current, state));
+
+    if(current == Narrator::EXIT)
+        LOG4CXX_INFO(narratorLog, "Narrator in state:" << getState_str(current) << ", not changing to state: " << getState_str(state));
 }
 
 /**
@@ -921,12 +2844,7 @@ void Narrator::setState(Narrator::threadState state)
  */
 Narrator::threadState Narrator::getState()
 {
-    Narrator::threadState state;
-    pthread_mutex_lock(narratorMutex);
-    state = mState;
-    pthread_mutex_unlock(narratorMutex);
-
-    return state;
+    return mState;
 }
 
 /**
@@ -936,9 +2854,13 @@ Narrator::threadState Narrator::getState()
  */
 bool Narrator::isSpeaking()
 {
+    // Read in the order the playback thread changes them the other way round, it turns PLAY
+    // before taking an item and counts AudioFinished before leaving PLAY
+    if(numPlaylistItems() > 0) return true;
     Narrator::threadState state = getState();
 
-    if(state == Narrator::PLAY || mPlaylist.size() > 0) return true;
+    // The slots see a narrator still speaking, like when they were called from the playback thread
+    if(state == Narrator::PLAY || mFinishedPending > 0) return true;
     else return false;
 }
 
@@ -969,95 +2891,715 @@ string Narrator::getState_str(Narrator::threadState state)
         case Narrator::EXIT: return "Narrator::EXIT";
     }
 
-    return "UNKNOWN";
+    return "UNKNOWN";
+}
+
+/**
+ * Getter for the number of items the narrator has left to narrate
+ *
+ * @returns How many items the narrator has left to narrate
+ */
+int Narrator::numPlaylistItems()
+{
+    return mGeneration.load() & 0xffffffff;
+}
+
+/*! \cond PRIVATE */
+
+/**
+ * Called from the narrator_thread and the voice threads to adjust playback parameters.
+ *
+ * @param n reference to the narrator to adjust
+ * @param filter audio filter
+ * @param gain new gain
+ * @param tempo new tempo
+ * @param pitch new pitch
+ * @param voice the voice, NULL for the speech
+ */
+void adjustGainTempoPitch(Narrator* n, Filter& filter, float& gain, float& tempo, float& pitch, Narrator::Voice* voice)
+{
+    // The other voices are scaled by the mixer and resampled to the rate it mixes at
+    if(voice != NULL) filter.setOutputRate(n->mMixer->getRate());
+
+    // Called for every block, so the values are read without locking
+    float value = voice != NULL ? 1.0f : n->mVolumeGain.load();
+    if(gain != value) {
+        gain = value;
+        LOG4CXX_DEBUG(narratorLog, "Setting gain(" << gain << ")");
+        filter.setGain(gain);
+    }
+
+    value = voice != NULL ? voice->mTempo.load() : n->mTempo.load();
+    if(tempo != value) {
+        tempo = value;
+        LOG4CXX_DEBUG(narratorLog, "Setting tempo(" << tempo << ")");
+        filter.setTempo(tempo);
+    }
+
+    value = voice != NULL ? 1.0f : n->mPitch.load();
+    if(pitch != value) {
+        pitch = value;
+        LOG4CXX_DEBUG(narratorLog, "Setting pitch(" << pitch << ")");
+        filter.setPitch(pitch);
+    }
+}
+
+/**
+ * Set the signal slot for when playback has finished
+ *
+ * @param slot A slot which should be called when audio has finished
+ */
+boost::signals2::connection Narrator::connectAudioFinished(const AudioFinishedSlotType &slot)
+{
+    startDispatcher();
+    return m_signal_audio_finished.connect(slot);
+}
+
+/**
+ * Connect a slot to the stages of the items queued from now on
+ *
+ * @param slot called with each stage an item reaches
+ * @return Connection of the slot
+ */
+boost::signals2::connection Narrator::connectItemEvent(const ItemEventSlotType &slot)
+{
+    startDispatcher();
+    bItemEvents = true;
+    return m_signal_item_event.connect(slot);
+}
+
+void Narrator::itemEvent(ItemId item, ItemStage stage, long long timeus)
+{
+    Event event;
+    event.type = EVENT_ITEM;
+    event.item.item = item;
+    event.item.stage = stage;
+    event.item.timeus = timeus;
+    queueEvent(event);
+}
+
+void Narrator::speakingEvent(bool speaking)
+{
+    Event event;
+    event.type = EVENT_STATE;
+    event.speaking = speaking;
+    queueEvent(event);
+}
+
+/**
+ * Merge events the slots have fallen behind on
+ *
+ * @param coalesce True to merge, false to deliver every event
+ */
+void Narrator::setCoalesceEvents(bool coalesce)
+{
+    bCoalesceEvents = coalesce;
+}
+
+/**
+ * Check if events the slots have fallen behind on are merged
+ *
+ * @return True if merged
+ */
+bool Narrator::getCoalesceEvents()
+{
+    return bCoalesceEvents;
+}
+
+/**
+ * Start the dispatcher thread unless it is running
+ */
+void Narrator::startDispatcher()
+{
+    if(bDispatcherStarted) return;
+
+    pthread_mutex_lock(narratorMutex);
+    if(!bDispatcherStarted && mState != EXIT) {
+        LOG4CXX_INFO(narratorLog, "Setting up dispatcher thread");
+        if(pthread_create(&mDispatcherThread, NULL, dispatcher_thread, this) == 0)
+            bDispatcherStarted = true;
+        else
+            LOG4CXX_ERROR(narratorLog, "Failed to initialize dispatcher thread");
+    }
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Make the event descriptor readable
+ *
+ * @param fd eventfd or the writing end of the pipe
+ */
+static void signalDescriptor(int fd)
+{
+#ifdef __linux__
+    eventfd_write(fd, 1);
+#elif !defined(_WIN32)
+    char c = 0;
+    if(write(fd, &c, 1) < 0 && errno != EAGAIN) LOG4CXX_WARN(narratorLog, "Failed to signal event descriptor");
+#endif
+}
+
+/**
+ * Queue an event for the dispatcher thread and pollEvents, never waits for them. Without connected slots
+ * or an event descriptor the event is dropped
+ *
+ * @param event event to deliver
+ */
+void Narrator::queueEvent(Event &event)
+{
+    bool slots = bDispatcherStarted && event.type != EVENT_STATE;
+    bool polled = mEventFd >= 0;
+    if(!slots && !polled) return;
+
+    event.timeus = nowus();
+
+    if(polled) {
+        if(!bPollOverflow && mPollQueue->push(event)) {
+            // A state queued after one kept from an overflow is the latest, both come from the playback thread
+            if(event.type == EVENT_STATE) mPollState = -1;
+        } else {
+            // Nothing is queued until the next poll, so the queued events all come before the dropped ones.
+            // The state and AudioFinished are kept for it
+            if(event.type == EVENT_STATE) {
+                mPollStateus = event.timeus;
+                mPollState = event.speaking;
+            } else if(event.type == EVENT_AUDIO_FINISHED) {
+                mPollFinished++;
+            }
+            if(!bPollOverflow.exchange(true))
+                LOG4CXX_WARN(narratorLog, "Poll queue full, dropping events until polled");
+        }
+        // Only the first event after a poll writes, the others find the descriptor readable already
+        if(!bEventSignalled.exchange(true)) signalDescriptor(mEventWriteFd);
+    }
+
+    if(!slots) return;
+
+    // Counted first, so isSpeaking does not turn false before the event is delivered
+    bool finished = (event.type == EVENT_AUDIO_FINISHED);
+    if(finished) mFinishedPending++;
+
+    if(!mEventQueue->push(event)) {
+        // AudioFinished is never dropped, the dispatcher delivers it after the events already queued
+        if(finished) {
+            LOG4CXX_WARN(narratorLog, "Event queue full, delivering AudioFinished after the queued events");
+            mFinishedOverflow++;
+        } else {
+            LOG4CXX_WARN(narratorLog, "Event queue full, dropping event");
+            return;
+        }
+    }
+
+    // Pairs with the fence in waitForEvents like wakeThread
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(bDispatcherSleeping) {
+        pthread_mutex_lock(narratorMutex);
+        pthread_cond_signal(&mEventCond);
+        pthread_mutex_unlock(narratorMutex);
+    }
+}
+
+/**
+ * Called from the dispatcher_thread to sleep until an event is queued
+ */
+void Narrator::waitForEvents()
+{
+    pthread_mutex_lock(narratorMutex);
+    bDispatcherSleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while(mEventQueue->size() == 0 && mFinishedOverflow == 0 && mState != EXIT)
+        pthread_cond_wait(&mEventCond, narratorMutex);
+    bDispatcherSleeping = false;
+    pthread_mutex_unlock(narratorMutex);
+}
+
+/**
+ * Keep only the last of the events of each item, and of the AudioFinished events.
+ * The speaking state is only reported when it changes, so those are all kept
+ *
+ * @param events events in the order they were queued
+ * @param deliver set to false for the events merged into a later one
+ */
+static void coalesceEvents(const vector <Narrator::Event> &events, vector <bool> &deliver)
+{
+    std::set<Narrator::ItemId> items;
+    bool finished = false;
+    for(size_t i = events.size(); i-- > 0; ) {
+        if(events[i].type == Narrator::EVENT_AUDIO_FINISHED) {
+            deliver[i] = !finished;
+            finished = true;
+        } else if(events[i].type == Narrator::EVENT_ITEM) {
+            deliver[i] = items.insert(events[i].item.item).second;
+        }
+    }
+}
+
+/**
+ * Called from the dispatcher_thread to call the slots for the events taken from the queue
+ *
+ * @param events events in the order they were queued
+ */
+void Narrator::dispatchEvents(vector <Event> &events)
+{
+    vector <bool> deliver(events.size(), true);
+    if(bCoalesceEvents) coalesceEvents(events, deliver);
+
+    for(size_t i = 0; i < events.size(); i++) {
+        if(events[i].type == EVENT_AUDIO_FINISHED) {
+            if(deliver[i]) m_signal_audio_finished();
+            mFinishedPending--;
+        } else if(deliver[i]) {
+            m_signal_item_event(events[i].item);
+        }
+    }
+}
+
+/**
+ * Get a descriptor to wait on for pollEvents, created on the first call
+ *
+ * @return Descriptor which polls readable while events wait, -1 on failure
+ */
+int Narrator::getEventDescriptor()
+{
+    if(mEventFd >= 0) return mEventFd;
+
+    pthread_mutex_lock(narratorMutex);
+    if(mEventFd < 0 && mState != EXIT) {
+#ifdef __linux__
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(fd >= 0) {
+            mEventWriteFd = fd;
+            mEventFd = fd;
+        }
+#elif !defined(_WIN32)
+        int fds[2];
+        if(pipe(fds) == 0) {
+            for(int i = 0; i < 2; i++) {
+                fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+            }
+            mEventWriteFd = fds[1];
+            mEventFd = fds[0];
+        }
+#endif
+        if(mEventFd >= 0) {
+            LOG4CXX_INFO(narratorLog, "Created event descriptor " << mEventFd);
+            bItemEvents = true;
+        } else {
+            LOG4CXX_ERROR(narratorLog, "Failed to create event descriptor");
+        }
+    }
+    pthread_mutex_unlock(narratorMutex);
+
+    return mEventFd;
+}
+
+/**
+ * Take the events queued since the last poll, never blocks
+ *
+ * @param events replaced with the events, oldest first
+ * @return Number of events
+ */
+size_t Narrator::pollEvents(vector<Event> &events)
+{
+    events.clear();
+    if(mEventFd < 0) return 0;
+
+    pthread_mutex_lock(&mPollMutex);
+
+    // Cleared before taking the events, so that an event queued meanwhile signals again. Read even
+    // when not signalled, a write racing the previous poll may have left the descriptor readable
+    bEventSignalled = false;
+#ifdef __linux__
+    eventfd_t value;
+    eventfd_read(mEventFd, &value);
+#else
+    char buffer[64];
+    while(read(mEventFd, buffer, sizeof(buffer)) > 0);
+#endif
+
+    // At most a queue full, producers faster than the caller can not keep it here
+    Event event;
+    while(events.size() < mPollQueue->capacity() && mPollQueue->pop(event)) events.push_back(event);
+
+    // Once the queue has been emptied, the events kept from an overflow follow the ones taken
+    if(mPollQueue->size() == 0) {
+        if(bPollOverflow.exchange(false)) {
+            event.type = EVENT_DROPPED;
+            event.timeus = nowus();
+            events.push_back(event);
+        }
+        int finished = mPollFinished.exchange(0);
+        event.type = EVENT_AUDIO_FINISHED;
+        event.timeus = nowus();
+        for(int i = 0; i < finished; i++) events.push_back(event);
+        int state = mPollState.exchange(-1);
+        if(state >= 0) {
+            event.type = EVENT_STATE;
+            event.speaking = state;
+            event.timeus = mPollStateus;
+            events.push_back(event);
+        }
+    }
+
+    // The descriptor stays readable for the ones left
+    if(mPollQueue->size() > 0 && !bEventSignalled.exchange(true)) signalDescriptor(mEventWriteFd);
+
+    pthread_mutex_unlock(&mPollMutex);
+
+    if(bCoalesceEvents && !events.empty()) {
+        vector <bool> deliver(events.size(), true);
+        coalesceEvents(events, deliver);
+        size_t kept = 0;
+        for(size_t i = 0; i < events.size(); i++)
+            if(deliver[i]) events[kept++] = events[i];
+        events.resize(kept);
+    }
+
+    return events.size();
+}
+
+/**
+ * Called from the narrator_thread, the voice threads and when rendering to copy audio data from the filter to the audio sink.
+ * Live playback stops copying when the narrator leaves the PLAY state or the voice is stopped,
+ * live speech has the other voices mixed into it on the way.
+ */
+void writeSamplesToSink( Narrator* n, AudioSink& sink, Filter& filter, float* buffer, bool live, Narrator::Voice* voice, Narrator::ItemReport* report )
+{
+    int outSamples = 0;
+    bool playing = !live || n->isPlaying(voice);
+
+    // The voices follow the rate of the speech, the sink may mix them in itself
+    if(live && voice == NULL) n->mMixer->setRate(sink.getRate());
+    bool mixing = live && voice == NULL && !n->bOutputMixes;
+
+    // See if we have any finished samples
+    // One filter sample contains data from all channels
+    while((outSamples = filter.numSamples()) != 0 && playing) {
+        int available = sink.getWriteAvailable() / sink.getChannels();
+
+        LOG4CXX_TRACE(narratorLog, "got available: " << available << ", outSamples: " << outSamples);
+
+        if(available > outSamples) available = outSamples;
+
+        // Let the filter write straight into the ringbuffer
+        float *data1, *data2;
+        unsigned int samples1, samples2;
+        if(sink.getWriteRegions(available, &data1, &samples1, &data2, &samples2) > 0) {
+            outSamples = filter.read(data1, samples1);
+            if(outSamples == (int)samples1 && samples2 > 0)
+                outSamples += filter.read(data2, samples2);
+
+            if(mixing) {
+                n->mMixer->setLatency(sink.getRemainingms());
+                n->mMixer->mix(data1, min(outSamples, (int)samples1) * sink.getChannels());
+                if(outSamples > (int)samples1)
+                    n->mMixer->mix(data2, (outSamples - samples1) * sink.getChannels());
+            }
+
+            LOG4CXX_TRACE(narratorLog, "write " << outSamples << " samples to audio system");
+            if(report != NULL && outSamples > 0) report->written(sink, live, n->stageMarks(voice));
+            sink.commitWrite(outSamples);
+        }
+        // ..unless a sample is split around the end of the ringbuffer
+        else {
+            if(available > BUFFERSIZE) available = BUFFERSIZE;
+            outSamples = filter.read(buffer, available);
+            if(mixing) {
+                n->mMixer->setLatency(sink.getRemainingms());
+                n->mMixer->mix(buffer, outSamples * sink.getChannels());
+            }
+
+            LOG4CXX_TRACE(narratorLog, "write " << outSamples << " samples to audio system");
+            if(report != NULL && outSamples > 0) report->written(sink, live, n->stageMarks(voice));
+            sink.write(buffer, outSamples);
+        }
+
+        // Let the playback thread mix what the voice has written
+        if(voice != NULL) n->wakeThread();
+
+        if(!live) continue;
+        n->reportPlayed(sink, n->stageMarks(voice), false);
+        playing = n->isPlaying(voice);
+        if(!playing)
+            LOG4CXX_INFO(narratorLog, "Aborting stream");
+    }
 }
 
 /**
- * Getter for the number of items the narrator has left to narrate
- *
- * @returns How many items the narrator has left to narrate
+ * Called while decoding to check if live playback has been stopped, a render always continues.
  */
-int Narrator::numPlaylistItems()
+bool keepPlaying(Narrator* n, bool live, Narrator::Voice* voice)
 {
-    int queueitems = 0;
-    pthread_mutex_lock(narratorMutex);
-    queueitems = mPlaylist.size();
-    pthread_mutex_unlock(narratorMutex);
-    return queueitems;
+    return !live || (n->isPlaying(voice) && (voice != NULL || !n->bResetFlag));
 }
 
-/*! \cond PRIVATE */
-
 /**
- * Called from the narrator_thread to adjust playback parameters.
+ * Called from the narrator_thread, the voice threads and when rendering to decode one playlist item through the filter into the audio sink.
  *
- * @param n reference to the narrator to adjust
+ * Live playback is aborted by stop() and waits for the sink to drain before the rate changes,
+ * a render always decodes everything and skips audio which does not match the rate of the sink.
+ * Live speech also gives way to higher priorities, leaving a resume point in the item if it should continue.
+ *
+ * @param n reference to the narrator
+ * @param pi playlist item to decode or continue, its message is deleted
+ * @param lang language to look up prompts in
+ * @param sink audio sink to write to
  * @param filter audio filter
- * @param gain new gain
- * @param tempo new tempo
- * @param pitch new pitch
+ * @param converter channel converter
+ * @param gain current gain
+ * @param tempo current tempo
+ * @param pitch current pitch
+ * @param live true when called from the narrator_thread or a voice thread
+ * @param voice the voice to play, NULL for the speech
  */
-void adjustGainTempoPitch(Narrator* n, Filter& filter, float& gain, float& tempo, float& pitch)
+void playItem(Narrator* n, Narrator::PlaylistItem& pi, const string& lang, AudioSink& sink, Filter& filter,
+        ChannelConverter& converter, float& gain, float& tempo, float& pitch, bool live, Narrator::Voice* voice)
 {
-    pthread_mutex_lock(n->narratorMutex);
-    if(gain != n->mVolumeGain) {
-        gain = n->mVolumeGain;
-        LOG4CXX_DEBUG(narratorLog, "Setting gain(" << gain << ")");
-        filter.setGain(gain);
+    vector <MessageAudio> vAudioQueue;
+    bool isFile = (pi.mClass == "file");
+    size_t firstClip = 0;
+    long resumeFrame = 0;
+    AudioStream *resumeStream = NULL;
+
+    // An interrupted item continues with the audio it already had
+    if(pi.mResume) {
+        LOG4CXX_DEBUG(narratorLog, "Resuming '" << pi.mIdentifier << "' at clip " << pi.mResume->mClip << ", frame " << pi.mResume->mFrame);
+        vAudioQueue.swap(pi.mResume->mAudio);
+        firstClip = pi.mResume->mClip;
+        resumeFrame = pi.mResume->mFrame;
+        resumeStream = pi.mResume->mStream;
+        pi.mResume->mStream = NULL;
+        pi.mResume.reset();
     }
 
-    if(tempo != n->mTempo) {
-        tempo = n->mTempo;
-        LOG4CXX_DEBUG(narratorLog, "Setting tempo(" << tempo << ")");
-        filter.setTempo(tempo);
+    // If trying to play a file, open it
+    else if(isFile) {
+        LOG4CXX_DEBUG(narratorLog, "Playing file: " << pi.mIdentifier);
     }
 
-    if(pitch != n->mPitch) {
-        pitch = n->mPitch;
-        LOG4CXX_DEBUG(narratorLog, "Setting pitch(" << pitch << ")");
-        filter.setPitch(pitch);
+    // Else get a list of MessageAudio objects to play, looked up ahead by the resolver thread..
+    else if(pi.mResolution) {
+        long long resolvedus = n->takeResolution(pi, lang, vAudioQueue);
+        if(pi.mReport && !vAudioQueue.empty()) pi.mReport->report(Narrator::ITEM_RESOLVED, resolvedus);
     }
-    pthread_mutex_unlock(n->narratorMutex);
-}
 
-/**
- * Set the signal slot for when playback has finished
- *
- * @param slot A slot which should be called when audio has finished
- */
-boost::signals2::connection Narrator::connectAudioFinished(const AudioFinishedSlotType &slot)
-{
-    return m_signal_audio_finished.connect(slot);
-}
+    // ..or from the database now
+    else {
+        resolveMessage(pi.mMessage.get(), lang, pi.mIdentifier, pi.mClass, vAudioQueue);
+        if(pi.mReport && !vAudioQueue.empty()) pi.mReport->report(Narrator::ITEM_RESOLVED, nowus());
+    }
 
-/**
- * Called from the narrator_thread to copy audio data from the filter to portaudio.
- */
-void writeSamplesToPortaudio( Narrator* n, PortAudio& portaudio, Filter& filter, float* buffer )
-{
-    int outSamples = 0;
-    Narrator::threadState state = n->getState();
+    //Cleanup message object
+    pi.mMessage.reset();
 
-    // See if we have any finished samples
-    // One filter sample contains data from all channels
-    while((outSamples = filter.numSamples()) != 0 && state == Narrator::PLAY) {
-        int available = portaudio.getWriteAvailable() / portaudio.getChannels();
+    if(!isFile && vAudioQueue.size() <= firstClip) return;
 
-        LOG4CXX_TRACE(narratorLog, "got available: " << available << ", outSamples: " << outSamples);
+    vector <MessageAudio>::iterator audio = vAudioQueue.begin() + firstClip;
+    bool clipPlayed = false;
+    do {
+        clipPlayed = false;
+        AudioStream *audioStream = resumeStream;
+        bool resumed = (resumeStream != NULL);
+        resumeStream = NULL;
 
-        if(available > outSamples) available = outSamples;
+        std::string encoding = isFile ? getFileExtension(pi.mIdentifier) : audio->getEncoding();
+        if(!isFile) LOG4CXX_INFO(narratorLog, "Saying: " << audio->getText());
+
+        if (resumed)
+        {
+            // Already open where the clip was cut off
+        }
+        else if (encoding == "ogg")
+        {
+            audioStream = new OggStream;
+        }
+        else if (encoding == "mp3")
+        {
+            audioStream = new Mp3Stream;
+        }
+        else
+        {
+            LOG4CXX_ERROR(narratorLog, (isFile ? "extension '" : "encoding '") << encoding << "' not supported");
+            if(isFile) break;
+            audio++;
+            continue;
+        }
 
-        if(available > BUFFERSIZE) available = BUFFERSIZE;
-        outSamples = filter.read(buffer, available);
+        if(pi.mReport) pi.mReport->report(Narrator::ITEM_DECODE_STARTED, nowus());
 
-        LOG4CXX_TRACE(narratorLog, "write " << outSamples << " samples to audio system");
+        if(!resumed && (isFile ? !audioStream->open(pi.mIdentifier) : !audioStream->open(*audio))) {
+            LOG4CXX_ERROR(narratorLog, "error opening audio stream: " << (isFile ? pi.mIdentifier : audio->getText()));
+            audioStream->close();
+            delete audioStream;
+            break;
+        }
 
-        state = n->getState();
-        if(state != Narrator::PLAY)
-            LOG4CXX_INFO(narratorLog, "Aborting stream");
+        // The other voices are resampled by the filter, so only the speech changes the rate
+        long outputRate = audioStream->getRate();
+        if (sink.getRate() != audioStream->getRate() && voice == NULL)
+        {
+            // A render can not wait for the rate to change, so it keeps the rate of the first clip
+            // and resamples the others in the filter like the voices
+            if (!live && sink.getRate() != 0)
+            {
+                LOG4CXX_DEBUG(narratorLog, "Resampling audio with rate " << audioStream->getRate() << " Hz to " << sink.getRate() << " Hz");
+                outputRate = sink.getRate();
+            }
+            else
+            {
+                sink.endOfData();
+                long waitms = sink.getRemainingms();
+                if (waitms != 0)
+                {
+                    LOG4CXX_DEBUG(narratorLog, "Waiting for current playback to finish");
+                    sink.waitForPlayback(waitms + 1000);
+                }
+                n->reportPlayed(sink, n->stageMarks(voice), false);
+            }
+        }
 
-        portaudio.write(buffer, outSamples);
-    }
+        if(!sink.open(outputRate, OUTPUT_CHANNELS)) {
+            LOG4CXX_ERROR(narratorLog, "error initializing audio sink, (rate: " << outputRate << " channels: " << OUTPUT_CHANNELS << ")");
+            audioStream->close();
+            delete audioStream;
+            break;
+        }
+
+        if(voice == NULL) filter.setOutputRate(outputRate);
+        if(!filter.open(audioStream->getRate(), OUTPUT_CHANNELS)) {
+            LOG4CXX_ERROR(narratorLog, "error initializing filter");
+            audioStream->close();
+            delete audioStream;
+            break;
+        }
+
+        if(!converter.open(audioStream->getChannels(), OUTPUT_CHANNELS)) {
+            LOG4CXX_ERROR(narratorLog, "error initializing channel converter");
+            audioStream->close();
+            delete audioStream;
+            break;
+        }
+
+        LOG4CXX_DEBUG(narratorLog, "Audio stream has " << audioStream->getChannels() << " channel(s) and rate " << audioStream->getRate() << " Hz");
+
+        // Skip leading and trailing silence, audio which has not been
+        // analyzed yet is scanned while it is played
+        bool trimmed = isFile || audio->isTrimmed();
+        bool scan = !trimmed;
+        long position = 0;
+        long trimEnd = isFile ? 0 : audio->getTrimEnd();
+        long fadeFrames = 0;
+        long faded = 0;
+        SilenceDetector detector;
+        if(resumeFrame > 0 && audioStream->seek(resumeFrame)) {
+            // A clip which was cut off continues with a short fade in, its start
+            // is not scanned again so no range can be stored
+            position = resumeFrame;
+            fadeFrames = audioStream->getRate() * RESUME_FADE_MS / 1000;
+            scan = false;
+        } else if(!trimmed) {
+            detector.reset(audioStream->getRate(), audioStream->getChannels());
+        } else if(!isFile && audio->getTrimStart() > 0 && audioStream->seek(audio->getTrimStart())) {
+            position = audio->getTrimStart();
+        }
+        long clipStart = position;
+        resumeFrame = 0;
+        bool interrupted = false;
+
+        int inSamples = 0;
+        // The buffer is also used for filter output, so make room for both layouts
+        soundtouch::SAMPLETYPE* buffer = scratchBuffer(max((int)audioStream->getChannels(), OUTPUT_CHANNELS)*BUFFERSIZE);
+
+        do {
+            // change gain, tempo and pitch
+            adjustGainTempoPitch(n, filter, gain, tempo, pitch, voice);
+
+            // read some stuff from the audio stream
+            int frames = BUFFERSIZE;
+            if(trimmed && !isFile && trimEnd - position < frames) frames = trimEnd - position;
+
+            inSamples = 0;
+            if(frames > 0) inSamples = audioStream->read(buffer, frames);
+            if(inSamples > 0) position += inSamples;
+            LOG4CXX_TRACE(narratorLog, "got " << inSamples << " samples");
+
+            if(inSamples != 0) {
+                if(scan) detector.process(buffer, inSamples);
+                for(long i = 0; faded < fadeFrames && i < inSamples; i++, faded++) {
+                    float fade = (float) (faded + 1) / fadeFrames;
+                    for(int c = 0; c < audioStream->getChannels(); c++) buffer[i * audioStream->getChannels() + c] *= fade;
+                }
+                filter.write(converter.convert(buffer, inSamples), inSamples); // One sample contains data for all channels here
+                writeSamplesToSink( n, sink, filter, buffer, live, voice, pi.mReport.get() );
+            } else {
+                // Write the tail now, not when the next clip starts
+                LOG4CXX_INFO(narratorLog, "Flushing soundtouch buffer");
+                filter.flush();
+                writeSamplesToSink( n, sink, filter, buffer, live, voice, pi.mReport.get() );
+            }
+
+            // Give way right away to a higher priority
+            if(live && voice == NULL && inSamples != 0 && n->isPreempted(pi, true)) {
+                interrupted = true;
+                break;
+            }
+
+        } while (inSamples != 0 && keepPlaying(n, live, voice));
+        clipPlayed = (inSamples == 0);
+
+        if(interrupted) {
+            // Estimate where the listener is, the output still holds what the filter has produced
+            double unheard = (filter.numSamples() + (double) sink.getRemainingms() * sink.getRate() / 1000) * tempo
+                + filter.numUnprocessedSamples();
+            long frame = position - (long) unheard;
+
+            LOG4CXX_INFO(narratorLog, "Interrupting '" << pi.mIdentifier << "' for a higher priority");
+            sink.drop();
+            n->reportPlayed(sink, n->stageMarks(voice), true);
+            filter.clear();
+
+            if(pi.bResume && keepPlaying(n, live, voice)) {
+                // Keep the open stream unless the clip starts over anyway
+                if(frame <= clipStart) frame = 0;
+                pi.mResume.reset(new Narrator::ResumePoint(vAudioQueue, audio - vAudioQueue.begin(), frame,
+                            frame > 0 ? audioStream : NULL));
+                if(frame > 0) audioStream = NULL;
+            }
+        }
+
+        if(audioStream != NULL) {
+            audioStream->close();
+            delete audioStream;
+        }
+
+        // Store the audible range if the whole clip was scanned, the write runs on the
+        // database thread and is dropped if its queue is full since the next play scans again
+        long trimStart;
+        if(scan && inSamples == 0 && detector.getRange(trimStart, trimEnd)) {
+            long audioid = audio->getAudioid();
+            n->queueDatabaseJob([audioid, trimStart, trimEnd]() {
+                    MessageHandler mh;
+                    return mh.updateAudioTrim(audioid, trimStart, trimEnd) != -1;
+                    }, Narrator::DatabaseCallback(), false);
+        }
+
+        if(interrupted || isFile) break;
+        audio++;
+
+        // Give way to a higher priority between clips, the current clip plays to the end
+        if(live && voice == NULL && audio != vAudioQueue.end() && keepPlaying(n, live, voice) && n->isPreempted(pi, false)) {
+            LOG4CXX_INFO(narratorLog, "Pausing '" << pi.mIdentifier << "' for a higher priority");
+            if(pi.bResume)
+                pi.mResume.reset(new Narrator::ResumePoint(vAudioQueue, audio - vAudioQueue.begin(), 0, NULL));
+            break;
+        }
+
+    } while(audio != vAudioQueue.end() && keepPlaying(n, live, voice));
+
+    // Counted as played once the last clip has been written to the end
+    if(pi.mReport && clipPlayed && (isFile || audio == vAudioQueue.end()))
+        pi.mReport->played(sink, live, n->stageMarks(voice));
 }
 
 /**
@@ -1076,267 +3618,344 @@ void *narrator_thread(void *narrator)
     float tempo = 0;
     float pitch = 0;
 
-    PortAudio portaudio;
+    string sinkName = n->getAudioSink();
+    AudioSink *sink = AudioSink::create(sinkName);
+    n->bOutputMixes = sink->setMixer(n->mMixer);
     Filter filter;
+    ChannelConverter converter;
+    scratchBuffer(OUTPUT_CHANNELS * BUFFERSIZE);
+
+    pthread_mutex_lock(n->narratorMutex);
+    n->mSink = sink;
+    pthread_mutex_unlock(n->narratorMutex);
 
     Narrator::threadState state = n->getState();
+    bool speaking = false;
     LOG4CXX_INFO(narratorLog, "Starting playback thread");
 
     do {
         queueitems = n->numPlaylistItems();
 
         if(queueitems == 0) {
+            // Everything is written, make sure the tail gets played
+            sink->endOfData();
+            n->updateOutputStats(*sink);
+
             // Wait a little before calling callback
-            long waitms = portaudio.getRemainingms();
-            if(waitms != 0) {
+            long waitms = sink->getRemainingms();
+            bool played = n->reportPlayed(*sink, n->mMarks, false);
+            if(waitms != 0 || !played) {
                 LOG4CXX_DEBUG(narratorLog, "Waiting " << waitms << " ms for playback to finish");
-                while(waitms > 0 && queueitems == 0) {
-                    usleep(100000);
-                    queueitems = n->numPlaylistItems();
-                    waitms -= 100;
+
+                // Sleep until the tail has played unless new items or a stop arrive,
+                // give up if playback does not progress. Stages waiting for the output
+                // are checked once per device buffer, the remaining time is rounded
+                // down so it may read 0 before the last sample has played
+                long timeoutms = waitms + 1000;
+                while(timeoutms > 0) {
+                    if(!played && (waitms == 0 || waitms > sink->getBufferms())) waitms = sink->getBufferms();
+                    if(waitms <= 0 || n->waitForWork(waitms, true)) break;
+                    timeoutms -= waitms;
+                    waitms = sink->getRemainingms();
+                    played = n->reportPlayed(*sink, n->mMarks, false);
                 }
+                queueitems = n->numPlaylistItems();
             }
 
             // Break if we during the pause got some more queued items to play
             if(queueitems == 0) {
+                // What the output has not played by now is not going to be
+                n->reportPlayed(*sink, n->mMarks, true);
                 if(state != Narrator::DEAD)
                     n->audioFinishedPlaying();
                 n->setState(Narrator::WAIT);
                 LOG4CXX_INFO(narratorLog, "Narrator in WAIT state");
-                portaudio.stop();
+                if(speaking) {
+                    speaking = false;
+                    n->speakingEvent(false);
+                }
 
+                // Keep the stream running on silence for a while in standby
+                long standbyms = n->getStandbyTime();
+                sink->setStandby(standbyms > 0);
+                if(standbyms > 0)
+                    LOG4CXX_DEBUG(narratorLog, "Keeping audio output in standby for " << standbyms << " ms");
+                else
+                    sink->stop();
+
+                // Sleep until something is queued, waking once more when standby ends
                 while(queueitems == 0) {
                     state = n->getState();
                     if(state == Narrator::EXIT) break;
 
-                    usleep(10000);
+                    // Play the other voices meanwhile, the output stops again after standby
+                    if(n->mixVoices(*sink)) {
+                        standbyms = n->getStandbyTime() + max(sink->getRemainingms(), n->mMixer->getRemainingms());
+                        if(standbyms <= 0) standbyms = 1;
+                        queueitems = n->numPlaylistItems();
+                        continue;
+                    }
+
+                    if(standbyms > 0) {
+                        if(!n->waitForWork(standbyms, false)) {
+                            LOG4CXX_DEBUG(narratorLog, "Standby time passed, stopping audio output");
+                            sink->stop();
+                            n->updateOutputStats(*sink);
+                            standbyms = 0;
+                        }
+                    } else {
+                        n->waitForWork(-1, false);
+                    }
+
+                    // A stop while idle leaves nothing to play, but its items would take up room
+                    if(n->bDropStale) n->dropStaleItems();
                     queueitems = n->numPlaylistItems();
                 }
             }
             LOG4CXX_INFO(narratorLog, "Narrator starting playback");
         }
 
-        if(state == Narrator::EXIT) break;
+        // A new sink takes effect before the next prompt
+        if(n->getAudioSink() != sinkName) {
+            AudioSink *newSink = AudioSink::create(n->getAudioSink());
+            if(newSink != NULL) {
+                LOG4CXX_INFO(narratorLog, "Switching audio sink to " << n->getAudioSink());
+                pthread_mutex_lock(n->narratorMutex);
+                n->mSink = newSink;
+                pthread_mutex_unlock(n->narratorMutex);
+                sink->close();
+                n->reportPlayed(*sink, n->mMarks, true);
+                delete sink;
+                sink = newSink;
+                n->bOutputMixes = sink->setMixer(n->mMixer);
+            }
+            sinkName = n->getAudioSink();
+        }
 
-        n->setState(Narrator::PLAY);
-        n->bResetFlag = false;
+        // A new profile takes effect when the stream is opened for the next prompt
+        sink->setLatencyProfile(n->getLatencyProfile());
 
+        if(state == Narrator::EXIT) break;
+
+        // Nothing to play if everything was queued before a stop, or the
+        // next item is still being queued
         Narrator::PlaylistItem pi;
+        if(!n->nextItem(pi)) continue;
 
-        pthread_mutex_lock(n->narratorMutex);
-        if(n->mPlaylist.size() > 0) {
-            pi = n->mPlaylist.front();
-            n->mPlaylist.pop();
-        } else {
-            LOG4CXX_ERROR(narratorLog, "Narrator started playback thread without playlistitems");
-            pthread_mutex_unlock(n->narratorMutex);
-            continue;
+        if(!speaking) {
+            speaking = true;
+            n->speakingEvent(true);
+        }
+
+        // A stop while idle has already silenced the output, let it start over.
+        // A stream kept in standby only drops what is left so it does not have to be restarted
+        if(n->bResetFlag) {
+            n->bResetFlag = false;
+            if(sink->getStandby()) sink->drop();
+            else sink->stop();
+            n->reportPlayed(*sink, n->mMarks, true);
         }
+
+        pthread_mutex_lock(n->narratorMutex);
         string lang = n->mLanguage;
         pthread_mutex_unlock(n->narratorMutex);
 
-        // If trying to play a file, open it
-        if(pi.mClass == "file") {
-            LOG4CXX_DEBUG(narratorLog, "Playing file: " << pi.mIdentifier);
+        LOG4CXX_DEBUG(narratorLog, "Starting '" << pi.mIdentifier << "' " << (nowus() - pi.mQueuedus) << " us after it was queued");
+        playItem(n, pi, lang, *sink, filter, converter, gain, tempo, pitch, true, NULL);
+        n->updateOutputStats(*sink);
+        state = n->getState();
 
-            AudioStream *audioStream;
+        // Continue an interrupted item once the higher priorities have been played
+        if(pi.mResume) {
+            n->countItems(pi.mGeneration, 1);
+            n->mInterrupted.push_back(std::move(pi));
+        }
 
-            std::string fileExtension = getFileExtension(pi.mIdentifier);
-            if (fileExtension == "ogg")
-            {
-                audioStream = new OggStream;
-            }
-            else if (fileExtension == "mp3")
-            {
-                audioStream = new Mp3Stream;
-            }
-            else
-            {
-                LOG4CXX_ERROR(narratorLog, "extension '" << fileExtension << "' not supported");
-                continue;
-            }
+        // Abort stream?
+        if(n->bResetFlag) {
+            n->bResetFlag = false;
+            if(sink->getStandby()) sink->drop();
+            else sink->stop();
+            n->reportPlayed(*sink, n->mMarks, true);
+            filter.clear();
+        }
 
-            if(!audioStream->open(pi.mIdentifier)) {
-                LOG4CXX_ERROR(narratorLog, "error opening audio stream: " << pi.mIdentifier);
-                audioStream->close();
-                continue;
-            }
+    } while(state != Narrator::EXIT);
 
-            if (portaudio.getRate() != audioStream->getRate())
-            {
-                long waitms = portaudio.getRemainingms();
-                if (waitms != 0)
-                {
-                    LOG4CXX_DEBUG(narratorLog, "Waiting for current playback to finish");
-                    while (waitms > 0)
-                    {
-                        usleep(100000);
-                        waitms -= 100;
-                    }
-                }
-            }
+    LOG4CXX_INFO(narratorLog, "Shutting down playbackthread");
 
-            if(!portaudio.open(audioStream->getRate(), audioStream->getChannels())) {
-                LOG4CXX_ERROR(narratorLog, "error initializing portaudio, (rate: " << audioStream->getRate() << " channels: " << audioStream->getChannels() << ")");
-                continue;
-            }
+    pthread_mutex_lock(n->narratorMutex);
+    n->mSink = NULL;
+    pthread_mutex_unlock(n->narratorMutex);
+    sink->close();
+    delete sink;
 
-            if(!filter.open(audioStream->getRate(), audioStream->getChannels())) {
-                LOG4CXX_ERROR(narratorLog, "error initializing filter");
-                continue;
-            }
+    pthread_exit(NULL);
+    return NULL;
+}
+
+/**
+ * The thread playing a voice other than the speech
+ * \internal
+ */
+void *voice_thread(void *voice)
+{
+    Narrator::Voice *v = (Narrator::Voice*)voice;
+    Narrator *n = v->mNarrator;
 
-            LOG4CXX_DEBUG(narratorLog, "Audio stream has " << audioStream->getChannels() << " channel(s) and rate " << audioStream->getRate() << " Hz");
+    // Set initial values to 0 so that they get updated for the first item
+    float gain = 0;
+    float tempo = 0;
+    float pitch = 0;
 
-            int inSamples = 0;
-            soundtouch::SAMPLETYPE* buffer = new soundtouch::SAMPLETYPE[audioStream->getChannels()*BUFFERSIZE];
-            //buffer = (short*)malloc(sizeof(short) * 2 * BUFFERSIZE);
-            // long totalSamplesRead = 0;
-            do {
-                // change gain, tempo and pitch
-                adjustGainTempoPitch(n, filter, gain, tempo, pitch);
+    Filter filter;
+    ChannelConverter converter;
+    scratchBuffer(OUTPUT_CHANNELS * BUFFERSIZE);
 
-                // read some stuff from the audio stream
-                inSamples = audioStream->read(buffer, BUFFERSIZE/**audioStream->getChannels()*/);
-                LOG4CXX_TRACE(narratorLog, "got " << inSamples << " samples");
+    LOG4CXX_INFO(narratorLog, "Starting playback thread for voice " << v->mIndex);
 
-                //printf("Read %d samples from audio stream\n", inSamples);
+    while(n->getState() != Narrator::EXIT) {
+        Narrator::PlaylistItem pi;
+        if(!n->nextVoiceItem(*v, pi)) {
+            // Report the end of what has been written before sleeping, unless more is queued
+            // meanwhile. A stop, or a mixer which makes no progress, leaves the rest unplayed
+            long waitms = v->mInput->getRemainingms() + 1000;
+            while(!n->reportPlayed(*v->mInput, v->mMarks, v->bResetFlag || waitms <= 0) &&
+                    v->mPlaylist.size() == 0 && n->getState() != Narrator::EXIT) {
+                usleep(v->mInput->getBufferms() * 1000);
+                waitms -= v->mInput->getBufferms();
+            }
 
-                if(inSamples != 0) {
-                    filter.write(buffer, inSamples); // One sample contains data for all channels here
-                    writeSamplesToPortaudio( n, portaudio, filter, buffer );
-                } else {
-                    LOG4CXX_INFO(narratorLog, "Flushing soundtouch buffer");
-                    filter.flush();
-                }
+            v->bPlaying = false;
+            n->waitForVoice(*v);
+            continue;
+        }
 
-                state = n->getState();
+        // A stop while idle is settled before the new item is written
+        if(v->bResetFlag) {
+            v->bResetFlag = false;
+            v->mInput->stop();
+            n->reportPlayed(*v->mInput, v->mMarks, true);
+        }
+        v->bPlaying = true;
+
+        pthread_mutex_lock(n->narratorMutex);
+        string lang = n->mLanguage;
+        pthread_mutex_unlock(n->narratorMutex);
 
-            } while (inSamples != 0 && state == Narrator::PLAY && !n->bResetFlag);
+        playItem(n, pi, lang, *v->mInput, filter, converter, gain, tempo, pitch, true, v);
 
-            if(buffer != NULL) delete [] (buffer);
-            audioStream->close();
-            delete audioStream;
+        // Abort stream?
+        if(v->bResetFlag) {
+            v->bResetFlag = false;
+            v->mInput->stop();
+            n->reportPlayed(*v->mInput, v->mMarks, true);
+            filter.clear();
         }
+    }
 
-        // Else try opening from database
-        else {
-            vector <MessageAudio> vAudioQueue;
+    LOG4CXX_INFO(narratorLog, "Shutting down playback thread for voice " << v->mIndex);
 
-            // Get a list of MessageAudio objects to play
+    pthread_exit(NULL);
+    return NULL;
+}
 
-            Message *m = pi.mMessage;
-            if(m==NULL){
-                LOG4CXX_ERROR(narratorLog, "Message was null");
-            }
+/**
+ * The thread looking up prompts in the database ahead of playback
+ * \internal
+ */
+void *resolver_thread(void *narrator)
+{
+    Narrator *n = (Narrator*)narrator;
 
-            m->setLanguage(lang);
-            m->load(pi.mIdentifier, pi.mClass);
+    LOG4CXX_INFO(narratorLog, "Starting resolver thread");
 
-            if(!m->compile() || !m->hasAudio()) {
-                LOG4CXX_ERROR(narratorLog, "Narrator translation not found: could not find audio for '" << pi.mIdentifier << "'");
-            } else {
-                vAudioQueue = m->getAudioQueue();
-            }
+    while(n->getState() != Narrator::EXIT) {
+        std::shared_ptr<Narrator::Resolution> resolution;
+        if(n->mResolvedAhead >= n->mLookahead || !n->mResolveQueue->pop(resolution)) {
+            n->waitForResolve();
+            continue;
+        }
 
-            // Play what we got
-            if(vAudioQueue.size() > 0) {
-                vector <MessageAudio>::iterator audio;
-                audio = vAudioQueue.begin();
-                do {
-                    LOG4CXX_INFO(narratorLog, "Saying: " << audio->getText());
+        n->resolve(*resolution);
+    }
 
-                    AudioStream *audioStream;
+    LOG4CXX_INFO(narratorLog, "Shutting down resolver thread");
 
-                    std::string encoding = ((MessageAudio&)*audio).getEncoding();
-                    if (encoding == "ogg")
-                    {
-                        audioStream = new OggStream;
-                    }
-                    else if (encoding == "mp3")
-                    {
-                        audioStream = new Mp3Stream;
-                    }
-                    else
-                    {
-                        LOG4CXX_ERROR(narratorLog, "encoding '" << encoding << "' not supported");
-                        audio++;
-                        continue;
-                    }
+    pthread_exit(NULL);
+    return NULL;
+}
 
-                    if(!audioStream->open(*audio)) {
-                        LOG4CXX_ERROR(narratorLog, "error opening audio stream");
-                        audioStream->close();
-                        break;
-                    }
+/**
+ * The thread calling the slots, so that they never hold up the playback thread
+ * \internal
+ */
+void *dispatcher_thread(void *narrator)
+{
+    Narrator *n = (Narrator*)narrator;
+    vector <Narrator::Event> events;
 
-                    if (portaudio.getRate() != audioStream->getRate())
-                    {
-                        long waitms = portaudio.getRemainingms();
-                        if (waitms != 0)
-                        {
-                            LOG4CXX_DEBUG(narratorLog, "Waiting for current playback to finish");
-                            while (waitms > 0)
-                            {
-                                usleep(100000);
-                                waitms -= 100;
-                            }
-                        }
-                    }
+    LOG4CXX_INFO(narratorLog, "Starting dispatcher thread");
 
-                    if(!portaudio.open(audioStream->getRate(), audioStream->getChannels())) {
-                        LOG4CXX_ERROR(narratorLog, "error initializing portaudio");
-                        break;
-                    }
+    while(true) {
+        // Checked before emptying the queue, so that the events queued before exit are delivered
+        bool exiting = (n->getState() == Narrator::EXIT);
 
-                    if(!filter.open(audioStream->getRate(), audioStream->getChannels())) {
-                        LOG4CXX_ERROR(narratorLog, "error initializing filter");
-                        break;
-                    }
+        // AudioFinished events that did not fit were queued after the ones waiting now
+        int overflow = n->mFinishedOverflow.exchange(0);
 
+        // At most a queue full at a time, so that producers faster than the slots can not starve them
+        Narrator::Event event;
+        while(events.size() < EVENT_QUEUE_SIZE && n->mEventQueue->pop(event)) events.push_back(event);
 
-                    int inSamples = 0;
-                    soundtouch::SAMPLETYPE* buffer = new soundtouch::SAMPLETYPE[audioStream->getChannels()*BUFFERSIZE];
+        event.type = Narrator::EVENT_AUDIO_FINISHED;
+        event.timeus = nowus();
+        for(int i = 0; i < overflow; i++) events.push_back(event);
 
-                    do {
-                        // change gain, tempo and pitch
-                        adjustGainTempoPitch(n, filter, gain, tempo, pitch);
+        if(!events.empty()) {
+            n->dispatchEvents(events);
+            events.clear();
+            continue;
+        }
 
-                        // read some stuff from the audio stream
-                        inSamples = audioStream->read(buffer, BUFFERSIZE*audioStream->getChannels());
+        if(exiting) break;
+        n->waitForEvents();
+    }
 
-                        if(inSamples != 0) {
-                            filter.write(buffer, inSamples);
-                            writeSamplesToPortaudio( n, portaudio, filter, buffer );
-                        } else {
-                            LOG4CXX_INFO(narratorLog, "Flushing soundtouch buffer");
-                            filter.flush();
-                        }
+    LOG4CXX_INFO(narratorLog, "Shutting down dispatcher thread");
 
-                        state = n->getState();
+    pthread_exit(NULL);
+    return NULL;
+}
 
-                    } while (inSamples != 0 && state == Narrator::PLAY && !n->bResetFlag);
+/**
+ * The thread running catalog queries and writes, which may sleep while the database is busy
+ * \internal
+ */
+void *database_thread(void *narrator)
+{
+    Narrator *n = (Narrator*)narrator;
 
-                    if(buffer != NULL) delete [] (buffer);
-                    audioStream->close();
-                    audio++;
+    LOG4CXX_INFO(narratorLog, "Starting database thread");
 
-                } while(audio != vAudioQueue.end() && state == Narrator::PLAY && !n->bResetFlag);
-            }
-            //Cleanup message object
-            delete(pi.mMessage);
+    while(n->getState() != Narrator::EXIT) {
+        Narrator::DatabaseJob job;
+        if(!n->mDatabaseQueue->pop(job)) {
+            n->waitForDatabaseJob();
+            continue;
         }
 
-        // Abort stream?
-        if(n->bResetFlag) {
-            n->bResetFlag = false;
-            portaudio.stop();
-            filter.clear();
-        }
+        bool result = job.mWork();
+        if(job.mDone) job.mDone(result);
+        job.mResult.set_value(result);
+    }
 
-    } while(state != Narrator::EXIT);
+    // Nobody should wait for work queued while shutting down
+    Narrator::DatabaseJob job;
+    while(n->mDatabaseQueue->pop(job))
+        job.mResult.set_value(false);
 
-    LOG4CXX_INFO(narratorLog, "Shutting down playbackthread");
+    LOG4CXX_INFO(narratorLog, "Shutting down database thread");
 
     pthread_exit(NULL);
     return NULL;
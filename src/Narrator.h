@@ -26,8 +26,14 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include <string>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
 #include <map>
 #include <sstream>
+#include <future>
+#include <functional>
 #include <boost/signals2.hpp>
 
 #define NARRATOR_MIN_TEMPO 0.5
@@ -37,41 +43,138 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #define NARRATOR_MIN_VOLUMEGAIN 0.5
 #define NARRATOR_MAX_VOLUMEGAIN 2.0
 
+// Voices mixed into the output, voice 0 is the speech
+#define NARRATOR_VOICES 4
+
 using namespace std;
 
 class Filter;
-class PortAudio;
+class AudioSink;
+class Mixer;
+class ChannelConverter;
 class Message;
 class MessageParameter;
+class MessageAudio;
+template <typename T> class BoundedQueue;
 
 class Narrator
 {
     protected:
         Narrator();
     public:
+        // Output latency profiles, from most responsive to most robust
+        enum LatencyProfile { LATENCY_LOW, LATENCY_BALANCED, LATENCY_SAFE };
+
+        // Scheduling policies for the playback thread, SCHEDULING_DEFAULT is the normal time sharing policy
+        enum SchedulingPolicy { SCHEDULING_DEFAULT, SCHEDULING_FIFO, SCHEDULING_RR };
+
+        // Playlist priorities, prompts of a higher priority are played before and interrupt prompts of a lower one
+        enum Priority { PRIORITY_NORMAL, PRIORITY_HIGH, PRIORITY_URGENT };
+
+        // When a prompt interrupts a lower priority, at the end of the current clip or right away with a short fade
+        enum Preemption { PREEMPT_CLIP, PREEMPT_NOW };
+
+        // Prompts are numbered when they are queued, 0 is never used
+        typedef long long ItemId;
+
+        // Stages an item passes through, each reported once. Files are not looked up so they are never
+        // ITEM_RESOLVED, and an item which is stopped, dropped or can not be played skips the stages it
+        // did not reach and ends with ITEM_STOPPED instead of ITEM_FINISHED
+        enum ItemStage {
+            ITEM_ENQUEUED,          // Queued by play*() or queueBatch
+            ITEM_RESOLVED,          // Audio looked up in the database
+            ITEM_DECODE_STARTED,    // Opening the first clip for decoding
+            ITEM_FIRST_WRITTEN,     // First sample written to the output buffer
+            ITEM_AUDIBLE,           // First sample reaches the speaker
+            ITEM_FINISHED,          // Last sample reaches the speaker
+            ITEM_STOPPED
+        };
+
+        // ITEM_AUDIBLE and ITEM_FINISHED are reported once the output has played the sample, with the time
+        // its clock says the sample reached the speaker. Audio dropped by a stop before then is never
+        // reported as played. File and memory sinks play the audio when it is written
+        struct ItemEvent {
+            ItemId item;
+            ItemStage stage;
+            long long timeus;       // Monotonic time (steady_clock) of the stage
+        };
+
+        // Events delivered to the slots or returned by pollEvents. EVENT_STATE is sent when the
+        // narrator starts and stops speaking, and is only returned by pollEvents. EVENT_DROPPED is
+        // returned by pollEvents where events were lost because the caller fell behind
+        enum EventType { EVENT_AUDIO_FINISHED, EVENT_ITEM, EVENT_STATE, EVENT_DROPPED };
+
+        struct Event {
+            EventType type;
+            ItemEvent item;         // Set for EVENT_ITEM
+            bool speaking;          // Set for EVENT_STATE
+            long long timeus;       // Monotonic time (steady_clock) the event was queued
+        };
+
         //Define signals and slot types
         typedef boost::signals2::signal<void ()> AudioFinished;
         typedef AudioFinished::slot_type AudioFinishedSlotType;
+        typedef boost::signals2::signal<void (const ItemEvent &)> ItemEventSignal;
+        typedef ItemEventSignal::slot_type ItemEventSlotType;
 
         static Narrator *Instance();
         ~Narrator();
 
-        void play(const char *identifier);
-        void play(int number);
-        void playFile(const string filepath);
-        void playDate(int day, int month, int year);
-        void playTime(int hour, int minute, int second);
-        void playDuration(int seconds, int minutes, int hours);
-        void playDuration(long seconds);
-        void playResource(string str, string cls);
-        void playLongpause();
-        void playShortpause();
-        void playWait();
-        void spell(string word);
+        // Each returns the id its events are reported with, the prompts of a date, time,
+        // duration or spelled word share one id. Each priority holds at most 1024 prompts and
+        // each of the other voices 64, 0 is returned and nothing reported if there is no room
+        ItemId play(const char *identifier);
+        ItemId play(int number);
+        ItemId playFile(const string filepath);
+        ItemId playDate(int day, int month, int year);
+        ItemId playTime(int hour, int minute, int second);
+        ItemId playDuration(int seconds, int minutes, int hours);
+        ItemId playDuration(long seconds);
+        ItemId playResource(string str, string cls);
+        ItemId playLongpause();
+        ItemId playShortpause();
+        ItemId playWait();
+        ItemId spell(string word);
+
+        // Prompts collected by a Batch are queued with queueBatch
+        class Batch;
+
+        // Queues all prompts of batch in one step, so that they play one after another without prompts
+        // from other threads in between and a stop() drops either all or none of them.
+        // Returns false and leaves the batch as it is if the playlist has no room for all of them,
+        // nothing is reported for its prompts then
+        bool queueBatch(Batch &batch);
 
         void stop();
         void printMessages();
 
+        // Priority of prompts queued from the calling thread from now on. If resume is true a prompt
+        // interrupted by a higher priority continues where it was cut off once those have been played,
+        // otherwise the rest of it is dropped
+        void setPriority(Priority priority, Preemption preemption = PREEMPT_CLIP, bool resume = true);
+        Priority getPriority();
+
+        // Voice that prompts queued from the calling thread are played on from now on. Voice 0 is the
+        // speech, other voices (e.g. earcons or background cues) play their own playlists at the same
+        // time and are mixed into the same output. Priorities and isSpeaking only concern the speech.
+        // The PortAudio output mixes the voices as it plays, so they are heard about one device buffer
+        // plus the output latency after they start whatever the speech has buffered. The other sinks
+        // mix them into the speech as it is written, behind the audio buffered before it
+        void setVoice(int voice);
+        int getVoice();
+
+        // Gain and tempo of a voice, those of voice 0 are the volume gain and tempo of the narrator
+        void setVoiceGain(int voice, float gain);
+        float getVoiceGain(int voice);
+        void setVoiceTempo(int voice, float tempo);
+        float getVoiceTempo(int voice);
+
+        // Stops a voice and drops its playlist, stopping voice 0 is the same as stop()
+        void stopVoice(int voice);
+
+        // Check if a voice has prompts playing or queued
+        bool isVoicePlaying(int voice);
+
         bool isSpeaking();
         string getState_str();
 
@@ -80,9 +183,108 @@ class Narrator
         void setPushCommandFinished(bool);
         bool getPushCommandFinished();
 
+        // Keep the audio output running on silence for ms after playback has finished,
+        // so that the next prompt starts without delay (0 stops the output right away)
+        void setStandbyTime(long ms);
+        long getStandbyTime();
+
+        // Number of prompts looked up in the database by the resolver thread as soon as they are queued,
+        // ahead of playback (0 looks up each prompt when it starts playing).
+        // A prompt looked up ahead is played in the language it was looked up in
+        void setLookahead(int items);
+        int getLookahead();
+
+        // Select how much audio is buffered for output, applied when the next prompt is played.
+        // The NARRATOR_LATENCY environment variable (low, balanced or safe) sets the initial profile
+        void setLatencyProfile(LatencyProfile profile);
+        LatencyProfile getLatencyProfile();
+
+        // Real-time scheduling of the playback thread, which decodes and filters the audio. The priority is
+        // clamped to the range of the policy. If the process may not use it, the highest priority it may use
+        // is tried before the thread stays on the policy it has, and false is returned.
+        // The NARRATOR_SCHEDULING environment variable (e.g. fifo:70 or rr:50) sets the initial policy
+        bool setPlaybackScheduling(SchedulingPolicy policy, int priority = 0);
+
+        // Policy and priority the playback thread actually runs with
+        SchedulingPolicy getPlaybackScheduling(int *priority = NULL);
+
+        // CPUs the playback thread may run on, an empty list allows all of them.
+        // The NARRATOR_AFFINITY environment variable (e.g. 2,3) sets the initial CPUs
+        bool setPlaybackAffinity(const vector<int> &cpus);
+        vector<int> getPlaybackAffinity();
+
+        // Lock all memory of the process, so that the audio buffers are never paged out while playing.
+        // Returns false if the process may not lock that much memory (RLIMIT_MEMLOCK or CAP_IPC_LOCK).
+        // The NARRATOR_MLOCK environment variable (1) locks it from the start
+        bool setMemoryLocked(bool locked);
+        bool getMemoryLocked();
+
+        // Output latency reported by the audio device (ms) and number of underruns so far
+        long getOutputLatency();
+        long getUnderruns();
+
+        // Audio output statistics, counted since the audio sink was created
+        struct OutputStats {
+            long latencyms;             // Output latency reported by the device
+            long underruns;             // Output ran empty while more audio was on its way
+            long underflows;            // Underflows reported by the device
+            long long framesRendered;   // Frames of audio passed to the device
+            long callbacks;             // Device buffers filled
+            double callbackAvgus;       // Average time spent filling a device buffer (us)
+            double callbackMaxus;       // Longest time spent filling a device buffer (us)
+            double cpuLoad;             // Share of the buffer time spent in the callback, 0.0-1.0
+            long stops;                 // Stops faded out by the output
+            double stopLatencyus;       // Time from the last stop() until the output was silent (us)
+            double stopLatencyMaxus;    // Longest time from stop() until the output was silent (us)
+        };
+
+        // Statistics are updated after each prompt and while idle
+        OutputStats getOutputStats();
+
+        // Select where audio is played, "portaudio" (default), "null" (discard as fast as possible),
+        // "null-realtime" (discard at playback speed), "wav:/path/to/file.wav" or "ogg:/path/to/file.ogg".
+        // Applied when the next prompt is played, the NARRATOR_AUDIO_SINK environment variable sets the initial sink
+        bool setAudioSink(const string &sink);
+        string getAudioSink();
+
+        // Prompts queued from the calling thread between beginRender and endRender are rendered
+        // there instead of played, at the current tempo, pitch and volume gain.
+        // Returns false if another thread is already rendering
+        bool beginRender();
+
+        // Renders the prompts and returns interleaved samples at the rate of the first prompt,
+        // prompts at other rates are resampled to it
+        bool endRender(vector<float> &samples, long &rate, int &channels);
+
+        // Renders the prompts and encodes them to an Ogg Vorbis file
+        bool endRender(const string &path);
+
         // Connect to audiofinished
         boost::signals2::connection connectAudioFinished(const AudioFinishedSlotType &slot);
 
+        // Connect to the stages of each item, items queued before the first slot is connected and
+        // prompts rendered with beginRender are not reported
+        boost::signals2::connection connectItemEvent(const ItemEventSlotType &slot);
+
+        // Slots are called on a dispatcher thread in the order the events happened, so a slow slot
+        // never holds up the audio. isSpeaking stays true until AudioFinished has been delivered.
+        // With coalescing, events the slots have fallen behind on are merged: of the events waiting
+        // for an item only the last stage is delivered, and waiting AudioFinished events only once.
+        // If the slots fall more than 1024 events behind item events are dropped, AudioFinished never is
+        void setCoalesceEvents(bool coalesce);
+        bool getCoalesceEvents();
+
+        // Returns a descriptor which polls readable while events wait for pollEvents, for event loops
+        // that would rather not have slots called on another thread. Events are collected from the
+        // first call on, the descriptor is owned by the narrator. Returns -1 if it can not be created
+        int getEventDescriptor();
+
+        // Replaces the contents of events with the waiting events, oldest first, without blocking.
+        // Coalescing applies like for the slots. May return none after a wakeup, returns the number of events.
+        // If more than 1024 events wait, the later ones are dropped until the next call. That call returns
+        // EVENT_DROPPED after the events kept, followed by the AudioFinished events and the latest state
+        size_t pollEvents(vector<Event> &events);
+
         float getVolumeGain();
         void setVolumeGain(float);
         void adjustVolumeGain(float);
@@ -105,61 +307,277 @@ class Narrator
         void setDatabasePath(string path);
         string getDatabasePath();
 
-        // Functions to find and insert audio
+        // Functions to find and insert audio, they wait for the database thread
         bool hasOggAudio(const char *identifier);
         bool hasMp3Audio(const char *identifier);
         bool addOggAudio(const char *identifier, const char *data, int size);
         bool addMp3Audio(const char *identifier, const char *data, int size);
 
+        // Called with the result on the database thread
+        typedef std::function<void (bool)> DatabaseCallback;
+
+        // Variants which queue the work for the database thread and return right away, so that the caller
+        // never waits for a busy database. The arguments are copied. The callback, if any, is called before
+        // the future gets its value. If the queue is full the future holds false without calling the callback
+        std::future<bool> hasOggAudioAsync(const char *identifier, DatabaseCallback done = DatabaseCallback());
+        std::future<bool> hasMp3AudioAsync(const char *identifier, DatabaseCallback done = DatabaseCallback());
+        std::future<bool> addOggAudioAsync(const char *identifier, const char *data, int size, DatabaseCallback done = DatabaseCallback());
+        std::future<bool> addMp3AudioAsync(const char *identifier, const char *data, int size, DatabaseCallback done = DatabaseCallback());
+
     private:
         enum threadState { DEAD, WAIT, PLAY, EXIT };
 
+        // Playlist and playback state of a voice other than the speech
+        struct Voice;
+
+        // Audio of a prompt looked up by the resolver thread
+        struct Resolution;
+
+        // Work queued for the database thread
+        struct DatabaseJob;
+
+        // Stages reported for an item, shared by the prompts of the item
+        struct ItemReport;
+
+        // Stage of an item reported once the output has played the samples before mPosition
+        struct StageMark {
+            std::shared_ptr<ItemReport> mReport;
+            ItemStage mStage;
+            long long mPosition;
+        };
+
         static Narrator *pinstance;
 
         bool setupThread();
         /*! \cond PRIVATE */
-        friend void adjustGainTempoPitch( Narrator* n, Filter& filter, float& gain, float& tempo, float& pitch );
-        friend void writeSamplesToPortaudio( Narrator* n, PortAudio& portaudio, Filter& filter, float* buffer );
+        friend void adjustGainTempoPitch( Narrator* n, Filter& filter, float& gain, float& tempo, float& pitch, Voice* voice );
+        friend void writeSamplesToSink( Narrator* n, AudioSink& sink, Filter& filter, float* buffer, bool live, Voice* voice, ItemReport* report );
+        friend bool keepPlaying( Narrator* n, bool live, Voice* voice );
         friend void *narrator_thread(void *narrator);
+        friend void *voice_thread(void *voice);
+        friend void *resolver_thread(void *narrator);
+        friend void *database_thread(void *narrator);
+        friend void *dispatcher_thread(void *narrator);
         /*! \endcond */
         pthread_mutex_t *narratorMutex;
         pthread_t playbackThread;
 
+        // Signalled with narratorMutex held when items are queued, on stop and on exit.
+        // Producers only take the mutex to signal if the playback thread is sleeping
+        pthread_cond_t mWorkCond;
+        std::atomic<bool> bSleeping;
+        bool waitForWork(long timeoutms, bool wakeOnStop);
+        void wakeThread();
+
         string mLanguage;
         string mDatabasePath;
-        Message *nextMessage;
+        std::unique_ptr<Message> nextMessage;
 
-        float mVolumeGain;
-        float mTempo;
-        float mPitch;
+        // Read by the playback thread for every block, so kept lock-free
+        std::atomic<float> mVolumeGain;
+        std::atomic<float> mTempo;
+        std::atomic<float> mPitch;
 
         bool bPushCommandFinished;
-        bool bResetFlag;
+        std::atomic<bool> bResetFlag;
+        AudioSink *mSink;       // Sink used by the playback thread, stopped directly by stop()
+        long mStandbyms;
+        LatencyProfile mLatencyProfile;
+        std::atomic<bool> bMemoryLocked;
+        OutputStats mOutputStats;
+        string mAudioSink;
 
         enum ItemType { type_unknown, type_message, type_resource };
 
+        // Where an interrupted item continues
+        struct ResumePoint;
+
         struct PlaylistItem {
             ItemType mType;
             string mIdentifier;
             string mClass;
-            Message *mMessage;
+            std::unique_ptr<Message> mMessage;
+            long long mQueuedus;        // When the item was queued, for measuring start latency
+            unsigned int mGeneration;   // Items from before the last stop() are dropped
+            Priority mPriority;
+            bool bResume;               // Continue the item if it is interrupted
+            std::unique_ptr<ResumePoint> mResume;
+            std::shared_ptr<Resolution> mResolution;   // Holds the message if it is looked up ahead
+            ItemId mId;                 // Shared by the prompts of one item
+            std::shared_ptr<ItemReport> mReport;       // Set if item events are connected
+
+            PlaylistItem();
         };
 
+        // Lock-free queues, one per priority, filled by any thread and emptied by the playback thread
         int numPlaylistItems();
-        queue <PlaylistItem> mPlaylist;
+        BoundedQueue <PlaylistItem> *mPlaylist[PRIORITY_URGENT + 1];
+        bool nextItem(PlaylistItem &pi);
+
+        // The generation in the upper 32 bits and how many of its items are queued or interrupted in the
+        // lower ones. A stop() starts a new generation without items in one step, so that items queued
+        // before it are neither played nor counted however the threads interleave
+        std::atomic<unsigned long long> mGeneration;
+        unsigned int generation();
+        unsigned int claimItems(size_t count);
+        void countItems(unsigned int generation, int count);
+
+        // Set by stop() until the playback thread has dropped the items left from before it
+        std::atomic<bool> bDropStale;
+        void dropStaleItems();
+
+        // Highest priority queued with PREEMPT_NOW since the playback thread last picked an item, -1 if none
+        std::atomic<int> mPreemptNow;
+        bool isPreempted(const PlaylistItem &pi, bool now);
+
+        // Interrupted items waiting to continue, lowest priority first (playback thread only)
+        vector <PlaylistItem> mInterrupted;
+
+        // The other voices are played by threads of their own, started when a voice is first used,
+        // into mixer inputs. The sink adds them to the output as it plays if it can (bOutputMixes),
+        // otherwise the playback thread mixes them into what it writes
+        std::atomic<Voice *> mVoices[NARRATOR_VOICES];
+        Mixer *mMixer;
+        bool bOutputMixes;          // Playback thread only
+        bool bMixing;               // Set while the playback thread waits for the sink to mix the voices
+        Voice *startVoice(int voice);
+        void wakeVoice(Voice &voice);
+        void waitForVoice(Voice &voice);
+        bool nextVoiceItem(Voice &voice, PlaylistItem &pi);
+        bool mixVoices(AudioSink &sink);
+        bool isPlaying(Voice *voice);
+
+        // Prompts waiting for the resolver thread, which keeps at most mLookahead of them looked up
+        // ahead of playback. mResolveCond is signalled with narratorMutex held when the resolver has
+        // something to do, mResolvedCond when it has looked up a prompt
+        BoundedQueue <std::shared_ptr<Resolution> > *mResolveQueue;
+        std::atomic<int> mLookahead;
+        std::atomic<int> mResolvedAhead;
+        pthread_t mResolverThread;
+        pthread_cond_t mResolveCond;
+        pthread_cond_t mResolvedCond;
+        std::atomic<bool> bResolverSleeping;
+        std::shared_ptr<Resolution> prepareLookahead(PlaylistItem &pi, Voice *voice);
+        void queueLookahead(std::shared_ptr<Resolution> *resolutions, size_t count);
+        void resolve(Resolution &resolution);
+        long long takeResolution(PlaylistItem &pi, const string &lang, vector <MessageAudio> &audio);
+        void waitForResolve();
+        void wakeResolver();
+
+        // Catalog queries and writes, run by a thread of its own started when first used.
+        // mDatabaseCond is signalled with narratorMutex held when work is queued and on exit
+        BoundedQueue <DatabaseJob> *mDatabaseQueue;
+        std::atomic<bool> bDatabaseStarted;
+        pthread_t mDatabaseThread;
+        pthread_cond_t mDatabaseCond;
+        std::atomic<bool> bDatabaseSleeping;
+        std::future<bool> queueDatabaseJob(std::function<bool ()> work, DatabaseCallback done, bool runIfFull);
+        void waitForDatabaseJob();
+
+        // Items queued by the rendering thread
+        std::atomic<bool> bRendering;
+        pthread_t mRenderThread;
+        queue <PlaylistItem> mRenderlist;
+        ItemId queueItem(PlaylistItem &pi);
+        bool render(AudioSink &sink);
+
+        // Item events are only collected once a slot has been connected
+        std::atomic<bool> bItemEvents;
+        void prepareReports(PlaylistItem *items, size_t count, vector < std::shared_ptr<ItemReport> > &reports);
+        void reportQueued(const vector < std::shared_ptr<ItemReport> > &reports);
+        void discardReports(PlaylistItem *items, size_t count);
+
+        // Stages waiting for the output of the speech, in the order they are written (playback thread only)
+        deque <StageMark> mMarks;
+        deque <StageMark> &stageMarks(Voice *voice);
+        bool reportPlayed(AudioSink &sink, deque <StageMark> &marks, bool settle);
+        ItemId queueOneItem(Batch &batch);
+        void itemEvent(ItemId item, ItemStage stage, long long timeus);
+
+        // Events for the slots, delivered by a thread of its own started when the first slot is connected.
+        // mEventCond is signalled with narratorMutex held when events are queued and on exit
+        BoundedQueue <Event> *mEventQueue;
+        std::atomic<bool> bDispatcherStarted;
+        pthread_t mDispatcherThread;
+        pthread_cond_t mEventCond;
+        std::atomic<bool> bDispatcherSleeping;
+        std::atomic<bool> bCoalesceEvents;
+        std::atomic<int> mFinishedPending;      // AudioFinished events not delivered yet
+        std::atomic<int> mFinishedOverflow;     // AudioFinished events which did not fit in the queue
+        void startDispatcher();
+        void queueEvent(Event &event);
+        void waitForEvents();
+        void dispatchEvents(vector <Event> &events);
+
+        // Events for pollEvents, mEventFd is written once when the first event after a poll is queued.
+        // mEventWriteFd is the other end of the pipe where there is no eventfd
+        BoundedQueue <Event> *mPollQueue;
+        std::atomic<int> mEventFd;
+        int mEventWriteFd;
+        std::atomic<bool> bEventSignalled;
+        std::atomic<bool> bPollOverflow;         // Set from an overflow until the next poll, events are dropped meanwhile
+        std::atomic<int> mPollFinished;         // AudioFinished events dropped
+        std::atomic<int> mPollState;            // Latest state dropped, -1 if none
+        std::atomic<long long> mPollStateus;
+        pthread_mutex_t mPollMutex;             // pollEvents may be called from any thread
+        void speakingEvent(bool speaking);
+
+        /*! \cond PRIVATE */
+        friend void playItem( Narrator* n, PlaylistItem& pi, const string& lang, AudioSink& sink, Filter& filter,
+                ChannelConverter& converter, float& gain, float& tempo, float& pitch, bool live, Voice* voice );
+        /*! \endcond */
 
         //vector <MessageParameter>vParameters;
 
         void setState(threadState state);
         threadState getState();
         string getState_str(threadState);
-        threadState mState;
+        std::atomic<threadState> mState;
 
         void audioFinishedPlaying();
+        void updateOutputStats(AudioSink &sink);
         bool hasAudio(const char *identifier, std::string encoding);
-        bool addAudio(const char *identifier, std::string encoding, const char *data, int size);
+        bool addAudio(const char *identifier, std::string encoding, const string &lang, const char *data, int size);
 
         AudioFinished m_signal_audio_finished;
+        ItemEventSignal m_signal_item_event;
+};
+
+// Prompts and their parameters collected without locking the narrator, queued together with
+// Narrator::queueBatch. A batch is filled from one thread at a time and can be reused once queued
+class Narrator::Batch
+{
+    public:
+        Batch();
+        ~Batch();
+
+        // Parameters for the next prompt added to the batch
+        void setParameter(const string &key, int value);
+        void setParameter(const string &key, const string &value);
+
+        // Each prompt gets an id of its own, returned here and reported once the batch is queued
+        ItemId play(const char *identifier);
+        ItemId play(int number);
+        ItemId playFile(const string filepath);
+        ItemId playResource(string str, string cls);
+
+        // Number of prompts in the batch
+        size_t size();
+        void clear();
+
+    private:
+        friend class Narrator;
+
+        ItemId add(const string &identifier, const string &cls);
+
+        // Set by the narrator for a date, time, duration or word, whose prompts share one id
+        bool bOneItem;
+
+        vector <PlaylistItem> mItems;
+        std::unique_ptr<Message> mNextMessage;
+
+        Batch(const Batch&);
+        Batch &operator=(const Batch&);
 };
 
 #endif
@@ -0,0 +1,162 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "NullSink.h"
+
+#include <unistd.h>
+#include <log4cxx/logger.h>
+
+// Elements accepted per write when not running in real time
+#define NULLSINK_CHUNK 4096
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorNsLog(log4cxx::Logger::getLogger("kolibre.narrator.nullsink"));
+
+NullSink::NullSink(bool realtime)
+{
+    mRealtime = realtime;
+    mRate = 0;
+    mChannels = 0;
+    mSamplesWritten = 0;
+    mStartSample = 0;
+    mDropFrom = 0;
+    mDropTo = 0;
+    clock_gettime(CLOCK_MONOTONIC, &mStartTime);
+}
+
+bool NullSink::open(long rate, int channels)
+{
+    if(rate <= 0 || channels <= 0) return false;
+
+    if(mRate != rate || mChannels != channels) {
+        LOG4CXX_DEBUG(narratorNsLog, "Opening " << (mRealtime ? "real-time " : "") << "null sink, channels: " << channels << ", rate: " << rate);
+        stop();
+        mRate = rate;
+        mChannels = channels;
+    }
+    return true;
+}
+
+long NullSink::stop()
+{
+    // Forget whatever has not been played yet
+    long long played = getSamplesPlayed();
+    if(played < mSamplesWritten) {
+        mDropFrom = played;
+        mDropTo = mSamplesWritten;
+    }
+    mStartSample = mSamplesWritten;
+    clock_gettime(CLOCK_MONOTONIC, &mStartTime);
+    return 0;
+}
+
+bool NullSink::close()
+{
+    stop();
+    mRate = 0;
+    mChannels = 0;
+    return true;
+}
+
+long NullSink::getRate()
+{
+    return mRate;
+}
+
+int NullSink::getChannels()
+{
+    return mChannels;
+}
+
+long long NullSink::getSamplesWritten()
+{
+    return mSamplesWritten;
+}
+
+void NullSink::getStats(Narrator::OutputStats &stats)
+{
+    AudioSink::getStats(stats);
+    stats.framesRendered = getSamplesPlayed();
+}
+
+long long NullSink::getWritePosition()
+{
+    return mSamplesWritten;
+}
+
+int NullSink::getPlayedTime(long long position, long long &timeus)
+{
+    if(!mRealtime || mRate == 0) return AudioSink::getPlayedTime(position, timeus);
+
+    if(position > mDropFrom && position <= mDropTo) return -1;
+    if(position > getSamplesPlayed()) return 0;
+
+    // Samples played before playback last started over are reported from when it did
+    if(position < mStartSample) position = mStartSample;
+    timeus = mStartTime.tv_sec * 1000000LL + mStartTime.tv_nsec / 1000 + (position - mStartSample) * 1000000 / mRate;
+    return 1;
+}
+
+long long NullSink::getSamplesPlayed()
+{
+    if(!mRealtime || mRate == 0) return mSamplesWritten;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - mStartTime.tv_sec) + (now.tv_nsec - mStartTime.tv_nsec) / 1000000000.0;
+
+    long long played = mStartSample + (long long) (elapsed * mRate);
+    if(played > mSamplesWritten) played = mSamplesWritten;
+    return played;
+}
+
+unsigned int NullSink::getWriteAvailable()
+{
+    if(mChannels == 0) return 0;
+    if(!mRealtime) return NULLSINK_CHUNK;
+
+    // Block until half of the simulated buffer is free, like a device consuming whole buffers
+    long long capacity = mRate * NULLSINK_BUFFER_MS / 1000;
+    long long buffered = mSamplesWritten - getSamplesPlayed();
+    if(buffered > capacity / 2) {
+        usleep((useconds_t) ((buffered - capacity / 2) * 1000000 / mRate));
+        buffered = mSamplesWritten - getSamplesPlayed();
+        if(buffered > capacity / 2) buffered = capacity / 2;
+    }
+
+    return (unsigned int) (capacity - buffered) * mChannels;
+}
+
+bool NullSink::write(float *buffer, unsigned int samples)
+{
+    // Playback restarts when new audio arrives after the sink ran empty
+    if(mRealtime && getSamplesPlayed() == mSamplesWritten) {
+        mStartSample = mSamplesWritten;
+        clock_gettime(CLOCK_MONOTONIC, &mStartTime);
+    }
+
+    mSamplesWritten += samples;
+    return true;
+}
+
+long NullSink::getRemainingms()
+{
+    if(mRate == 0) return 0;
+    return (long) ((mSamplesWritten - getSamplesPlayed()) * 1000 / mRate);
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NULLSINK_H
+#define _NULLSINK_H
+
+#include "AudioSink.h"
+#include <time.h>
+
+// Audio buffered by a real-time null sink before writes block (ms)
+#define NULLSINK_BUFFER_MS 200
+
+// Sink which discards all audio, either as fast as it is written
+// or at the pace a sound device would play it
+class NullSink : public AudioSink {
+    public:
+        NullSink(bool realtime);
+
+        bool open(long rate, int channels);
+        long stop();
+        bool close();
+
+        long getRate();
+        int getChannels();
+
+        unsigned int getWriteAvailable();
+        bool write(float *buffer, unsigned int samples);
+        long getRemainingms();
+
+        // Number of samples written since the sink was created
+        long long getSamplesWritten();
+
+        // In real time the samples are played at the rate of the sink, otherwise as soon as they are written
+        long long getWritePosition();
+        int getPlayedTime(long long position, long long &timeus);
+
+        // Reports the samples played so far as rendered frames
+        void getStats(Narrator::OutputStats &stats);
+
+    private:
+        bool mRealtime;
+        long mRate;
+        int mChannels;
+
+        long long mSamplesWritten;
+
+        // Simulated playback started at mStartTime from sample mStartSample
+        struct timespec mStartTime;
+        long long mStartSample;
+
+        // Samples after mDropFrom up to mDropTo were dropped by the last stop
+        long long mDropFrom;
+        long long mDropTo;
+
+        long long getSamplesPlayed();
+};
+
+#endif
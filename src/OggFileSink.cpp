@@ -0,0 +1,208 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "OggFileSink.h"
+
+#include <ctime>
+#include <log4cxx/logger.h>
+
+// Samples accepted per write
+#define OGGFILESINK_CHUNK 1024
+
+// Vorbis VBR quality, from -0.1 to 1.0. Speech is fine well below music quality
+#define OGGFILESINK_QUALITY 0.4f
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorOfsLog(log4cxx::Logger::getLogger("kolibre.narrator.oggfilesink"));
+
+OggFileSink::OggFileSink(const std::string &path)
+{
+    mBasePath = path;
+    mFileIndex = 0;
+    pFile = NULL;
+    mRate = 0;
+    mChannels = 0;
+}
+
+OggFileSink::~OggFileSink()
+{
+    close();
+}
+
+bool OggFileSink::open(long rate, int channels)
+{
+    if(pFile != NULL && mRate == rate && mChannels == channels) return true;
+    if(rate <= 0 || channels <= 0) return false;
+
+    // Each file holds one format, so continue in a new file after a change
+    if(pFile != NULL) close();
+
+    mPath = indexedPath(mBasePath, mFileIndex);
+
+    vorbis_info_init(&vi);
+    if(vorbis_encode_init_vbr(&vi, channels, rate, OGGFILESINK_QUALITY) != 0) {
+        LOG4CXX_ERROR(narratorOfsLog, "Vorbis encoder does not support channels: " << channels << ", rate: " << rate);
+        vorbis_info_clear(&vi);
+        return false;
+    }
+
+    pFile = fopen(mPath.c_str(), "wb");
+    if(pFile == NULL) {
+        LOG4CXX_ERROR(narratorOfsLog, "Failed to open '" << mPath << "' for writing");
+        vorbis_info_clear(&vi);
+        return false;
+    }
+
+    LOG4CXX_DEBUG(narratorOfsLog, "Encoding audio to '" << mPath << "', channels: " << channels << ", rate: " << rate);
+
+    vorbis_comment_init(&vc);
+    vorbis_comment_add_tag(&vc, "ENCODER", "kolibre-narrator");
+    vorbis_analysis_init(&vd, &vi);
+    vorbis_block_init(&vd, &vb);
+
+    // The serial only has to differ between streams chained into one file
+    ogg_stream_init(&os, (int)time(NULL) + mFileIndex);
+
+    // The three header packets go on pages of their own before any audio
+    ogg_packet header, headerComment, headerCode;
+    vorbis_analysis_headerout(&vd, &vc, &header, &headerComment, &headerCode);
+    ogg_stream_packetin(&os, &header);
+    ogg_stream_packetin(&os, &headerComment);
+    ogg_stream_packetin(&os, &headerCode);
+
+    mFileIndex++;
+    mRate = rate;
+    mChannels = channels;
+
+    return writePages(true);
+}
+
+long OggFileSink::stop()
+{
+    // Everything written is already encoded
+    endOfData();
+    return 0;
+}
+
+bool OggFileSink::close()
+{
+    if(pFile == NULL) return true;
+
+    // Signal end of stream and write the last pages
+    vorbis_analysis_wrote(&vd, 0);
+    encodeBlocks();
+    writePages(true);
+
+    ogg_stream_clear(&os);
+    vorbis_block_clear(&vb);
+    vorbis_dsp_clear(&vd);
+    vorbis_comment_clear(&vc);
+    vorbis_info_clear(&vi);
+
+    fclose(pFile);
+    pFile = NULL;
+    mRate = 0;
+    mChannels = 0;
+    return true;
+}
+
+long OggFileSink::getRate()
+{
+    return mRate;
+}
+
+int OggFileSink::getChannels()
+{
+    return mChannels;
+}
+
+std::string OggFileSink::getPath()
+{
+    return mPath;
+}
+
+unsigned int OggFileSink::getWriteAvailable()
+{
+    if(pFile == NULL) return 0;
+    return OGGFILESINK_CHUNK * mChannels;
+}
+
+bool OggFileSink::write(float *buffer, unsigned int samples)
+{
+    if(pFile == NULL) return false;
+
+    // The encoder takes one buffer per channel
+    float **analysis = vorbis_analysis_buffer(&vd, samples);
+    for(unsigned int i = 0; i < samples; i++)
+        for(int c = 0; c < mChannels; c++)
+            analysis[c][i] = buffer[i * mChannels + c];
+    vorbis_analysis_wrote(&vd, samples);
+
+    return encodeBlocks();
+}
+
+long OggFileSink::getRemainingms()
+{
+    return 0;
+}
+
+void OggFileSink::endOfData()
+{
+    if(pFile == NULL) return;
+
+    writePages(true);
+    fflush(pFile);
+}
+
+/*
+   Encodes all complete blocks and queues the packets for writing
+*/
+bool OggFileSink::encodeBlocks()
+{
+    ogg_packet packet;
+
+    while(vorbis_analysis_blockout(&vd, &vb) == 1) {
+        vorbis_analysis(&vb, NULL);
+        vorbis_bitrate_addblock(&vb);
+
+        while(vorbis_bitrate_flushpacket(&vd, &packet))
+            ogg_stream_packetin(&os, &packet);
+    }
+
+    return writePages(false);
+}
+
+/*
+   Writes finished pages to the file, flush also writes a page which is not full yet
+*/
+bool OggFileSink::writePages(bool flush)
+{
+    ogg_page page;
+
+    while(flush ? ogg_stream_flush(&os, &page) : ogg_stream_pageout(&os, &page)) {
+        if(fwrite(page.header, 1, page.header_len, pFile) != (size_t)page.header_len ||
+                fwrite(page.body, 1, page.body_len, pFile) != (size_t)page.body_len) {
+            LOG4CXX_ERROR(narratorOfsLog, "Failed to write to '" << mPath << "'");
+            return false;
+        }
+    }
+
+    return true;
+}
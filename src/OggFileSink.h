@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _OGGFILESINK_H
+#define _OGGFILESINK_H
+
+#include "AudioSink.h"
+#include <string>
+#include <cstdio>
+#include <vorbis/vorbisenc.h>
+
+// Sink which encodes all audio to an Ogg Vorbis file as fast as possible.
+// If the rate or channels change a new file is started with an index appended to the name
+class OggFileSink : public AudioSink {
+    public:
+        OggFileSink(const std::string &path);
+        ~OggFileSink();
+
+        bool open(long rate, int channels);
+        long stop();
+        bool close();
+
+        long getRate();
+        int getChannels();
+
+        unsigned int getWriteAvailable();
+        bool write(float *buffer, unsigned int samples);
+        long getRemainingms();
+
+        // Writes the pages encoded so far to the file
+        void endOfData();
+
+        // Path of the file currently written
+        std::string getPath();
+
+    private:
+        std::string mBasePath;
+        std::string mPath;
+        int mFileIndex;
+        FILE *pFile;
+
+        long mRate;
+        int mChannels;
+
+        vorbis_info vi;
+        vorbis_comment vc;
+        vorbis_dsp_state vd;
+        vorbis_block vb;
+        ogg_stream_state os;
+
+        bool writePages(bool flush);
+        bool encodeBlocks();
+};
+
+#endif
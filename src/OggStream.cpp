@@ -177,6 +177,18 @@ long OggStream::read(float* buffer, int bytes)
     return (samples_read);
 }
 
+bool OggStream::seek(long frame)
+{
+    if(!isOpen) return false;
+
+    int error = ov_pcm_seek(&mStream, frame);
+    if(error) {
+        LOG4CXX_WARN(narratorOsLog, "Could not seek to frame " << frame << " in " << mStreamInfo << " (" << error << ")");
+        return false;
+    }
+    return true;
+}
+
 bool OggStream::close()
 {
     if(isOpen) {
@@ -33,6 +33,7 @@ class OggStream: public AudioStream
         bool open(const MessageAudio &);
         bool open(string);
         long read(float* buffer, int bytes);
+        bool seek(long frame);
         bool close();
 
         long getRate();
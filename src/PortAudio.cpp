@@ -19,14 +19,38 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 
 #include "PortAudio.h"
 #include "RingBuffer.h"
+#include "Mixer.h"
 
 #include <iostream>
 #include <unistd.h>
 #include <cassert>
 #include <cstring>
+#include <cerrno>
+#include <time.h>
+#include <chrono>
 #include <log4cxx/logger.h>
 
-#define RINGBUFFERSIZE 4096*16
+// Buffer sizes in ms for each Narrator::LatencyProfile
+struct LatencySettings {
+    const char *name;
+    long bufferms;      // Frames per device buffer
+    long ringms;        // Ringbuffer between the playback thread and the callback
+    long startms;       // Audio buffered before a stopped stream is started
+    bool lowLatency;    // Suggest the device's low output latency instead of the high one
+};
+
+static const LatencySettings latencySettings[] = {
+    { "low",        5,  60,  10, true },
+    { "balanced",  10, 200,  40, true },
+    // 1024 frames and a 64K element ringbuffer for 44.1 kHz stereo
+    { "safe",      23, 743, 371, false },
+};
+
+// How long the writer waits for free space before checking the stream
+#define SPACE_WAIT_MS 200
+
+// Length of the fade applied on stop, shortened to one device buffer if needed
+#define STOP_FADE_MS 8
 
 // create logger which will become a child to logger kolibre.narrator
 log4cxx::LoggerPtr narratorPaLog(log4cxx::Logger::getLogger("kolibre.narrator.portaudio"));
@@ -41,8 +65,7 @@ int pa_stream_callback(
 
 void pa_stream_finished_callback( void *userData );
 
-PortAudio::PortAudio():
-    ringbuf(RINGBUFFERSIZE)
+PortAudio::PortAudio()
 {
     isInitialized = true;
     isOpen = false;
@@ -52,6 +75,39 @@ PortAudio::PortAudio():
     mLatency = 0;
     pStream = NULL;
 
+    mWaitingForSpace = false;
+    mSpaceWatermark = 0;
+    mStandby = false;
+    mUnderrunms = 0;
+    mMixer = NULL;
+    mMixIdlems = 0;
+    mProfile = mOpenProfile = Narrator::LATENCY_SAFE;
+    mStartThreshold = 0;
+    mEndOfData = false;
+    mBufferms = 0;
+    mUnderruns = 0;
+    mUnderflows = 0;
+    mCallbacks = 0;
+    mFramesRendered = 0;
+    mCallbackTotalns = 0;
+    mCallbackMaxns = 0;
+    mCpuLoad = 0;
+    mStops = 0;
+    mStopLastns = 0;
+    mStopMaxns = 0;
+    mStopRequested = false;
+    mStopRequests = 0;
+    mStopRequestns = 0;
+    mStopsHandled = 0;
+    mClockSeq = 0;
+    mClockDacPos = 0;
+    mClockDacns = 0;
+    mClockDropFrom = 0;
+    mClockDropTo = 0;
+    mSamplesWritten = 0;
+    resetClock();
+    sem_init(&mSpaceSem, 0, 0);
+
     LOG4CXX_INFO(narratorPaLog, "Initializing portaudio");
 
     mError = Pa_Initialize();
@@ -67,12 +123,14 @@ PortAudio::~PortAudio()
 
     if(isInitialized)
         Pa_Terminate();
+
+    sem_destroy(&mSpaceSem);
 }
 
 bool PortAudio::open(long rate, int channels)
 {
 
-    if(mRate != rate || mChannels != channels) {
+    if(mRate != rate || mChannels != channels || mOpenProfile != mProfile) {
         close();
     }
 
@@ -87,7 +145,11 @@ bool PortAudio::open(long rate, int channels)
         mOutputParameters.device = default_device; /* default output device */
         mOutputParameters.channelCount = channels;
         mOutputParameters.sampleFormat = paFloat32;
-        mOutputParameters.suggestedLatency = Pa_GetDeviceInfo( mOutputParameters.device )->defaultHighOutputLatency;
+        const LatencySettings &settings = latencySettings[mProfile];
+
+        mOutputParameters.suggestedLatency = settings.lowLatency ?
+            Pa_GetDeviceInfo( mOutputParameters.device )->defaultLowOutputLatency :
+            Pa_GetDeviceInfo( mOutputParameters.device )->defaultHighOutputLatency;
         mOutputParameters.hostApiSpecificStreamInfo = NULL;
 
         const PaDeviceInfo* devinfo = Pa_GetDeviceInfo(mOutputParameters.device);
@@ -95,12 +157,22 @@ bool PortAudio::open(long rate, int channels)
 
         LOG4CXX_DEBUG(narratorPaLog, "Opening device: " << devinfo->name << " (" << hostapiinfo->name << "), channels: " << channels << ", rate: " << rate <<" (" << devinfo->defaultSampleRate << ")");
 
-        unsigned long framesPerBuffer = 1024;
+        unsigned long framesPerBuffer = rate * settings.bufferms / 1000;
 
 #ifdef WIN32
-        framesPerBuffer = 4096;
+        if(framesPerBuffer < 4096) framesPerBuffer = 4096;
 #endif
 
+        // The ringbuffer holds at least four device buffers, it is only reallocated when the size changes
+        size_t ringElements = rate * settings.ringms / 1000 * channels;
+        if(ringElements < 4 * framesPerBuffer * channels) ringElements = 4 * framesPerBuffer * channels;
+        size_t ringSize = 1;
+        while(ringSize < ringElements) ringSize <<= 1;
+        if(ringSize != ringbuf.getSize()) ringbuf.initialize(ringSize);
+
+        mStartThreshold = rate * settings.startms / 1000 * channels;
+        if(mStartThreshold > ringbuf.getSize() / 2) mStartThreshold = ringbuf.getSize() / 2;
+
         mError = Pa_OpenStream(&pStream, NULL, &mOutputParameters, rate, framesPerBuffer/*paFramesPerBufferUnspecified*/,
                 paNoFlag, pa_stream_callback, this);
 
@@ -111,9 +183,21 @@ bool PortAudio::open(long rate, int channels)
 
         mRate = rate;
         mChannels = channels;
+        mOpenProfile = mProfile;
         isOpen = true;
+
+        mBufferms = 1000 * framesPerBuffer / rate;
+        resetClock();
+
+        // Wake the writer when there is room for a full device buffer
+        mSpaceWatermark = framesPerBuffer * channels;
+        if(mSpaceWatermark > ringbuf.getSize()) mSpaceWatermark = ringbuf.getSize();
         isStarted = false;
 
+        LOG4CXX_INFO(narratorPaLog, "Latency profile " << settings.name << ": " << framesPerBuffer << " frames per buffer, ringbuffer "
+                << (1000 * ringbuf.getSize() / channels / rate) << " ms, start threshold "
+                << (1000 * mStartThreshold / channels / rate) << " ms");
+
         mError = Pa_SetStreamFinishedCallback(pStream, pa_stream_finished_callback);
         if(mError != paNoError) {
             LOG4CXX_ERROR(narratorPaLog, "Failed to set FinishedCallback: " << Pa_GetErrorText(mError));
@@ -126,14 +210,24 @@ bool PortAudio::open(long rate, int channels)
 long PortAudio::stop()
 {
     if(isStarted) {
+        // The load is only known while the stream runs
+        mCpuLoad = Pa_GetStreamCpuLoad(pStream);
+        LOG4CXX_DEBUG(narratorPaLog, "Stopping stream, " << mUnderruns << " underruns, " << mUnderflows << " underflows, "
+                << mFramesRendered << " frames rendered, CPU load " << mCpuLoad);
+
         mError = Pa_StopStream(pStream);
         if(mError != paNoError)
             LOG4CXX_ERROR(narratorPaLog, "Failed to stop stream: " << Pa_GetErrorText(mError));
 
         ringbuf.flush();
+        resetClock();
         isStarted = false;
     }
 
+    // The callback is not running, so pending requests can be settled here
+    mStopsHandled = mStopRequests;
+    mStopRequested = false;
+
     return mLatency;
 }
 
@@ -146,9 +240,13 @@ long PortAudio::abort()
             LOG4CXX_ERROR(narratorPaLog, "Failed to abort stream: " << Pa_GetErrorText(mError));
 
         ringbuf.flush();
+        resetClock();
         isStarted = false;
     }
 
+    mStopsHandled = mStopRequests;
+    mStopRequested = false;
+
     return mLatency;
 }
 
@@ -179,21 +277,211 @@ int PortAudio::getChannels()
     return mChannels;
 }
 
+void PortAudio::setStandby(bool standby)
+{
+    if(mStandby != standby)
+        LOG4CXX_DEBUG(narratorPaLog, (standby ? "Enabling" : "Disabling") << " standby");
+    mStandby = standby;
+}
+
+bool PortAudio::getStandby()
+{
+    return mStandby;
+}
+
+void PortAudio::setLatencyProfile(Narrator::LatencyProfile profile)
+{
+    mProfile = profile;
+}
+
+Narrator::LatencyProfile PortAudio::getLatencyProfile()
+{
+    return mProfile;
+}
+
+long PortAudio::getOutputLatency()
+{
+    return mLatency;
+}
+
+long PortAudio::getUnderruns()
+{
+    return mUnderruns + mUnderflows;
+}
+
+void PortAudio::requestStop()
+{
+    mStopRequestns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    // Counted before the flag is raised, so the callback never sees the flag without the request
+    mStopRequests++;
+    mStopRequested = true;
+}
+
+void PortAudio::drop()
+{
+    // Without a running callback the buffered audio can be dropped here
+    if(!isStarted) {
+        ringbuf.flush();
+        resetClock();
+        mStopsHandled = mStopRequests;
+        mStopRequested = false;
+        return;
+    }
+
+    long stops = mStops.load(std::memory_order_relaxed);
+    requestStop();
+
+    // The callback drops everything while the request is raised, so nothing may be written until it has run
+    long waitms = 2 * getBufferms() + 100;
+    while(isStarted && mStops.load(std::memory_order_relaxed) == stops && waitms-- > 0)
+        Pa_Sleep(1);
+
+    if(mStops.load(std::memory_order_relaxed) == stops) {
+        LOG4CXX_WARN(narratorPaLog, "Callback did not drop the buffered audio, stopping stream");
+        stop();
+        return;
+    }
+
+    mStopRequested = false;
+}
+
+void PortAudio::getStats(Narrator::OutputStats &stats)
+{
+    if(isStarted) mCpuLoad = Pa_GetStreamCpuLoad(pStream);
+
+    long callbacks = mCallbacks.load(std::memory_order_relaxed);
+
+    stats.latencyms = mLatency;
+    stats.underruns = mUnderruns.load(std::memory_order_relaxed);
+    stats.underflows = mUnderflows.load(std::memory_order_relaxed);
+    stats.framesRendered = mFramesRendered.load(std::memory_order_relaxed);
+    stats.callbacks = callbacks;
+    stats.callbackAvgus = callbacks > 0 ? mCallbackTotalns.load(std::memory_order_relaxed) / 1000.0 / callbacks : 0;
+    stats.callbackMaxus = mCallbackMaxns.load(std::memory_order_relaxed) / 1000.0;
+    stats.cpuLoad = mCpuLoad;
+    stats.stops = mStops.load(std::memory_order_relaxed);
+    stats.stopLatencyus = mStopLastns.load(std::memory_order_relaxed) / 1000.0;
+    stats.stopLatencyMaxus = mStopMaxns.load(std::memory_order_relaxed) / 1000.0;
+}
+
+void PortAudio::endOfData()
+{
+    mEndOfData = true;
+
+    // Play whatever is left even if it is less than the start threshold
+    Mixer *mixer = mMixer;
+    if(isOpen && !isStarted && (ringbuf.getReadAvailable() > 0 || (mixer != NULL && mixer->hasWork())))
+        startStream();
+}
+
+bool PortAudio::setMixer(Mixer *mixer)
+{
+    mMixer = mixer;
+    return true;
+}
+
 long PortAudio::getRemainingms()
 {
-    size_t bufferedData = ringbuf.getReadAvailable();
+    if(mRate == 0) return 0;
+    return (long) (1000 * getRemainingSamples() / mRate);
+}
+
+long long PortAudio::getRemainingSamples()
+{
+    if(!isOpen || mRate == 0) return 0;
+
+    long long start, end;
+    double dacTime;
+    unsigned int seq;
+
+    // Read a consistent snapshot, retry if the callback updated it meanwhile
+    do {
+        seq = mClockSeq;
+        start = mClockStart;
+        end = mClockEnd;
+        dacTime = mClockDacTime;
+    } while((seq & 1) || seq != mClockSeq);
+
+    long long remaining = mSamplesWritten - end;
+    double now = 0;
+    if(isStarted && dacTime > 0) now = Pa_GetStreamTime(pStream);
+
+    // Without timing information assume what the callback has taken is still in the device,
+    // a stream which has only played the voices of the mixer has taken nothing
+    if(now <= 0) {
+        if(remaining <= 0 && (!isStarted || start == end)) return 0;
+        return mSamplesWritten - start + (long long) (mLatency * mRate / 1000);
+    }
+
+    // Samples reach the DAC at the rate of the stream from the time reported by the callback
+    long long played = start + (long long) ((now - dacTime) * mRate);
+    if(played > end) played = end;
+
+    remaining = mSamplesWritten - played;
+    return remaining > 0 ? remaining : 0;
+}
+
+long long PortAudio::getWritePosition()
+{
+    return mSamplesWritten;
+}
+
+int PortAudio::getPlayedTime(long long position, long long &timeus)
+{
+    long long end, dacPos, dacns, dropFrom, dropTo;
+    unsigned int seq;
+
+    do {
+        seq = mClockSeq;
+        end = mClockEnd;
+        dacPos = mClockDacPos;
+        dacns = mClockDacns;
+        dropFrom = mClockDropFrom;
+        dropTo = mClockDropTo;
+    } while((seq & 1) || seq != mClockSeq);
+
+    if(position > dropFrom && position <= dropTo) return -1;
+    if(position > end) return 0;
+
+    // The samples of one callback reach the DAC one after another at the rate of the stream
+    long long ns = dacns;
+    if(mRate > 0) ns += (position - dacPos) * 1000000000LL / mRate;
+    if(ns > std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count()) return 0;
+
+    timeus = ns / 1000;
+    return 1;
+}
 
-    long bufferms = 0;
+long PortAudio::getBufferms()
+{
+    return mBufferms > 0 ? mBufferms : 10;
+}
 
-    if(mChannels != 0 && mRate != 0)
-        bufferms = (long) (1000.0 * bufferedData) / mChannels / mRate;
+/*
+   Discards the playback clock, must not be called while the callback runs.
+   Samples the callback has not taken count as dropped
+*/
+void PortAudio::resetClock()
+{
+    long long written = mSamplesWritten;
+    long long end = mClockEnd;
 
-    return bufferms + mLatency;
+    mClockSeq++;
+    if(written > end) {
+        if(end > mClockDropTo || end < mClockDropFrom) mClockDropFrom = end;
+        mClockDropTo = written;
+    }
+    mClockStart = written;
+    mClockEnd = written;
+    mClockDacTime = 0;
+    mClockSeq++;
 }
 
 /*
    Blocks until data can be written.
-   If no data can be written in 2ms*100 the stream gets restarted.
+   The callback wakes us when space is freed, if no space is freed in 200ms*10 the stream gets restarted.
    returns the amount of data that can be written.
 */
 unsigned int PortAudio::getWriteAvailable()
@@ -205,12 +493,12 @@ unsigned int PortAudio::getWriteAvailable()
     while( writeAvailable == 0 ) {
         writeAvailable = ringbuf.getWriteAvailable();
 
-        if( writeAvailable == 0 ) {
-            usleep(200000); //200 ms
-            //LOG4CXX_DEBUG(narratorPaLog, "getWriteAvailable = 0, Pa_IsStreamActive = " << Pa_IsStreamActive(pStream));
+        if( writeAvailable == 0 && waitForSpace(SPACE_WAIT_MS) ) {
+            waitCount = 0;
+            continue;
         }
 
-        if(waitCount++ > 10) {
+        if( writeAvailable == 0 && waitCount++ > 10) {
             LOG4CXX_ERROR(narratorPaLog, "getWriteAvailable waittime exceeded, restarting stream");
 
             mError = Pa_AbortStream(pStream);
@@ -238,22 +526,45 @@ unsigned int PortAudio::getWriteAvailable()
     return writeAvailable;
 }
 
+/*
+   Waits until the callback signals free space or timeoutms has passed.
+   returns false on timeout.
+*/
+bool PortAudio::waitForSpace(long timeoutms)
+{
+    // Drop wakeups left over from earlier waits
+    while(sem_trywait(&mSpaceSem) == 0);
+
+    // Announce the wait before checking again, so a callback freeing space in between is not missed
+    mWaitingForSpace = true;
+    if(ringbuf.getWriteAvailable() > 0) {
+        mWaitingForSpace = false;
+        return true;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutms / 1000;
+    deadline.tv_nsec += (timeoutms % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    int result;
+    while((result = sem_timedwait(&mSpaceSem, &deadline)) == -1 && errno == EINTR);
+
+    mWaitingForSpace = false;
+    return result == 0;
+}
+
 bool PortAudio::write(float *buffer, unsigned int samples)
 {
     size_t elemWritten = ringbuf.writeElements(buffer, samples*mChannels);
+    mSamplesWritten += elemWritten / mChannels;
+    mEndOfData = false;
 
-    // Try starting the stream
-    if(!isStarted && ringbuf.getWriteAvailable() <= (RINGBUFFERSIZE/2)) {
-        LOG4CXX_TRACE(narratorPaLog, "Starting stream");
-        mError = Pa_StartStream(pStream);
-        if(mError != paNoError) {
-            LOG4CXX_ERROR(narratorPaLog, "Failed to start stream: " << Pa_GetErrorText(mError));
-        }
-        mLatency = (long) (Pa_GetStreamInfo(pStream)->outputLatency * 1000.0);
-        isStarted = true;
-    }
-    else if(!isStarted )
-        LOG4CXX_TRACE(narratorPaLog, "Buffering: " << ((RINGBUFFERSIZE - ringbuf.getWriteAvailable()) * 100) / (RINGBUFFERSIZE) << "%");
+    startWhenBuffered();
 
     if( elemWritten < samples)
         return false;
@@ -261,6 +572,72 @@ bool PortAudio::write(float *buffer, unsigned int samples)
     return false;
 }
 
+unsigned int PortAudio::getWriteRegions(unsigned int samples, float **data1, unsigned int *samples1, float **data2, unsigned int *samples2)
+{
+    float *elemData1, *elemData2;
+    size_t elements1, elements2;
+
+    *samples1 = *samples2 = 0;
+    if(mChannels == 0) return 0;
+
+    ringbuf.getWriteRegions(samples*mChannels, &elemData1, &elements1, &elemData2, &elements2);
+
+    // Only whole samples can be handed out, a sample split around the end ends the regions
+    *data1 = elemData1;
+    *samples1 = elements1 / mChannels;
+    if(elements1 % mChannels == 0) {
+        *data2 = elemData2;
+        *samples2 = elements2 / mChannels;
+    }
+
+    return *samples1 + *samples2;
+}
+
+bool PortAudio::commitWrite(unsigned int samples)
+{
+    ringbuf.commitWrite(samples*mChannels);
+    mSamplesWritten += samples;
+    mEndOfData = false;
+
+    startWhenBuffered();
+
+    return true;
+}
+
+void PortAudio::startWhenBuffered()
+{
+    // In standby one device buffer is enough
+    size_t threshold = mStartThreshold;
+    if(mStandby && mSpaceWatermark > 0 && mSpaceWatermark < threshold) threshold = mSpaceWatermark;
+
+    // Try starting the stream
+    if(!isStarted && ringbuf.getReadAvailable() >= threshold)
+        startStream();
+    else if(!isStarted )
+        LOG4CXX_TRACE(narratorPaLog, "Buffering: " << (ringbuf.getReadAvailable() * 100) / threshold << "%");
+}
+
+void PortAudio::startStream()
+{
+    LOG4CXX_TRACE(narratorPaLog, "Starting stream");
+    mUnderrunms = 0;
+    mMixIdlems = 0;
+    // Known once the stream is open, the callback reads it
+    mLatency = (long) (Pa_GetStreamInfo(pStream)->outputLatency * 1000.0);
+    mError = Pa_StartStream(pStream);
+    if(mError != paNoError) {
+        LOG4CXX_ERROR(narratorPaLog, "Failed to start stream: " << Pa_GetErrorText(mError));
+    }
+    LOG4CXX_DEBUG(narratorPaLog, "Stream started, output latency " << mLatency << " ms, " << mUnderruns << " underruns so far");
+    isStarted = true;
+}
+
+// Only the callback writes the counters, so a read-modify-write is not needed
+template <typename T> static inline void addRelaxed(std::atomic<T> &counter, T value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
 long unsigned int min( long unsigned int a, long unsigned int b )
 {
     if( a < b )
@@ -280,37 +657,134 @@ int pa_stream_callback(
         PaStreamCallbackFlags statusFlags,
         void *userData )
 {
-    (void) timeInfo;    /* Prevent unused variable warning. */
     (void) input; /* Prevent unused variable warning. */
 
-    //if(statusFlags & paOutputUnderflow)
-    //    LOG4CXX_WARN(narratorPaLog, "Output underflow!");
-    //if(statusFlags & paOutputOverflow)
-    //    LOG4CXX_WARN(narratorPaLog, "Output overflow!");
-    //if(statusFlags & paPrimingOutput)
-    //    LOG4CXX_WARN(narratorPaLog, "Priming output!");
-
-    static long underrunms = 0;
+    // Logging is not allowed here, problems are counted and reported through getStats
+    std::chrono::steady_clock::time_point callbackStart = std::chrono::steady_clock::now();
 
-    RingBuffer *ringbuf = &((PortAudio*)userData)->ringbuf;
+    PortAudio *pa = (PortAudio*)userData;
+    RingBuffer *ringbuf = &pa->ringbuf;
 
-    int channels = ((PortAudio*)userData)->mChannels;
-    long rate = ((PortAudio*)userData)->mRate;
+    int channels = pa->mChannels;
+    long rate = pa->mRate;
 
     float* outbuf = (float*)output;
 
-    size_t elementsRead = ringbuf->readElements(outbuf, frameCount * channels);
+    // Time until the start of this buffer reaches the DAC
+    double dacDelay = pa->mLatency / 1000.0;
+    if(timeInfo->outputBufferDacTime > 0 && timeInfo->currentTime > 0)
+        dacDelay = timeInfo->outputBufferDacTime - timeInfo->currentTime;
+
+    // Copy straight from the ringbuffer memory into the device buffer
+    float *data1, *data2;
+    size_t size1, size2;
+    size_t elementsRead = ringbuf->getReadRegions(frameCount * channels, &data1, &size1, &data2, &size2);
+    if(size1 > 0) memcpy(outbuf, data1, size1 * sizeof(float));
+    if(size2 > 0) memcpy(outbuf + size1, data2, size2 * sizeof(float));
+    ringbuf->commitRead(elementsRead);
+    size_t elementsDropped = 0;
+    long long clockEnd = pa->mClockEnd;
+    long long dropFrom = -1;
+
+    // On stop the start of this buffer is faded out and the rest of the ringbuffer dropped,
+    // so the output is silent within one device buffer whatever the writer is doing
+    if(pa->mStopRequested) {
+        unsigned int requests = pa->mStopRequests;
+        unsigned long framesRead = elementsRead / channels;
+        unsigned long fadeFrames = 0;
+
+        if(requests != pa->mStopsHandled) {
+            pa->mStopsHandled = requests;
+            fadeFrames = rate * STOP_FADE_MS / 1000;
+            if(fadeFrames > framesRead) fadeFrames = framesRead;
+
+            for(unsigned long i = 0; i < fadeFrames; i++) {
+                float gain = 1.0f - (float) (i + 1) / fadeFrames;
+                for(int c = 0; c < channels; c++) outbuf[i * channels + c] *= gain;
+            }
+
+            // Measured until the end of the fade reaches the DAC
+            long long nowns = std::chrono::duration_cast<std::chrono::nanoseconds>(callbackStart.time_since_epoch()).count();
+            long long latencyns = nowns - pa->mStopRequestns + (long long) ((dacDelay + (double) fadeFrames / rate) * 1000000000.0);
+            pa->mStopLastns.store(latencyns, std::memory_order_relaxed);
+            if(latencyns > pa->mStopMaxns.load(std::memory_order_relaxed))
+                pa->mStopMaxns.store(latencyns, std::memory_order_relaxed);
+            addRelaxed(pa->mStops, 1L);
+        }
+
+        if(framesRead > fadeFrames)
+            memset(outbuf + fadeFrames * channels, 0, (framesRead - fadeFrames) * channels * sizeof(float));
+        elementsDropped = ringbuf->getReadRegions(ringbuf->getSize(), &data1, &size1, &data2, &size2);
+        ringbuf->commitRead(elementsDropped);
+
+        // Everything after the fade is never heard
+        if(framesRead > fadeFrames || elementsDropped > 0) dropFrom = clockEnd + fadeFrames;
+    }
+
+    // Advance the playback clock, the first sample of this buffer is heard at outputBufferDacTime.
+    // Buffers of silence only are left out so the clock keeps counting from the last audio,
+    // dropped samples are skipped so they are not waited for when the stream keeps running
+    if(elementsRead > 0 || elementsDropped > 0) {
+        double dacTime = timeInfo->outputBufferDacTime;
+        if(dacTime <= 0 && timeInfo->currentTime > 0) dacTime = timeInfo->currentTime + pa->mLatency / 1000.0;
+        long long consumed = clockEnd + elementsDropped / channels;
+        long long callbackns = std::chrono::duration_cast<std::chrono::nanoseconds>(callbackStart.time_since_epoch()).count();
+        pa->mClockSeq++;
+        pa->mClockStart = consumed;
+        pa->mClockEnd = consumed + elementsRead / channels;
+        pa->mClockDacTime = dacTime;
+        // The first sample read reaches the DAC first, the dropped ones are skipped after it
+        pa->mClockDacPos = clockEnd;
+        pa->mClockDacns = callbackns + (long long) (dacDelay * 1000000000.0);
+        if(dropFrom >= 0) {
+            if(dropFrom > pa->mClockDropTo || dropFrom < pa->mClockDropFrom) pa->mClockDropFrom = dropFrom;
+            pa->mClockDropTo = consumed + elementsRead / channels;
+        }
+        pa->mClockSeq++;
+    }
+
+    // Wake the writer once enough space is free, sem_post is safe to call from here
+    if(pa->mWaitingForSpace && ringbuf->getWriteAvailable() >= pa->mSpaceWatermark) {
+        if(pa->mWaitingForSpace.exchange(false))
+            sem_post(&pa->mSpaceSem);
+    }
+
+    // Count device underflows, and running empty while more audio is on its way
+    if(statusFlags & paOutputUnderflow)
+        addRelaxed(pa->mUnderflows, 1L);
+    if( elementsRead < frameCount*channels && pa->mUnderrunms == 0 && !pa->mEndOfData && !pa->mStopRequested )
+        addRelaxed(pa->mUnderruns, 1L);
 
     if( elementsRead < frameCount*channels ) {
         memset( (outbuf+(elementsRead)), 0, (frameCount*channels-elementsRead)*sizeof(float) );
-        underrunms += (long) (frameCount * channels * 1000.0) / rate;
-        //LOG4CXX_DEBUG(narratorPaLog, " Less read than requested, underrun ms:" << underrunms );
+        pa->mUnderrunms += (long) (frameCount * channels * 1000.0) / rate;
+        //LOG4CXX_DEBUG(narratorPaLog, " Less read than requested, underrun ms:" << pa->mUnderrunms );
     } else {
         //LOG4CXX_TRACE(narratorPaLog, " availableElements: " << availableElements << " elementsToRead: " << elementsToRead << " elementsRead:" << elementsRead);
-        underrunms = 0;
+        pa->mUnderrunms = 0;
+    }
+
+    // The voices are added as they are played, so they are heard one buffer after they were
+    // written whatever the speech has buffered. A stop of the speech leaves them alone
+    size_t elementsRendered = elementsRead;
+    Mixer *mixer = pa->mMixer;
+    if(mixer != NULL) {
+        mixer->setLatency((long) (dacDelay * 1000));
+        size_t elementsMixed = mixer->mix(outbuf, frameCount * channels);
+        if(elementsMixed > elementsRendered) elementsRendered = elementsMixed;
+        if(elementsMixed > 0) pa->mMixIdlems = 0;
+        else pa->mMixIdlems += (long) (frameCount * 1000.0) / rate;
     }
+    addRelaxed(pa->mFramesRendered, (long long) (elementsRendered / channels));
+
+    long durationns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - callbackStart).count();
+    addRelaxed(pa->mCallbacks, 1L);
+    addRelaxed(pa->mCallbackTotalns, (long long) durationns);
+    if(durationns > pa->mCallbackMaxns.load(std::memory_order_relaxed))
+        pa->mCallbackMaxns.store(durationns, std::memory_order_relaxed);
 
-    if(underrunms > 500) return paComplete;
+    // In standby the stream keeps playing silence until it is stopped
+    if(pa->mUnderrunms > 500 && (mixer == NULL || pa->mMixIdlems > 500) && !pa->mStandby) return paComplete;
 
     return paContinue; // paAbort, paComplete
 }
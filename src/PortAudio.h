@@ -21,9 +21,13 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #define _PORTAUDIO_H
 
 #include <portaudio.h>
+#include <semaphore.h>
+#include <atomic>
 #include "RingBuffer.h"
+#include "AudioSink.h"
+#include "Narrator.h"
 
-class PortAudio {
+class PortAudio : public AudioSink {
     public:
         PortAudio();
         ~PortAudio();
@@ -37,15 +41,64 @@ class PortAudio {
         long getRate();
         int getChannels();
 
+        // Sizes buffers according to profile, a stream open with another profile is reopened on next open
+        void setLatencyProfile(Narrator::LatencyProfile profile);
+        Narrator::LatencyProfile getLatencyProfile();
+
+        // Output latency reported by portaudio (ms) and number of underruns since the object was created
+        long getOutputLatency();
+        long getUnderruns();
+
+        // Reads the callback counters and samples the CPU load of the stream
+        void getStats(Narrator::OutputStats &stats);
+
+        // Tells that all audio has been written, so running empty is not counted as an underrun.
+        // Starts the stream if anything is left to play, including the inputs of the mixer
+        void endOfData();
+
+        // The callback adds the inputs of mixer to every buffer it plays
+        bool setMixer(Mixer *mixer);
+
+        // Makes the callback fade out the next device buffer and drop everything after it,
+        // until stop() is called. Safe to call from any thread
+        void requestStop();
+
+        // Fades out and drops the buffered audio through the callback but keeps the stream running,
+        // waits until the callback has done so (writer thread only)
+        void drop();
+
         // Checks how many samples we can write
         unsigned int getWriteAvailable();
 
-        // Return remaining audio in internal buffers (ms)
+        // Return remaining audio in internal buffers and the device (ms)
         long getRemainingms();
 
+        // Return number of written samples which have not yet been played by the device
+        long long getRemainingSamples();
+
+        // Positions are counted in samples written, the callback tells when they reach the DAC
+        long long getWritePosition();
+        int getPlayedTime(long long position, long long &timeus);
+
+        // Return duration of one device buffer (ms)
+        long getBufferms();
+
         // Writes no more than getWriteAvailable samples
         bool write(float *buffer, unsigned int samples);
 
+        // Returns up to two regions in the ringbuffer where at most samples can be written
+        // directly, returns the total number of samples in the regions.
+        // Returns 0 if the next sample is split around the end of the ringbuffer, use write() then
+        unsigned int getWriteRegions(unsigned int samples, float **data1, unsigned int *samples1, float **data2, unsigned int *samples2);
+
+        // Commits samples written into the write regions
+        bool commitWrite(unsigned int samples);
+
+        // In standby the stream keeps running on silence when the buffer runs empty,
+        // and a stopped stream starts as soon as one device buffer has been written
+        void setStandby(bool standby);
+        bool getStandby();
+
     private:
         bool isInitialized;
         bool isOpen;
@@ -61,6 +114,60 @@ class PortAudio {
 
         RingBuffer ringbuf;
 
+        // Posted from the callback when free space crosses the watermark while the writer waits
+        sem_t mSpaceSem;
+        std::atomic<bool> mWaitingForSpace;
+        size_t mSpaceWatermark;
+
+        std::atomic<bool> mStandby;
+        long mUnderrunms;
+
+        // Voices added by the callback, which keeps the stream running while they play
+        std::atomic<Mixer *> mMixer;
+        long mMixIdlems;
+
+        Narrator::LatencyProfile mProfile;
+        Narrator::LatencyProfile mOpenProfile;
+        size_t mStartThreshold;
+        std::atomic<bool> mEndOfData;
+        long mBufferms;
+
+        // Telemetry, only written by the callback so plain loads and stores are enough
+        std::atomic<long> mUnderruns;           // Ran empty while more audio was on its way
+        std::atomic<long> mUnderflows;          // paOutputUnderflow reported by the device
+        std::atomic<long> mCallbacks;
+        std::atomic<long long> mFramesRendered;
+        std::atomic<long long> mCallbackTotalns;
+        std::atomic<long> mCallbackMaxns;
+        double mCpuLoad;                        // Last sampled Pa_GetStreamCpuLoad
+        std::atomic<long> mStops;
+        std::atomic<long long> mStopLastns;     // Time from requestStop until the faded buffer reached the DAC
+        std::atomic<long long> mStopMaxns;
+
+        // Stop requests, each one is faded out once by the callback
+        std::atomic<bool> mStopRequested;
+        std::atomic<unsigned int> mStopRequests;
+        std::atomic<long long> mStopRequestns;  // steady_clock time of the last request
+        unsigned int mStopsHandled;             // Only changed while the callback is not running
+
+        // Playback clock, updated by the callback under a sequence counter.
+        // Samples are counted from when the sink was created
+        std::atomic<unsigned int> mClockSeq;
+        std::atomic<long long> mClockStart;     // Samples consumed before the last callback
+        std::atomic<long long> mClockEnd;       // Samples consumed after the last callback
+        std::atomic<double> mClockDacTime;      // Stream time when mClockStart reaches the DAC, 0 if unknown
+        std::atomic<long long> mClockDacPos;    // Sample which reaches the DAC at mClockDacns (steady_clock),
+        std::atomic<long long> mClockDacns;     // kept when the clock is reset
+        std::atomic<long long> mClockDropFrom;  // Samples after mClockDropFrom up to mClockDropTo were
+        std::atomic<long long> mClockDropTo;    // dropped by the last stop
+        std::atomic<long long> mSamplesWritten;
+
+        void resetClock();
+
+        bool waitForSpace(long timeoutms);
+        void startWhenBuffered();
+        void startStream();
+
         friend int pa_stream_callback(
                 const void *input,
                 void *output,
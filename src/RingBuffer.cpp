@@ -19,195 +19,160 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 
 #include "RingBuffer.h"
 #include <cassert>
-#include <malloc.h>
 #include <memory.h>
 
 #include <iostream>
 
 RingBuffer::RingBuffer():
     buffer(0),
-    maxIndex(0),
-    readIndex(0),
+    mSize(0),
+    mMask(0),
     writeIndex(0),
-    full(0),
-    bufMutex()
+    readIndex(0)
 {
-    // Initialize buffer mutex
-    pthread_mutex_init(&bufMutex, NULL);
-    pthread_mutex_lock(&bufMutex);
-    pthread_mutex_unlock(&bufMutex);
 }
 
 RingBuffer::RingBuffer(size_t elements):
     buffer(0),
-    maxIndex(0),
-    readIndex(0),
+    mSize(0),
+    mMask(0),
     writeIndex(0),
-    full(0),
-    bufMutex()
+    readIndex(0)
 {
-    // Initialize buffer mutex
-    pthread_mutex_init(&bufMutex, NULL);
-    pthread_mutex_lock(&bufMutex);
-    pthread_mutex_unlock(&bufMutex);
     initialize(elements);
 }
 
 RingBuffer::~RingBuffer()
 {
-    pthread_mutex_unlock(&bufMutex);
-    pthread_mutex_destroy(&bufMutex);
+    if(buffer != NULL) delete [] buffer;
 }
 
 const size_t RingBuffer::initialize(const size_t elements)
 {
-    if(buffer != NULL) delete buffer;
-    writeIndex = 0;
-    readIndex = 0;
-    maxIndex = 0;
+    if(buffer != NULL) delete [] buffer;
+    buffer = NULL;
+    writeIndex.store(0);
+    readIndex.store(0);
+    mSize = 0;
+    mMask = 0;
 
-    buffer = new float[elements];
+    // Round up to a power of two so that indices can be masked
+    size_t size = 1;
+    while(size < elements) size <<= 1;
+
+    buffer = new float[size];
 
     if(buffer == NULL) return 0;
-    maxIndex = elements;
+    mSize = size;
+    mMask = size - 1;
 
-    memset(buffer, 0, elements * sizeof(float));
+    memset(buffer, 0, size * sizeof(float));
 
-    return elements;
+    return size;
 }
 
-const size_t RingBuffer::_getReadAvailable()
+const size_t RingBuffer::getReadAvailable()
 {
-    if(full) return maxIndex;
-    if(writeIndex >= readIndex) return writeIndex - readIndex;
-    return maxIndex - readIndex + writeIndex;
+    size_t rIndex = readIndex.load(std::memory_order_acquire);
+    size_t wIndex = writeIndex.load(std::memory_order_acquire);
+    return wIndex - rIndex;
 }
 
-const size_t RingBuffer::getReadAvailable()
+const size_t RingBuffer::getWriteAvailable()
 {
-    size_t elements = 0;
+    return mSize - getReadAvailable();
+}
+
+const size_t RingBuffer::getWriteRegions(size_t elements, float **data1, size_t *size1, float **data2, size_t *size2)
+{
+    // The reader may only free more space while we are writing
+    size_t wIndex = writeIndex.load(std::memory_order_relaxed);
+    size_t rIndex = readIndex.load(std::memory_order_acquire);
+    size_t available = mSize - (wIndex - rIndex);
 
-    pthread_mutex_lock(&bufMutex);
-    elements = _getReadAvailable();
-    pthread_mutex_unlock(&bufMutex);
+    if(elements > available) elements = available;
 
+    splitRegions(wIndex & mMask, elements, data1, size1, data2, size2);
     return elements;
 }
 
-const size_t RingBuffer::_getWriteAvailable()
+const size_t RingBuffer::commitWrite(size_t elements)
 {
-    if(full) return 0;
-    if(writeIndex >= readIndex) return maxIndex - writeIndex + readIndex;
-    return readIndex - writeIndex;
+    // Publish the data to the reader
+    size_t wIndex = writeIndex.load(std::memory_order_relaxed);
+    writeIndex.store(wIndex + elements, std::memory_order_release);
+    return elements;
 }
 
-const size_t RingBuffer::getWriteAvailable()
+const size_t RingBuffer::getReadRegions(size_t elements, float **data1, size_t *size1, float **data2, size_t *size2)
 {
-    size_t elements = 0;
+    // The writer may only add more data while we are reading
+    size_t rIndex = readIndex.load(std::memory_order_relaxed);
+    size_t wIndex = writeIndex.load(std::memory_order_acquire);
+    size_t available = wIndex - rIndex;
 
-    pthread_mutex_lock(&bufMutex);
-    elements = _getWriteAvailable();
-    pthread_mutex_unlock(&bufMutex);
+    if(elements > available) elements = available;
 
+    splitRegions(rIndex & mMask, elements, data1, size1, data2, size2);
     return elements;
 }
 
-void RingBuffer::_advanceWriteIndex(const size_t elements)
+const size_t RingBuffer::commitRead(size_t elements)
 {
-    //std::cout << __FUNCTION__ << " readIndex " << readIndex << " writeIndex " << writeIndex << " elements " << elements << //std::endl;
-    //std::cout << __FUNCTION__ << " maxIndex  " << maxIndex << " (writeIndex + elements) " << (writeIndex + elements) << //std::endl;
-    if(writeIndex + elements < maxIndex) writeIndex += elements;
-    else writeIndex = (writeIndex + elements) - maxIndex;
-    //std::cout << __FUNCTION__ << " readIndex " << readIndex << " writeIndex " << writeIndex << " elements " << elements << //std::endl;
+    // Hand the space back to the writer
+    size_t rIndex = readIndex.load(std::memory_order_relaxed);
+    readIndex.store(rIndex + elements, std::memory_order_release);
+    return elements;
 }
 
 const size_t RingBuffer::writeElements(const float * source, size_t elements)
 {
-    //std::cout << __FUNCTION__ << " readIndex " << readIndex << " writeIndex " << writeIndex << //std::endl;
-    pthread_mutex_lock(&bufMutex);
-    size_t available = _getWriteAvailable();
-    size_t wIndex = writeIndex;
-    pthread_mutex_unlock(&bufMutex);
+    float *data1, *data2;
+    size_t size1, size2;
 
-    if(elements > available) elements = available;
-
-    // If write is contiguous all data can be copied at once
-    if(wIndex + elements <= maxIndex) {
-        //std::cout << __FUNCTION__ << " writing " << elements << " continuously at pos " << writeIndex << //std::endl;
-        memcpy(buffer + wIndex, source, elements * sizeof(float));
-
-    } // ..if not we need two separate writes
-    else {
-        size_t rightSize = maxIndex - wIndex;
-        size_t leftSize = elements - rightSize;
+    elements = getWriteRegions(elements, &data1, &size1, &data2, &size2);
+    if(elements == 0) return 0;
 
-        // Write right part of buffer
-        //std::cout << __FUNCTION__ << " writing right part of size " << rightSize << " elements at pos " << writeIndex << //std::endl;
-        memcpy(buffer + wIndex, source, rightSize * sizeof(float));
+    memcpy(data1, source, size1 * sizeof(float));
+    if(size2 > 0) memcpy(data2, source + size1, size2 * sizeof(float));
 
-        // Write the rest to left part of buffer
-        //std::cout << __FUNCTION__ << " writing left part of size " << leftSize << " elements at pos 0" << //std::endl;
-        memcpy(buffer, source + rightSize, leftSize * sizeof(float));
-    }
-
-    pthread_mutex_lock(&bufMutex);
-    _advanceWriteIndex(elements);
-    if(writeIndex == readIndex) full = true;
-    pthread_mutex_unlock(&bufMutex);
-
-    return elements;
-}
-
-void RingBuffer::_advanceReadIndex(const size_t elements)
-{
-    //std::cout << __FUNCTION__ << " readIndex " << readIndex << " writeIndex " << writeIndex << " elements " << elements << //std::endl;
-    if(readIndex + elements < maxIndex) readIndex += elements;
-    else readIndex = (readIndex + elements) - maxIndex;
-    //else readIndex = maxIndex - (readIndex + elements) + 1;
-    //std::cout << __FUNCTION__ << " readIndex " << readIndex << " writeIndex " << writeIndex << " elements " << elements << //std::endl;
+    return commitWrite(elements);
 }
 
 const size_t RingBuffer::readElements(float *data, size_t elements)
 {
-    //std::cout << __FUNCTION__ << " readIndex " << readIndex << " writeIndex " << writeIndex << //std::endl;
-    pthread_mutex_lock(&bufMutex);
-    size_t available = _getReadAvailable();
-    size_t rIndex = readIndex;
-    pthread_mutex_unlock(&bufMutex);
-
-    if(elements > available) elements = available;
+    float *data1, *data2;
+    size_t size1, size2;
 
-    // If read is contiguous all data can be copied at once
-    if(rIndex + elements <= maxIndex) {
-        //std::cout << __FUNCTION__ << " reading " << elements << " continuously at pos " << readIndex << //std::endl;
-        memcpy(data, buffer + rIndex, elements * sizeof(float));
+    elements = getReadRegions(elements, &data1, &size1, &data2, &size2);
+    if(elements == 0) return 0;
 
-    } // ..if not we need two separate reads
-    else {
-        size_t rightSize = maxIndex - rIndex;
-        size_t leftSize = elements - rightSize;
+    memcpy(data, data1, size1 * sizeof(float));
+    if(size2 > 0) memcpy(data + size1, data2, size2 * sizeof(float));
 
-        // Read the right part of the buffer
-        //std::cout << __FUNCTION__ << " reading right part of size " << rightSize << " elements from pos " << readIndex << //std::endl;
-        memcpy(data, buffer + rIndex, rightSize * sizeof(float));
+    return commitRead(elements);
+}
 
-        // Read the rest from the left part the buffer
-        //std::cout << __FUNCTION__ << " reading left part of size " << leftSize << " elements from pos 0" << //std::endl;
-        memcpy(data + rightSize, buffer, leftSize * sizeof(float));
+void RingBuffer::splitRegions(size_t pos, size_t elements, float **data1, size_t *size1, float **data2, size_t *size2)
+{
+    // If the region is contiguous everything fits in the first part
+    if(pos + elements <= mSize) {
+        *data1 = buffer + pos;
+        *size1 = elements;
+        *data2 = NULL;
+        *size2 = 0;
+
+    } // ..if not the rest continues from the start of the buffer
+    else {
+        *data1 = buffer + pos;
+        *size1 = mSize - pos;
+        *data2 = buffer;
+        *size2 = elements - *size1;
     }
-
-    pthread_mutex_lock(&bufMutex);
-    _advanceReadIndex(elements);
-    if(elements) full = false;
-    pthread_mutex_unlock(&bufMutex);
-
-    return elements;
 }
 
 void RingBuffer::flush()
 {
-    pthread_mutex_lock(&bufMutex);
-    readIndex = writeIndex = 0;
-    full = false;
-    pthread_mutex_unlock(&bufMutex);
+    // Discard by moving the reader up to the writer
+    readIndex.store(writeIndex.load(std::memory_order_acquire), std::memory_order_release);
 }
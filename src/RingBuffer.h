@@ -20,17 +20,26 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #ifndef _RINGBUFFER_H
 #define _RINGBUFFER_H
 
-#include <pthread.h>
+#include <cstddef>
+#include <atomic>
 
+// Size of a cache line, the read and write indices are kept on separate lines
+#define RINGBUFFER_CACHELINE 64
+
+// Wait-free ringbuffer for one writing thread and one reading thread.
+// The indices run freely and are masked on access, so the size is always a power of two
 class RingBuffer {
     public:
         RingBuffer();
         RingBuffer(size_t elements);
         ~RingBuffer();
 
-        // Initializes a buffer of size elements
+        // Initializes a buffer of at least size elements, must not be called while reading or writing
         const size_t initialize(const size_t elements);
 
+        // Returns the number of elements the buffer can hold
+        const size_t getSize() { return mSize; };
+
         // Returns number of elements available for read
         const size_t getReadAvailable();
 
@@ -38,29 +47,50 @@ class RingBuffer {
         const size_t getWriteAvailable();
 
         // Writes specified number of elements into ringbuffer from source, returns number of elements actually written
+        // (writing thread only)
         const size_t writeElements(const float * data, size_t elements);
 
         // Reads specified number of elements from ringbuffer into target, returns number of elements actually read
+        // (reading thread only)
         const size_t readElements(float *data, size_t elements);
 
-        // Flushes all data in ringbuffer
+        // Returns up to two contiguous regions where at most elements can be written directly,
+        // returns the total number of elements in the regions (writing thread only)
+        const size_t getWriteRegions(size_t elements, float **data1, size_t *size1, float **data2, size_t *size2);
+
+        // Makes elements written into the write regions available for read (writing thread only)
+        const size_t commitWrite(size_t elements);
+
+        // Returns up to two contiguous regions where at most elements can be read directly,
+        // returns the total number of elements in the regions (reading thread only)
+        const size_t getReadRegions(size_t elements, float **data1, size_t *size1, float **data2, size_t *size2);
+
+        // Releases elements read from the read regions for writing (reading thread only)
+        const size_t commitRead(size_t elements);
+
+        // Flushes all data in ringbuffer, must not be called while another thread is reading
         void flush();
 
     private:
-        const size_t _getReadAvailable();
-        const size_t _getWriteAvailable();
+        void splitRegions(size_t pos, size_t elements, float **data1, size_t *size1, float **data2, size_t *size2);
 
-        void _advanceReadIndex(const size_t elements);
-        void _advanceWriteIndex(const size_t elements);
+        char padFront[RINGBUFFER_CACHELINE];
 
         float *buffer;
-        pthread_mutex_t bufMutex;
+        size_t mSize;
+        size_t mMask;
+
+        char padBuffer[RINGBUFFER_CACHELINE];
+
+        // Only changed by the writing thread
+        std::atomic<size_t> writeIndex;
+
+        char padWrite[RINGBUFFER_CACHELINE];
 
-        size_t maxIndex;
-        size_t readIndex;
-        size_t writeIndex;
-        bool full;
+        // Only changed by the reading thread
+        std::atomic<size_t> readIndex;
 
+        char padRead[RINGBUFFER_CACHELINE];
 };
 
 #endif
@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SilenceDetector.h"
+#include "OggStream.h"
+#include "Mp3Stream.h"
+
+#include <cmath>
+#include <log4cxx/logger.h>
+
+#define ANALYZE_FRAMES 1024
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorSdLog(log4cxx::Logger::getLogger("kolibre.narrator.silencedetector"));
+
+SilenceDetector::SilenceDetector()
+{
+    reset(0, 0);
+}
+
+void SilenceDetector::reset(long rate, int channels)
+{
+    mRate = rate;
+    mChannels = channels;
+    mPosition = 0;
+    mFirstAudible = -1;
+    mLastAudible = -1;
+}
+
+void SilenceDetector::process(const float *buffer, long frames)
+{
+    if(mChannels <= 0 || frames <= 0) return;
+
+    for(long i = 0; i < frames; i++) {
+        for(int c = 0; c < mChannels; c++) {
+            if(fabsf(buffer[i * mChannels + c]) > SILENCE_THRESHOLD) {
+                if(mFirstAudible < 0) mFirstAudible = mPosition + i;
+                mLastAudible = mPosition + i;
+                break;
+            }
+        }
+    }
+    mPosition += frames;
+}
+
+bool SilenceDetector::getRange(long &start, long &end)
+{
+    if(mPosition == 0) return false;
+
+    if(mFirstAudible < 0) {
+        start = 0;
+        end = mPosition;
+        return true;
+    }
+
+    long padding = mRate * SILENCE_PADDING_MS / 1000;
+
+    start = mFirstAudible - padding;
+    if(start < 0) start = 0;
+    end = mLastAudible + 1 + padding;
+    if(end > mPosition) end = mPosition;
+
+    return true;
+}
+
+bool SilenceDetector::analyze(const MessageAudio &ma, long &start, long &end)
+{
+    AudioStream *audioStream;
+
+    if(ma.getEncoding() == "ogg") audioStream = new OggStream;
+    else if(ma.getEncoding() == "mp3") audioStream = new Mp3Stream;
+    else {
+        LOG4CXX_WARN(narratorSdLog, "encoding '" << ma.getEncoding() << "' can not be analyzed");
+        return false;
+    }
+
+    if(!audioStream->open(ma)) {
+        LOG4CXX_WARN(narratorSdLog, "error opening audio stream for analysis");
+        audioStream->close();
+        delete audioStream;
+        return false;
+    }
+
+    reset(audioStream->getRate(), audioStream->getChannels());
+
+    float *buffer = new float[mChannels * ANALYZE_FRAMES];
+    long frames = 0;
+    while((frames = audioStream->read(buffer, ANALYZE_FRAMES)) > 0)
+        process(buffer, frames);
+
+    delete [] buffer;
+    audioStream->close();
+    delete audioStream;
+
+    if(!getRange(start, end)) return false;
+
+    LOG4CXX_DEBUG(narratorSdLog, "Audible range of '" << ma.getText() << "' is " << start << "-" << end << " of " << mPosition << " frames");
+    return true;
+}
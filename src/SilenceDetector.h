@@ -0,0 +1,57 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SILENCEDETECTOR_H
+#define _SILENCEDETECTOR_H
+
+#include "Message.h"
+
+// Samples below this level are considered silent (about -50 dBFS)
+#define SILENCE_THRESHOLD 0.0032f
+
+// Silence kept before the first and after the last audible sample
+#define SILENCE_PADDING_MS 20
+
+// Finds the audible part of a clip so leading and trailing silence can be skipped
+class SilenceDetector {
+    public:
+        SilenceDetector();
+
+        // Starts a new scan of audio with given rate and channels
+        void reset(long rate, int channels);
+
+        // Scans frames (1 frame contains data from all channels), frames must be passed in order
+        void process(const float *buffer, long frames);
+
+        // Calculates the range of frames to play, end is exclusive.
+        // A clip which is silent throughout is kept as it is (e.g. pauses)
+        bool getRange(long &start, long &end);
+
+        // Decodes a complete clip and calculates the range of frames to play
+        bool analyze(const MessageAudio &ma, long &start, long &end);
+
+    private:
+        long mRate;
+        int mChannels;
+        long mPosition;
+        long mFirstAudible;
+        long mLastAudible;
+};
+
+#endif
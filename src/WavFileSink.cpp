@@ -0,0 +1,186 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WavFileSink.h"
+
+#include <log4cxx/logger.h>
+
+// Elements accepted per write
+#define WAVFILESINK_CHUNK 4096
+
+// Size of the header written by writeHeader
+#define WAV_HEADER_BYTES 58
+
+// create logger which will become a child to logger kolibre.narrator
+log4cxx::LoggerPtr narratorWsLog(log4cxx::Logger::getLogger("kolibre.narrator.wavfilesink"));
+
+// WAV files are little endian regardless of host
+static void putLE(unsigned char *&p, unsigned long value, int bytes)
+{
+    for(int i = 0; i < bytes; i++) *p++ = (value >> (8 * i)) & 0xff;
+}
+
+static void putTag(unsigned char *&p, const char *tag)
+{
+    for(int i = 0; i < 4; i++) *p++ = tag[i];
+}
+
+WavFileSink::WavFileSink(const std::string &path)
+{
+    mBasePath = path;
+    mFileIndex = 0;
+    pFile = NULL;
+    mRate = 0;
+    mChannels = 0;
+    mDataBytes = 0;
+}
+
+WavFileSink::~WavFileSink()
+{
+    close();
+}
+
+bool WavFileSink::open(long rate, int channels)
+{
+    if(pFile != NULL && mRate == rate && mChannels == channels) return true;
+    if(rate <= 0 || channels <= 0) return false;
+
+    // Each file holds one format, so continue in a new file after a change
+    if(pFile != NULL) close();
+
+    mPath = indexedPath(mBasePath, mFileIndex);
+
+    pFile = fopen(mPath.c_str(), "wb");
+    if(pFile == NULL) {
+        LOG4CXX_ERROR(narratorWsLog, "Failed to open '" << mPath << "' for writing");
+        return false;
+    }
+
+    LOG4CXX_DEBUG(narratorWsLog, "Writing audio to '" << mPath << "', channels: " << channels << ", rate: " << rate);
+
+    mFileIndex++;
+    mRate = rate;
+    mChannels = channels;
+    mDataBytes = 0;
+
+    return writeHeader();
+}
+
+long WavFileSink::stop()
+{
+    // Everything written is already in the file
+    endOfData();
+    return 0;
+}
+
+bool WavFileSink::close()
+{
+    if(pFile == NULL) return true;
+
+    writeHeader();
+    fclose(pFile);
+    pFile = NULL;
+    mRate = 0;
+    mChannels = 0;
+    return true;
+}
+
+long WavFileSink::getRate()
+{
+    return mRate;
+}
+
+int WavFileSink::getChannels()
+{
+    return mChannels;
+}
+
+std::string WavFileSink::getPath()
+{
+    return mPath;
+}
+
+unsigned int WavFileSink::getWriteAvailable()
+{
+    if(pFile == NULL) return 0;
+    return WAVFILESINK_CHUNK;
+}
+
+bool WavFileSink::write(float *buffer, unsigned int samples)
+{
+    if(pFile == NULL) return false;
+
+    // Samples are written in host order, which is little endian on all supported platforms
+    size_t elements = fwrite(buffer, sizeof(float), samples * mChannels, pFile);
+    mDataBytes += elements * sizeof(float);
+
+    return elements == samples * mChannels;
+}
+
+long WavFileSink::getRemainingms()
+{
+    return 0;
+}
+
+void WavFileSink::endOfData()
+{
+    if(pFile == NULL) return;
+
+    writeHeader();
+    fflush(pFile);
+}
+
+/*
+   Writes a WAVE_FORMAT_IEEE_FLOAT header for the data written so far and returns to the end of the file
+*/
+bool WavFileSink::writeHeader()
+{
+    unsigned char header[WAV_HEADER_BYTES];
+    unsigned char *p = header;
+
+    putTag(p, "RIFF");
+    putLE(p, WAV_HEADER_BYTES - 8 + mDataBytes, 4);
+    putTag(p, "WAVE");
+
+    putTag(p, "fmt ");
+    putLE(p, 18, 4);
+    putLE(p, 3, 2);                                     // IEEE float
+    putLE(p, mChannels, 2);
+    putLE(p, mRate, 4);
+    putLE(p, mRate * mChannels * sizeof(float), 4);     // Bytes per second
+    putLE(p, mChannels * sizeof(float), 2);             // Block align
+    putLE(p, 8 * sizeof(float), 2);                     // Bits per sample
+    putLE(p, 0, 2);
+
+    putTag(p, "fact");
+    putLE(p, 4, 4);
+    putLE(p, mDataBytes / (mChannels * sizeof(float)), 4);
+
+    putTag(p, "data");
+    putLE(p, mDataBytes, 4);
+
+    if(fseek(pFile, 0, SEEK_SET) != 0 || fwrite(header, 1, WAV_HEADER_BYTES, pFile) != WAV_HEADER_BYTES) {
+        LOG4CXX_ERROR(narratorWsLog, "Failed to write header to '" << mPath << "'");
+        fseek(pFile, 0, SEEK_END);
+        return false;
+    }
+
+    fseek(pFile, 0, SEEK_END);
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WAVFILESINK_H
+#define _WAVFILESINK_H
+
+#include "AudioSink.h"
+#include <string>
+#include <cstdio>
+
+// Sink which writes all audio as 32 bit float samples to a WAV file as fast as possible.
+// If the rate or channels change a new file is started with an index appended to the name
+class WavFileSink : public AudioSink {
+    public:
+        WavFileSink(const std::string &path);
+        ~WavFileSink();
+
+        bool open(long rate, int channels);
+        long stop();
+        bool close();
+
+        long getRate();
+        int getChannels();
+
+        unsigned int getWriteAvailable();
+        bool write(float *buffer, unsigned int samples);
+        long getRemainingms();
+
+        // Updates the header so the file is complete up to here
+        void endOfData();
+
+        // Path of the file currently written
+        std::string getPath();
+
+    private:
+        std::string mBasePath;
+        std::string mPath;
+        int mFileIndex;
+        FILE *pFile;
+
+        long mRate;
+        int mChannels;
+        unsigned long mDataBytes;
+
+        bool writeHeader();
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <NullSink.h>
+#include <WavFileSink.h>
+#include <MemorySink.h>
+#include "setup_logging.h"
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <sys/time.h>
+
+using namespace std;
+
+#define RATE 8000
+#define CHANNELS 2
+#define FRAMES 800
+
+double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+unsigned long readLE(const unsigned char *p, int bytes)
+{
+    unsigned long value = 0;
+    for(int i = bytes - 1; i >= 0; i--) value = (value << 8) | p[i];
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    setup_logging();
+
+    float buffer[FRAMES * CHANNELS];
+    for(int i = 0; i < FRAMES * CHANNELS; i++) buffer[i] = (i % 100) / 100.0;
+
+    // Descriptions understood by the factory
+    assert(AudioSink::isValid("portaudio"));
+    assert(AudioSink::isValid("null"));
+    assert(AudioSink::isValid("null-realtime"));
+    assert(AudioSink::isValid("wav:/tmp/out.wav"));
+    assert(AudioSink::isValid("ogg:/tmp/out.ogg"));
+    assert(!AudioSink::isValid("wav:"));
+    assert(!AudioSink::isValid("alsa"));
+    assert(AudioSink::create("alsa") == NULL);
+
+    // The null sink consumes everything at once
+    NullSink null(false);
+    assert(null.open(RATE, CHANNELS));
+    double start = now();
+    for(int i = 0; i < 100; i++) {
+        assert(null.getWriteAvailable() > 0);
+        null.write(buffer, FRAMES);
+    }
+    assert(null.getSamplesWritten() == 100 * FRAMES);
+    assert(null.getRemainingms() == 0);
+    assert(now() - start < 1.0);
+
+    // The real-time null sink takes as long as the audio would play
+    NullSink realtime(true);
+    assert(realtime.open(RATE, CHANNELS));
+    start = now();
+    long written = 0;
+    while(written < 5 * FRAMES) {
+        unsigned int available = realtime.getWriteAvailable() / CHANNELS;
+        assert(available > 0);
+        unsigned int frames = available < FRAMES ? available : FRAMES;
+        realtime.write(buffer, frames);
+        written += frames;
+    }
+    assert(realtime.getRemainingms() > 0);
+    assert(realtime.getRemainingms() <= NULLSINK_BUFFER_MS);
+    assert(realtime.waitForPlayback(1000) == 0);
+    double elapsed = now() - start;
+    cout << "real-time null sink played 500 ms in " << (elapsed * 1000) << " ms" << endl;
+    assert(elapsed > 0.45 && elapsed < 0.8);
+
+    // Stopping discards what has not been played
+    realtime.write(buffer, FRAMES);
+    assert(realtime.getRemainingms() > 0);
+    realtime.stop();
+    assert(realtime.getRemainingms() == 0);
+
+    // The wav sink writes a float wav file
+    const char *path = "audiosink.wav";
+    {
+        WavFileSink wav(path);
+        assert(wav.open(RATE, CHANNELS));
+        assert(wav.write(buffer, FRAMES));
+        assert(wav.write(buffer, FRAMES));
+        assert(wav.getRemainingms() == 0);
+        wav.close();
+    }
+
+    FILE *file = fopen(path, "rb");
+    assert(file != NULL);
+    unsigned char header[58];
+    assert(fread(header, 1, sizeof(header), file) == sizeof(header));
+    assert(memcmp(header, "RIFF", 4) == 0);
+    assert(readLE(header + 4, 4) == 50 + 2 * FRAMES * CHANNELS * sizeof(float));
+    assert(memcmp(header + 8, "WAVEfmt ", 8) == 0);
+    assert(readLE(header + 20, 2) == 3);
+    assert(readLE(header + 22, 2) == CHANNELS);
+    assert(readLE(header + 24, 4) == RATE);
+    assert(readLE(header + 34, 2) == 32);
+    assert(memcmp(header + 38, "fact", 4) == 0);
+    assert(readLE(header + 46, 4) == 2 * FRAMES);
+    assert(memcmp(header + 50, "data", 4) == 0);
+    assert(readLE(header + 54, 4) == 2 * FRAMES * CHANNELS * sizeof(float));
+
+    float samples[FRAMES * CHANNELS];
+    assert(fread(samples, sizeof(float), FRAMES * CHANNELS, file) == FRAMES * CHANNELS);
+    assert(memcmp(samples, buffer, sizeof(samples)) == 0);
+    fclose(file);
+    remove(path);
+
+    // A format change continues in a new file
+    {
+        WavFileSink wav(path);
+        assert(wav.open(RATE, CHANNELS));
+        assert(wav.getPath() == path);
+        assert(wav.open(RATE * 2, 1));
+        assert(wav.getPath() == "audiosink-1.wav");
+    }
+    remove(path);
+    remove("audiosink-1.wav");
+    assert(AudioSink::indexedPath("/tmp/a.b/out", 2) == "/tmp/a.b/out-2");
+
+    // Memory sink collects everything written in one format
+    MemorySink memory;
+    assert(memory.getWriteAvailable() == 0);
+    assert(memory.open(RATE, CHANNELS));
+    assert(memory.getWriteAvailable() > 0);
+    assert(memory.write(buffer, FRAMES));
+    assert(memory.write(buffer, FRAMES / 2));
+    assert(memory.getSamples().size() == (FRAMES + FRAMES / 2) * CHANNELS);
+    assert(memcmp(&memory.getSamples()[FRAMES * CHANNELS], buffer, FRAMES / 2 * CHANNELS * sizeof(float)) == 0);
+    assert(memory.open(RATE, CHANNELS));
+    assert(!memory.open(RATE * 2, CHANNELS));
+    assert(memory.getRate() == RATE);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <sys/utsname.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+/*
+ * Helpers shared by the benchmarks. Results are written as JSON with one benchmark per line,
+ * so that a stored baseline can be read back without a JSON parser
+ */
+
+// Results of one benchmark, metrics ending in _per_second are better when higher and
+// metrics ending in _us or _ns better when lower. The others, and the p99_ and max_
+// latencies which vary too much between runs, are only reported
+struct BenchResult {
+    string name;
+    vector< pair<string, double> > metrics;
+
+    BenchResult(const string &n): name(n) {}
+    void add(const string &key, double value) { metrics.push_back(make_pair(key, value)); }
+};
+
+// Monotonic time in nanoseconds
+static long long bench_nowns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Value below which the fraction p of the samples lie, sorts the samples
+static double bench_percentile(vector<double> &samples, double p)
+{
+    if(samples.empty()) return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t idx = (size_t)(p * (samples.size() - 1) + 0.5);
+    return samples[idx];
+}
+
+// Architecture the results were measured on, results are only compared on the same one
+static string bench_arch()
+{
+    struct utsname name;
+    if(uname(&name) != 0) return "unknown";
+    return name.machine;
+}
+
+static bool bench_write(const string &path, const string &suite, const vector<BenchResult> &results)
+{
+    ofstream out(path.c_str());
+    if(!out) return false;
+    out.precision(10);
+
+    out << "{\"suite\": \"" << suite << "\", \"arch\": \"" << bench_arch() << "\", \"compiler\": \"" << __VERSION__ << "\"," << endl;
+    out << "\"benchmarks\": [" << endl;
+    for(size_t i = 0; i < results.size(); i++) {
+        out << "{\"name\": \"" << results[i].name << "\"";
+        for(size_t j = 0; j < results[i].metrics.size(); j++)
+            out << ", \"" << results[i].metrics[j].first << "\": " << results[i].metrics[j].second;
+        out << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "]}" << endl;
+    return out.good();
+}
+
+// Reads the metrics of each benchmark and the architecture from a file written by bench_write
+static bool bench_read(const string &path, string &arch, map<string, map<string, double> > &results)
+{
+    ifstream in(path.c_str());
+    if(!in) return false;
+
+    string line;
+    while(getline(in, line)) {
+        size_t pos = line.find("\"arch\": \"");
+        if(pos != string::npos) {
+            pos += 9;
+            arch = line.substr(pos, line.find('"', pos) - pos);
+        }
+
+        if(line.compare(0, 10, "{\"name\": \"") != 0) continue;
+        pos = 10;
+        string name = line.substr(pos, line.find('"', pos) - pos);
+
+        // The remaining pairs are "key": number
+        pos = line.find('"', pos) + 1;
+        while((pos = line.find('"', pos)) != string::npos) {
+            size_t end = line.find('"', pos + 1);
+            if(end == string::npos) break;
+            string key = line.substr(pos + 1, end - pos - 1);
+            results[name][key] = atof(line.c_str() + end + 2);
+            pos = line.find(',', end);
+            if(pos == string::npos) break;
+        }
+    }
+    return true;
+}
+
+/*
+ * Compares the results with a baseline written by bench_write and reports the metrics which got worse
+ * by more than NARRATOR_BENCH_TOLERANCE (a fraction, 0.2 by default). Returns the number of regressions,
+ * a missing baseline or one from another architecture is not compared
+ */
+static int bench_compare(const vector<BenchResult> &results, const string &path)
+{
+    string arch;
+    map<string, map<string, double> > baseline;
+    if(!bench_read(path, arch, baseline)) {
+        cerr << "No baseline in " << path << ", not comparing" << endl;
+        return 0;
+    }
+    if(arch != bench_arch()) {
+        cerr << "Baseline " << path << " is for " << arch << ", not comparing" << endl;
+        return 0;
+    }
+
+    double tolerance = 0.2;
+    const char *env = getenv("NARRATOR_BENCH_TOLERANCE");
+    if(env != NULL) tolerance = atof(env);
+
+    int regressions = 0;
+    for(size_t i = 0; i < results.size(); i++) {
+        if(baseline.find(results[i].name) == baseline.end()) continue;
+        map<string, double> &old = baseline[results[i].name];
+
+        for(size_t j = 0; j < results[i].metrics.size(); j++) {
+            const string &key = results[i].metrics[j].first;
+            double value = results[i].metrics[j].second;
+            if(old.find(key) == old.end() || old[key] <= 0) continue;
+
+            double change = value / old[key] - 1;
+            bool higherBetter = key.size() > 11 && key.compare(key.size() - 11, 11, "_per_second") == 0;
+            bool lowerBetter = key.size() > 3 && (key.compare(key.size() - 3, 3, "_us") == 0 || key.compare(key.size() - 3, 3, "_ns") == 0)
+                && key.compare(0, 4, "p99_") != 0 && key.compare(0, 4, "max_") != 0;
+
+            if((higherBetter && change < -tolerance) || (lowerBetter && change > tolerance)) {
+                cerr << "REGRESSION " << results[i].name << " " << key << ": " << old[key] << " -> " << value
+                     << " (" << (int)(change * 100) << "%)" << endl;
+                regressions++;
+            }
+        }
+    }
+    return regressions;
+}
+
+#endif
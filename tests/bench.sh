@@ -0,0 +1,41 @@
+#!/bin/sh
+
+# Builds a database per language from the prompts, runs the benchmarks on them and on the test
+# data and compares the results with the baseline stored for this architecture. BENCH_BASELINE=store
+# stores the results as the new baseline instead, NARRATOR_BENCH_TOLERANCE sets how much worse a
+# result may get (0.2)
+
+toppkgdir=${srcdir:-.}
+utils=$toppkgdir/../utils/build_message_db.py
+prompts=$toppkgdir/../prompts/narrator.csv
+messages=$toppkgdir/../prompts/types.csv
+languages=${BENCH_LANGUAGES:-"sv en fi"}
+results=bench-results
+baseline=$toppkgdir/bench-baseline/`uname -m`
+
+mkdir -p $results
+result=0
+
+for language in $languages; do
+    translations=$toppkgdir/../prompts/${language}_translations.csv
+    database=bench-$language.db
+
+    # Building the audio is slow, so the database is kept until the prompts change
+    if [ ! -f $database ] || [ $prompts -nt $database ] || [ $messages -nt $database ] || [ $translations -nt $database ]; then
+        rm -f $database
+        python $utils -p $prompts -m $messages -t $translations -l $language -o $database || exit 1
+    fi
+
+    ./bench_messages $database $language $results/messages-$language.json $baseline/messages-$language.json || result=1
+done
+
+./bench_decode $toppkgdir/testdata $results/decode.json $baseline/decode.json || result=1
+
+if [ "$BENCH_BASELINE" = "store" ]; then
+    mkdir -p $baseline
+    cp $results/*.json $baseline/
+    echo "Stored the results as the baseline in $baseline"
+    result=0
+fi
+
+exit $result
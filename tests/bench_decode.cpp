@@ -0,0 +1,283 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <Narrator.h>
+#include <Message.h>
+#include <OggStream.h>
+#include <Mp3Stream.h>
+#include <Filter.h>
+#include <ChannelConverter.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <functional>
+#include "setup_logging.h"
+#include "bench.h"
+
+using namespace std;
+
+/*
+ * Measures decoding the bundled test data from files and from database blobs, and the filter
+ * at the corners and middle of the tempo and pitch range. Nothing is played
+ */
+
+#define DATABASE "./bench_decode.db"
+
+// Frames read at a time, like the playback thread
+#define FRAMES 1024
+
+// Each benchmark repeats until it has run this long
+#define MIN_SECONDS 0.5
+
+// Opens a new stream on the audio
+typedef std::function<AudioStream *()> StreamOpener;
+
+// Opens and decodes the whole audio, like the playback thread does for each clip
+BenchResult decode(const string &name, StreamOpener open)
+{
+    BenchResult result(name);
+    vector<float> buffer;
+    vector<double> opens;
+    long long frames = 0;
+    long long total = 0;
+    long rate = 0;
+    int channels = 0;
+
+    while(total < MIN_SECONDS * 1e9) {
+        long long start = bench_nowns();
+        AudioStream *stream = open();
+        if(stream == NULL) {
+            cout << name << ": could not open" << endl;
+            result.add("failed", 1);
+            return result;
+        }
+        long long opened = bench_nowns();
+
+        rate = stream->getRate();
+        channels = stream->getChannels();
+        buffer.resize(FRAMES * channels);
+        long got;
+        while((got = stream->read(&buffer[0], FRAMES)) > 0) frames += got;
+        stream->close();
+        delete stream;
+
+        total += bench_nowns() - start;
+        opens.push_back((opened - start) / 1000.0);
+    }
+
+    double seconds = total / 1e9;
+    result.add("iterations", opens.size());
+    result.add("rate", rate);
+    result.add("channels", channels);
+    result.add("frames", frames);
+    result.add("seconds", seconds);
+    result.add("frames_per_second", frames / seconds);
+    result.add("per_frame_ns", frames > 0 ? total / (double)frames : 0);
+    result.add("open_p50_us", bench_percentile(opens, 0.5));
+
+    cout << name << ": " << frames / seconds << " frames/s, " << total / (double)frames << " ns/frame, open "
+         << bench_percentile(opens, 0.5) << " us" << endl;
+    return result;
+}
+
+// Filters interleaved stereo audio through a fresh filter until MIN_SECONDS have passed
+BenchResult filter(const string &name, vector<float> &input, long rate, double tempo, double pitch, long outputRate)
+{
+    BenchResult result(name);
+    vector<float> output(FRAMES * 2 * 4);
+    long inFrames = input.size() / 2;
+    long long frames = 0;
+    long long outFrames = 0;
+    long long total = 0;
+    long iterations = 0;
+
+    while(total < MIN_SECONDS * 1e9) {
+        long long start = bench_nowns();
+
+        // Set up like the playback thread for each clip
+        Filter f;
+        f.setOutputRate(outputRate);
+        f.open(rate, 2);
+        f.setTempo(tempo);
+        f.setPitch(pitch);
+
+        for(long pos = 0; pos < inFrames; pos += FRAMES) {
+            long count = inFrames - pos < FRAMES ? inFrames - pos : FRAMES;
+            f.write(&input[pos * 2], count);
+            while(f.numSamples() > 0) outFrames += f.read(&output[0], output.size() / 2);
+        }
+        f.flush();
+        while(f.numSamples() > 0) outFrames += f.read(&output[0], output.size() / 2);
+
+        total += bench_nowns() - start;
+        frames += inFrames;
+        iterations++;
+    }
+
+    double seconds = total / 1e9;
+    result.add("iterations", iterations);
+    result.add("tempo", tempo);
+    result.add("pitch", pitch);
+    result.add("frames", frames);
+    result.add("output_frames", outFrames);
+    result.add("seconds", seconds);
+    result.add("frames_per_second", frames / seconds);
+    result.add("per_frame_ns", frames > 0 ? total / (double)frames : 0);
+
+    cout << name << ": " << frames / seconds << " frames/s, " << total / (double)frames << " ns/frame" << endl;
+    return result;
+}
+
+// Decodes a whole file into interleaved stereo, like the playback thread feeds the filter
+bool decodeStereo(const string &path, vector<float> &samples, long &rate)
+{
+    OggStream stream;
+    if(!stream.open(path)) return false;
+
+    ChannelConverter converter;
+    converter.open(stream.getChannels(), 2);
+    rate = stream.getRate();
+
+    vector<float> buffer(FRAMES * stream.getChannels());
+    long got;
+    while((got = stream.read(&buffer[0], FRAMES)) > 0) {
+        float *stereo = converter.convert(&buffer[0], got);
+        samples.insert(samples.end(), stereo, stereo + got * 2);
+    }
+    stream.close();
+    return !samples.empty();
+}
+
+// Stores a file in the database and looks up its audio like a prompt
+bool storeAudio(Narrator *speaker, const string &path, const string &identifier, MessageAudio &audio)
+{
+    ifstream in(path.c_str(), ios::binary);
+    if(!in) return false;
+    stringstream data;
+    data << in.rdbuf();
+    string bytes = data.str();
+
+    bool stored = path.compare(path.size() - 3, 3, "ogg") == 0 ?
+        speaker->addOggAudio(identifier.c_str(), bytes.data(), bytes.size()) :
+        speaker->addMp3Audio(identifier.c_str(), bytes.data(), bytes.size());
+    if(!stored) return false;
+
+    Message message;
+    message.setLanguage(speaker->getLanguage());
+    message.load(identifier, "prompt");
+    if(!message.compile() || !message.hasAudio()) return false;
+    audio = message.getAudioQueue()[0];
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "run this benchmark with e.g. " << argv[0] << " testdata results.json [baseline.json]" << std::endl;
+        return 1;
+    }
+
+    setup_logging();
+    logger->setLevel(log4cxx::Level::getWarn());
+
+    string testdata = argv[1];
+    vector<BenchResult> results;
+
+    // Files, read by the decoders themselves
+    const char *oggFiles[] = { "sample.ogg", "sample_mono.ogg", "sample_stereo.ogg", "sample_22050.ogg", "sample_44100.ogg" };
+    for(int i = 0; i < 5; i++) {
+        string path = testdata + "/" + oggFiles[i];
+        results.push_back(decode(string("ogg_file/") + oggFiles[i], [path]() -> AudioStream * {
+            OggStream *stream = new OggStream;
+            if(stream->open(path)) return stream;
+            delete stream;
+            return NULL;
+        }));
+    }
+    const char *mp3Files[] = { "sample.mp3", "sample_mono.mp3", "sample_stereo.mp3" };
+    for(int i = 0; i < 3; i++) {
+        string path = testdata + "/" + mp3Files[i];
+        results.push_back(decode(string("mp3_file/") + mp3Files[i], [path]() -> AudioStream * {
+            Mp3Stream *stream = new Mp3Stream;
+            if(stream->open(path)) return stream;
+            delete stream;
+            return NULL;
+        }));
+    }
+
+    // Database blobs, read through MessageAudio like prompts
+    Narrator *speaker = Narrator::Instance();
+    remove(DATABASE);
+    speaker->setDatabasePath(DATABASE);
+    speaker->setLanguage("en");
+
+    MessageAudio oggAudio, mp3Audio;
+    if(storeAudio(speaker, testdata + "/sample.ogg", "bench ogg", oggAudio)) {
+        results.push_back(decode("ogg_db/sample.ogg", [&oggAudio]() -> AudioStream * {
+            OggStream *stream = new OggStream;
+            if(stream->open(oggAudio)) return stream;
+            delete stream;
+            return NULL;
+        }));
+    } else {
+        cout << "Could not store sample.ogg in the database" << endl;
+    }
+    if(storeAudio(speaker, testdata + "/sample.mp3", "bench mp3", mp3Audio)) {
+        results.push_back(decode("mp3_db/sample.mp3", [&mp3Audio]() -> AudioStream * {
+            Mp3Stream *stream = new Mp3Stream;
+            if(stream->open(mp3Audio)) return stream;
+            delete stream;
+            return NULL;
+        }));
+    } else {
+        cout << "Could not store sample.mp3 in the database" << endl;
+    }
+
+    // Filter over the tempo and pitch range, and resampling for the other voices
+    vector<float> samples;
+    long rate;
+    if(decodeStereo(testdata + "/sample.ogg", samples, rate)) {
+        const double tempos[] = { NARRATOR_MIN_TEMPO, 1.0, 1.5, NARRATOR_MAX_TEMPO };
+        const double pitches[] = { NARRATOR_MIN_PITCH, 1.0, NARRATOR_MAX_PITCH };
+        for(int t = 0; t < 4; t++) {
+            for(int p = 0; p < 3; p++) {
+                ostringstream name;
+                name << "filter/tempo_" << tempos[t] << "_pitch_" << pitches[p];
+                results.push_back(filter(name.str(), samples, rate, tempos[t], pitches[p], 0));
+            }
+        }
+    }
+    samples.clear();
+    if(decodeStereo(testdata + "/sample_22050.ogg", samples, rate))
+        results.push_back(filter("filter/resample_22050_44100", samples, rate, 1.0, 1.0, 44100));
+
+    delete speaker;
+    remove(DATABASE);
+
+    if(!bench_write(argv[2], "decode", results)) {
+        std::cout << "Could not write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    if(argc > 3 && bench_compare(results, argv[3]) > 0) return 1;
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <Narrator.h>
+#include <Message.h>
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cassert>
+#include "setup_logging.h"
+#include "bench.h"
+
+using namespace std;
+
+/*
+ * Measures looking up prompts in the database, Message::load and compile as done for each prompt
+ * before it is played. The prompts are the ones the play functions of the narrator queue
+ */
+
+// A prompt with its parameters
+struct Prompt {
+    string identifier;
+    string cls;
+    vector< pair<string, int> > numbers;
+    vector< pair<string, string> > strings;
+
+    Prompt(const string &id, const string &c): identifier(id), cls(c) {}
+    Prompt &set(const string &key, int value) { numbers.push_back(make_pair(key, value)); return *this; }
+    Prompt &set(const string &key, const string &value) { strings.push_back(make_pair(key, value)); return *this; }
+};
+
+// The prompts queued by one call of a play function
+typedef vector<Prompt> Call;
+
+Call playNumber(int number)
+{
+    return Call(1, Prompt("{number}", "number").set("number", number));
+}
+
+// Like Narrator::playDate
+Call playDate(int day, int month, int year)
+{
+    Prompt p("{dayname} {date} of {month} {year} {yearnum}", "prompt");
+    p.set("date", day).set("month", month).set("year", year).set("yearnum", year);
+    int daynum = (day+=month<3?year--:year-2,23*month/9+day+4+year/4-year/100+year/400)%7;
+    p.set("dayname", daynum);
+    return Call(1, p);
+}
+
+// Like Narrator::playTime
+Call playTime(int hour, int minute, int second)
+{
+    Prompt p("{hour} {hour12} {minute} {second} {ampm}", "prompt");
+    p.set("minute", minute).set("second", second).set("hour", hour).set("hour12", hour > 12 ? hour - 12 : hour);
+    p.set("ampm", hour > 12 ? "am" : "pm");
+    return Call(1, p);
+}
+
+// Like Narrator::playDuration
+Call playDuration(long seconds)
+{
+    int h = seconds / 3600;
+    int m = (seconds - h * 3600) / 60;
+    int s = seconds - h * 3600 - m * 60;
+
+    Call call;
+    if(h > 0) {
+        if(h == 1) call.push_back(Prompt("one hour", "prompt"));
+        else call.push_back(Prompt("{2} hours", "prompt").set("2", h));
+        if(m != 0 || s != 0) call.push_back(Prompt("and", "prompt"));
+    }
+    if(m > 0) {
+        if(m == 1) call.push_back(Prompt("one minute", "prompt"));
+        else call.push_back(Prompt("{2} minutes", "prompt").set("2", m));
+        if(s != 0) call.push_back(Prompt("and", "prompt"));
+    }
+    if(s > 0) {
+        if(s == 1) call.push_back(Prompt("one second", "prompt"));
+        else call.push_back(Prompt("{2} seconds", "prompt").set("2", s));
+    }
+    if(h == 0 && m == 0 && s == 0)
+        call.push_back(Prompt("{2} seconds", "prompt").set("2", 0));
+    return call;
+}
+
+// Like Narrator::spell
+Call spell(string word)
+{
+    std::transform(word.begin(), word.end(), word.begin(), ::toupper);
+
+    Call call;
+    for(size_t i = 0; i < word.size(); i++) {
+        char c = word[i];
+        string s(1, c);
+        if(c >= '0' && c <= '9') call.push_back(Prompt("{number}", "number").set("number", c - '0'));
+        else if(c >= 'A' && c <= 'Z') call.push_back(Prompt(s, "letter"));
+        else if(c == ' ') call.push_back(Prompt("shortpause", "prompt"));
+        else if(strchr("!#%*+,-./:;?@_~", c) != NULL) call.push_back(Prompt(s, "symbol"));
+    }
+    return call;
+}
+
+// Looks up the prompts of each call, returns the metrics with the latency of whole calls
+BenchResult run(const string &name, const vector<Call> &calls, const string &language)
+{
+    vector<double> latencies;
+    latencies.reserve(calls.size());
+    long messages = 0;
+    long failed = 0;
+    long long total = 0;
+
+    for(size_t i = 0; i < calls.size(); i++) {
+        long long callns = 0;
+        for(size_t j = 0; j < calls[i].size(); j++) {
+            const Prompt &p = calls[i][j];
+
+            // Set up like Narrator::setParameter, outside the measurement
+            Message message;
+            for(size_t k = 0; k < p.numbers.size(); k++) {
+                MessageParameter mp(p.numbers[k].first);
+                mp.setIntValue(p.numbers[k].second);
+                message.addParameter(mp);
+            }
+            for(size_t k = 0; k < p.strings.size(); k++)
+                message.setParameterValue(p.strings[k].first, p.strings[k].second);
+            message.setLanguage(language);
+
+            long long start = bench_nowns();
+            message.load(p.identifier, p.cls);
+            bool found = message.compile() && message.hasAudio();
+            callns += bench_nowns() - start;
+
+            messages++;
+            if(!found) failed++;
+        }
+        latencies.push_back(callns / 1000.0);
+        total += callns;
+    }
+
+    double seconds = total / 1e9;
+    BenchResult result(name);
+    result.add("calls", calls.size());
+    result.add("messages", messages);
+    result.add("failed", failed);
+    result.add("seconds", seconds);
+    result.add("calls_per_second", seconds > 0 ? calls.size() / seconds : 0);
+    result.add("messages_per_second", seconds > 0 ? messages / seconds : 0);
+    result.add("p50_us", bench_percentile(latencies, 0.50));
+    result.add("p90_us", bench_percentile(latencies, 0.90));
+    result.add("p99_us", bench_percentile(latencies, 0.99));
+    result.add("max_us", bench_percentile(latencies, 1.0));
+
+    cout << name << ": " << calls.size() / seconds << " calls/s, p50 " << bench_percentile(latencies, 0.5)
+         << " us, p99 " << bench_percentile(latencies, 0.99) << " us";
+    if(failed > 0) cout << ", " << failed << " prompts not found";
+    cout << endl;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        std::cout << "run this benchmark with e.g. " << argv[0] << " database.db sv results.json [baseline.json]" << std::endl;
+        return 1;
+    }
+
+    setup_logging();
+    logger->setLevel(log4cxx::Level::getWarn());
+
+    // The messages open the database of the narrator
+    Narrator *speaker = Narrator::Instance();
+    speaker->setDatabasePath(argv[1]);
+    string language = argv[2];
+
+    vector<Call> numbers, dates, times, durations, words;
+    for(int number = 0; number < 10000; number++)
+        numbers.push_back(playNumber(number));
+    for(int year = 1999; year <= 2001; year++)
+        for(int month = 1; month <= 12; month++)
+            for(int day = 1; day <= 31; day++)
+                dates.push_back(playDate(day, month, year));
+    for(int minute = 0; minute < 24 * 60; minute++)
+        times.push_back(playTime(minute / 60, minute % 60, minute % 60));
+    for(long seconds = 0; seconds < 10000; seconds += 3)
+        durations.push_back(playDuration(seconds));
+    const char *spelled[] = { "aBcXyZ012890", "http://google.com", "info@kolibre.org", "1.2.3~4", "+5 -6" };
+    for(int round = 0; round < 200; round++)
+        for(int i = 0; i < 5; i++)
+            words.push_back(spell(spelled[i]));
+
+    // Warm up the database cache
+    run("warmup", vector<Call>(numbers.begin(), numbers.begin() + 100), language);
+
+    vector<BenchResult> results;
+    results.push_back(run("play_number", numbers, language));
+    results.push_back(run("play_date", dates, language));
+    results.push_back(run("play_time", times, language));
+    results.push_back(run("play_duration", durations, language));
+    results.push_back(run("spell", words, language));
+
+    delete speaker;
+
+    if(!bench_write(argv[3], "messages-" + language, results)) {
+        std::cout << "Could not write " << argv[3] << std::endl;
+        return 1;
+    }
+
+    if(argc > 4 && bench_compare(results, argv[4]) > 0) return 1;
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <BoundedQueue.h>
+#include "setup_logging.h"
+#include <iostream>
+#include <cassert>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+using namespace std;
+
+// Concurrent test, each producer numbers its items and the consumer checks they arrive in order
+#define TORTURE_PRODUCERS 4
+#define TORTURE_ITEMS 1000000
+#define TORTURE_QUEUE_SIZE 64
+#define TORTURE_BATCH 8
+
+struct Item {
+    int producer;
+    long number;
+};
+
+struct TortureArgs {
+    BoundedQueue<Item> *queue;
+    int producer;
+    bool batches;
+};
+
+void *torture_producer(void *arg)
+{
+    TortureArgs *args = (TortureArgs*)arg;
+
+    if(args->batches) {
+        Item items[TORTURE_BATCH];
+        for(long i = 0; i < TORTURE_ITEMS; i += TORTURE_BATCH) {
+            for(int j = 0; j < TORTURE_BATCH; j++) {
+                items[j].producer = args->producer;
+                items[j].number = i + j;
+            }
+            while(!args->queue->push(items, TORTURE_BATCH)) sched_yield();
+        }
+        return NULL;
+    }
+
+    for(long i = 0; i < TORTURE_ITEMS; i++) {
+        Item item = { args->producer, i };
+        while(!args->queue->push(item)) sched_yield();
+    }
+    return NULL;
+}
+
+// Pushes from several threads and verifies that nothing is lost, duplicated or reordered per producer,
+// and that items pushed in one batch come out together
+void torture(bool batches)
+{
+    BoundedQueue<Item> queue(TORTURE_QUEUE_SIZE);
+    TortureArgs args[TORTURE_PRODUCERS];
+    pthread_t producers[TORTURE_PRODUCERS];
+    long next[TORTURE_PRODUCERS] = {0};
+    long errors = 0;
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    for(int p = 0; p < TORTURE_PRODUCERS; p++) {
+        args[p].queue = &queue;
+        args[p].producer = p;
+        args[p].batches = batches;
+        assert(pthread_create(&producers[p], NULL, torture_producer, &args[p]) == 0);
+    }
+
+    long received = 0;
+    Item item, previous = { -1, -1 };
+    while(received < (long) TORTURE_PRODUCERS * TORTURE_ITEMS) {
+        if(!queue.pop(item)) {
+            sched_yield();
+            continue;
+        }
+        if(item.number != next[item.producer]) errors++;
+        if(batches && item.number % TORTURE_BATCH != 0 && previous.producer != item.producer) errors++;
+        next[item.producer] = item.number + 1;
+        previous = item;
+        received++;
+    }
+
+    for(int p = 0; p < TORTURE_PRODUCERS; p++) pthread_join(producers[p], NULL);
+
+    gettimeofday(&end, NULL);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    cout << (batches ? "torture batches: " : "torture: ") << received << " items from " << TORTURE_PRODUCERS << " producers in " << seconds << " s, "
+        << (received / seconds / 1000000.0) << " M items/s, " << errors << " errors" << endl;
+
+    assert(errors == 0);
+    assert(queue.size() == 0);
+    assert(!queue.pop(item));
+}
+
+int main(int argc, char **argv)
+{
+    setup_logging();
+
+    // Sizes are rounded up to a power of two
+    BoundedQueue<int> numbers(10);
+    assert(numbers.capacity() == 16);
+    assert(numbers.size() == 0);
+
+    int value = 0;
+    assert(!numbers.pop(value));
+    assert(numbers.front() == NULL);
+
+    // Fill it up, the item is left alone when full
+    for(int i = 0; i < 16; i++) {
+        value = i;
+        assert(numbers.push(value));
+    }
+    assert(numbers.size() == 16);
+    value = 100;
+    assert(!numbers.push(value));
+    assert(value == 100);
+
+    // Items come out in order, also after wrapping around
+    for(int lap = 0; lap < 3; lap++) {
+        for(int i = 0; i < 16; i++) {
+            assert(numbers.pop(value));
+            assert(value == lap * 16 + i);
+            value = (lap + 1) * 16 + i;
+            assert(numbers.push(value));
+        }
+    }
+
+    // The oldest item can be looked at without taking it out
+    assert(*numbers.front() == 48);
+    assert(numbers.size() == 16);
+    assert(numbers.pop(value));
+    assert(value == 48);
+    assert(*numbers.front() == 49);
+    value = 64;
+    assert(numbers.push(value));
+
+    // Move-only items are moved in and out
+    BoundedQueue< unique_ptr<int> > owned(4);
+    unique_ptr<int> in(new int(42));
+    assert(owned.push(in));
+    assert(!in);
+    unique_ptr<int> out;
+    assert(owned.pop(out));
+    assert(out && *out == 42);
+
+    // A batch goes in whole or not at all
+    int batch[16];
+    for(int i = 0; i < 16; i++) batch[i] = 100 + i;
+    assert(!numbers.push(batch, 3));
+    for(int i = 0; i < 3; i++) assert(numbers.pop(value));
+    assert(numbers.push(batch, 3));
+    assert(numbers.size() == 16);
+    for(int i = 0; i < 13; i++) assert(numbers.pop(value));
+    for(int i = 0; i < 3; i++) {
+        assert(numbers.pop(value));
+        assert(value == 100 + i);
+    }
+    assert(!numbers.push(batch, 17));
+    assert(numbers.push(batch, 16));
+    assert(numbers.size() == 16);
+
+    torture(false);
+    torture(true);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ChannelConverter.h>
+#include "setup_logging.h"
+#include <iostream>
+#include <cassert>
+
+using namespace std;
+
+#define FRAMES 8
+
+int main(int argc, char **argv)
+{
+    setup_logging();
+
+    ChannelConverter converter;
+    float mono[FRAMES] = {1,2,3,4,5,6,7,8};
+    float stereo[FRAMES*2] = {1,3,2,4,3,5,4,6,5,7,6,8,7,9,8,10};
+    float *out;
+
+    // Invalid layouts are refused
+    assert(!converter.open(0, 2));
+    assert(!converter.open(2, 0));
+
+    // Same layout passes the buffer through untouched
+    assert(converter.open(2, 2));
+    out = converter.convert(stereo, FRAMES);
+    assert(out == stereo);
+
+    // Mono is duplicated into both channels
+    assert(converter.open(1, 2));
+    out = converter.convert(mono, FRAMES);
+    assert(out != mono);
+    for(int i = 0; i < FRAMES; i++) {
+        assert(out[i*2] == mono[i]);
+        assert(out[i*2+1] == mono[i]);
+    }
+
+    // Stereo is averaged down to mono
+    assert(converter.open(2, 1));
+    out = converter.convert(stereo, FRAMES);
+    for(int i = 0; i < FRAMES; i++) {
+        assert(out[i] == (stereo[i*2] + stereo[i*2+1]) / 2);
+    }
+
+    // Switching back and forth with growing frame counts
+    assert(converter.open(1, 2));
+    out = converter.convert(mono, FRAMES/2);
+    assert(out[FRAMES-1] == mono[FRAMES/2-1]);
+    out = converter.convert(mono, FRAMES);
+    assert(out[FRAMES*2-1] == mono[FRAMES-1]);
+
+    return 0;
+}
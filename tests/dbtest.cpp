@@ -166,6 +166,30 @@ int main(int argc, char **argv)
     while (speaker->isSpeaking());
     assert(narratorDone);
 
+    /*
+     * try inserting audio on the database thread -> expect callback and future with the same result
+     */
+
+    {
+        char *data = NULL;
+        int size = readData(argv[1], &data);
+        assert(size>=0);
+        bool callbackResult = false;
+        std::future<bool> added;
+        if (extension == "ogg")
+            added = speaker->addOggAudioAsync("async identifier", data, size, [&](bool result) { callbackResult = result; });
+        else
+            added = speaker->addMp3AudioAsync("async identifier", data, size, [&](bool result) { callbackResult = result; });
+        free(data); // the data is copied before queueing
+        assert(added.get());
+        assert(callbackResult);
+
+        if (extension == "ogg")
+            assert(speaker->hasOggAudioAsync("async identifier").get());
+        else
+            assert(speaker->hasMp3AudioAsync("async identifier").get());
+    }
+
     // stop thread and delete instance before exiting
     delete speaker;
 
@@ -0,0 +1,73 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <Filter.h>
+#include "setup_logging.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+#define CHANNELS 2
+#define FRAMES 8192
+
+// Writes the input to the filter and reads back everything it produces
+vector<float> process(Filter &filter, vector<float> &input)
+{
+    vector<float> output;
+    float buffer[1024 * CHANNELS];
+
+    filter.write(&input[0], input.size() / CHANNELS);
+    filter.flush();
+    unsigned int frames;
+    while((frames = filter.read(buffer, 1024)) > 0)
+        output.insert(output.end(), buffer, buffer + frames * CHANNELS);
+    return output;
+}
+
+int main(int argc, char **argv)
+{
+    setup_logging();
+
+    // Different signals in the channels, so a channel left out shows
+    vector<float> input(FRAMES * CHANNELS);
+    for(int i = 0; i < FRAMES; i++) {
+        input[i * CHANNELS] = 0.5 * sin(i * 0.05);
+        input[i * CHANNELS + 1] = 0.25 * cos(i * 0.03);
+    }
+
+    Filter full, half;
+    assert(full.open(44100, CHANNELS));
+    assert(half.open(44100, CHANNELS));
+    half.setGain(0.5);
+
+    vector<float> fullOut = process(full, input);
+    vector<float> halfOut = process(half, input);
+
+    // The gain applies to every sample of every channel
+    assert(fullOut.size() > 0);
+    assert(fullOut.size() == halfOut.size());
+    for(size_t i = 0; i < fullOut.size(); i++)
+        assert(fabs(halfOut[i] - fullOut[i] * 0.5) < 1e-6);
+
+    return 0;
+}
@@ -19,15 +19,40 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 
 #include <Narrator.h>
 #include <iostream>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <poll.h>
+#include <unistd.h>
 #include "setup_logging.h"
 
 bool narratorDone = false;
+std::mutex itemMutex;
+Narrator::ItemId lastItem = 0;
+int lastStage = -1;
+long long audibleus = 0;
+long long finishedus = 0;
+
+long long nowus() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 void narrator_done() {
     std::cout << "narrator finished playback" << endl;
     narratorDone = true;
 }
 
+void item_event(const Narrator::ItemEvent &event) {
+    // Stages of one item are reported in order, items queued meanwhile are reported from another thread
+    std::lock_guard<std::mutex> lock(itemMutex);
+    if(event.item == lastItem) assert(event.stage > lastStage);
+    lastItem = event.item;
+    lastStage = event.stage;
+    if(event.stage == Narrator::ITEM_AUDIBLE) audibleus = event.timeus;
+    if(event.stage == Narrator::ITEM_FINISHED) finishedus = event.timeus;
+}
+
 int main(int argc, char **argv)
 {
     if (argc < 3)
@@ -136,6 +161,83 @@ int main(int argc, char **argv)
     speaker->setPitch(defaultValue);
     assert(speaker->getPitch() == defaultValue);
 
+    // test item events, an item is finished once the output has played its last sample
+    speaker->connectItemEvent(&item_event);
+    narratorDone = false;
+    Narrator::ItemId item = speaker->play("Monday");
+    assert(item != 0);
+    assert(speaker->play("Monday") > item);
+    while (speaker->isSpeaking());
+    assert(narratorDone);
+    for (int i = 0; i < 200; i++) {
+        {
+            std::lock_guard<std::mutex> lock(itemMutex);
+            if (lastItem > item && lastStage >= Narrator::ITEM_FINISHED) break;
+        }
+        usleep(10000);
+    }
+    assert(lastItem > item && lastStage == Narrator::ITEM_FINISHED);
+    assert(finishedus >= audibleus && finishedus <= nowus());
+
+    // an item stopped before the output has played it is reported stopped, the null sink plays on write
+    const char *sink = getenv("NARRATOR_AUDIO_SINK");
+    if (sink == NULL || string(sink) != "null") {
+        item = speaker->play("Monday");
+        speaker->stop();
+        for (int i = 0; i < 200; i++) {
+            {
+                std::lock_guard<std::mutex> lock(itemMutex);
+                if (lastItem == item && lastStage >= Narrator::ITEM_FINISHED) break;
+            }
+            usleep(10000);
+        }
+        assert(lastItem == item && lastStage == Narrator::ITEM_STOPPED);
+        while (speaker->isSpeaking());
+    }
+
+    // test coalescing, events the slots have fallen behind on are merged
+    speaker->setCoalesceEvents(true);
+    assert(speaker->getCoalesceEvents());
+    speaker->setCoalesceEvents(false);
+    assert(!speaker->getCoalesceEvents());
+
+    // test polled events, the narrator reports when it starts and stops speaking
+    vector<Narrator::Event> events;
+    int fd = speaker->getEventDescriptor();
+    assert(fd >= 0);
+    speaker->play("Monday");
+    bool speaking = true;
+    while (speaking) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        assert(poll(&pfd, 1, 5000) == 1);
+        speaker->pollEvents(events);
+        for (size_t i = 0; i < events.size(); i++)
+            if (events[i].type == Narrator::EVENT_STATE) speaking = events[i].speaking;
+    }
+
+    // test set lookahead, prompts are then looked up ahead of playback
+    speaker->setLookahead(-1);
+    assert(speaker->getLookahead() == 0);
+    speaker->setLookahead(8);
+    assert(speaker->getLookahead() == 8);
+
+    // test real-time settings of the playback thread, they are either applied or left as they were
+    assert(speaker->setPlaybackScheduling(Narrator::SCHEDULING_DEFAULT));
+    assert(speaker->getPlaybackScheduling() == Narrator::SCHEDULING_DEFAULT);
+    if(speaker->setPlaybackScheduling(Narrator::SCHEDULING_FIFO, 10)) {
+        int priority;
+        assert(speaker->getPlaybackScheduling(&priority) == Narrator::SCHEDULING_FIFO);
+        assert(priority == 10);
+        assert(speaker->setPlaybackScheduling(Narrator::SCHEDULING_DEFAULT));
+    }
+    vector<int> cpus = speaker->getPlaybackAffinity();
+    assert(!cpus.empty());
+    assert(speaker->setPlaybackAffinity(vector<int>(1, cpus[0])));
+    assert(speaker->getPlaybackAffinity() == vector<int>(1, cpus[0]));
+    assert(speaker->setPlaybackAffinity(vector<int>()));
+    assert(speaker->setMemoryLocked(false));
+    assert(!speaker->getMemoryLocked());
+
     /*
      * play interface
      */
@@ -161,6 +263,49 @@ int main(int argc, char **argv)
     while (speaker->isSpeaking());
     assert(narratorDone);
 
+    // output statistics are updated when playback finishes
+    Narrator::OutputStats stats = speaker->getOutputStats();
+    assert(stats.framesRendered > 0);
+    assert(stats.callbackMaxus >= stats.callbackAvgus);
+
+    // test priority, an urgent prompt cuts into the file which then continues
+    narratorDone = false;
+    speaker->playFile(file);
+    speaker->setPriority(Narrator::PRIORITY_URGENT, Narrator::PREEMPT_NOW);
+    assert(speaker->getPriority() == Narrator::PRIORITY_URGENT);
+    speaker->play("Monday");
+    speaker->setPriority(Narrator::PRIORITY_NORMAL);
+    assert(speaker->getPriority() == Narrator::PRIORITY_NORMAL);
+    while (speaker->isSpeaking());
+    assert(narratorDone);
+
+    // test voices, a quieter file plays alongside the speech
+    narratorDone = false;
+    speaker->setVoice(1);
+    assert(speaker->getVoice() == 1);
+    speaker->setVoiceGain(1, 0.5);
+    assert(speaker->getVoiceGain(1) == 0.5);
+    speaker->playFile(file);
+    speaker->setVoice(0);
+    assert(speaker->isVoicePlaying(1));
+    speaker->play("Monday");
+    while (speaker->isSpeaking() || speaker->isVoicePlaying(1));
+    assert(narratorDone);
+
+    // test batch, the prompts are queued together with their own parameters
+    narratorDone = false;
+    Narrator::Batch batch;
+    batch.setParameter("2", 5);
+    batch.play("{2} minutes");
+    batch.play("and");
+    batch.play(2);
+    batch.playFile(file);
+    assert(batch.size() == 4);
+    assert(speaker->queueBatch(batch));
+    assert(batch.size() == 0);
+    while (speaker->isSpeaking());
+    assert(narratorDone);
+
     // test play date
     narratorDone = false;
     speaker->playDate(1,1,1970);
@@ -0,0 +1,138 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Mixer.h>
+#include "setup_logging.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <pthread.h>
+
+using namespace std;
+
+#define CHANNELS 2
+#define FRAMES 256
+
+void *stop_input(void *input)
+{
+    ((MixerInput*)input)->stop();
+    return NULL;
+}
+
+// Writes frames of a constant value to an input
+void fill(MixerInput *input, float value, unsigned int frames)
+{
+    float buffer[FRAMES * CHANNELS];
+    for(unsigned int i = 0; i < frames * CHANNELS; i++) buffer[i] = value;
+    assert(input->write(buffer, frames));
+}
+
+int main(int argc, char **argv)
+{
+    setup_logging();
+
+    Mixer mixer(3, CHANNELS);
+    assert(mixer.getInputs() == 3);
+    assert(mixer.getInput(3) == NULL);
+    assert(mixer.getRate() == MIXER_RATE);
+    assert(!mixer.hasWork());
+
+    float buffer[FRAMES * CHANNELS] = {0};
+
+    // Nothing written leaves the output alone
+    assert(mixer.mix(buffer, FRAMES * CHANNELS) == 0);
+    for(int i = 0; i < FRAMES * CHANNELS; i++) assert(buffer[i] == 0);
+
+    // Inputs are scaled by their gain and added to what is in the output
+    MixerInput *first = mixer.getInput(0);
+    MixerInput *second = mixer.getInput(1);
+    assert(first->open(22050, CHANNELS));
+    assert(!first->open(22050, 1));
+    assert(second->open(44100, CHANNELS));
+    second->setGain(0.5);
+    assert(second->getGain() == 0.5);
+
+    fill(first, 0.25, FRAMES);
+    fill(second, 0.5, FRAMES / 2);
+    assert(mixer.hasWork());
+    assert(first->getRemainingms() == FRAMES * 1000 / MIXER_RATE);
+
+    for(int i = 0; i < FRAMES * CHANNELS; i++) buffer[i] = 0.125;
+    assert(mixer.mix(buffer, FRAMES * CHANNELS) == FRAMES * CHANNELS);
+    for(int i = 0; i < FRAMES * CHANNELS; i++) {
+        float expected = (i < FRAMES) ? 0.125 + 0.25 + 0.25 : 0.125 + 0.25;
+        assert(fabs(buffer[i] - expected) < 1e-6);
+    }
+    assert(!mixer.hasWork());
+
+    // Only part of an input is mixed if the output is shorter
+    fill(first, 1.0, FRAMES);
+    for(int i = 0; i < FRAMES * CHANNELS; i++) buffer[i] = 0;
+    assert(mixer.mix(buffer, 10 * CHANNELS) == 10 * CHANNELS);
+    assert(buffer[10 * CHANNELS - 1] == 1.0 && buffer[10 * CHANNELS] == 0);
+    assert(mixer.hasWork());
+
+    // A stop request drops the rest without mixing it
+    first->requestStop();
+    assert(mixer.hasWork());
+    for(int i = 0; i < FRAMES * CHANNELS; i++) buffer[i] = 0;
+    assert(mixer.mix(buffer, FRAMES * CHANNELS) == 0);
+    for(int i = 0; i < FRAMES * CHANNELS; i++) assert(buffer[i] == 0);
+    assert(!mixer.hasWork());
+    assert(first->getRemainingms() == 0);
+
+    // Stop waits until the mixer has dropped the input
+    fill(first, 1.0, FRAMES);
+    pthread_t stopper;
+    assert(pthread_create(&stopper, NULL, stop_input, first) == 0);
+    while(first->getRemainingms() > 0 || mixer.hasWork())
+        mixer.mix(buffer, FRAMES * CHANNELS);
+    pthread_join(stopper, NULL);
+    assert(!mixer.hasWork());
+
+    // Writing into regions, the remaining time follows the rate of the output
+    mixer.setRate(1000);
+    assert(mixer.getRate() == 1000);
+    float *data1, *data2;
+    unsigned int frames1, frames2;
+    assert(first->getWriteRegions(FRAMES, &data1, &frames1, &data2, &frames2) == FRAMES);
+    for(unsigned int i = 0; i < frames1 * CHANNELS; i++) data1[i] = 0.5;
+    for(unsigned int i = 0; i < frames2 * CHANNELS; i++) data2[i] = 0.5;
+    assert(first->commitWrite(FRAMES));
+    assert(first->getRemainingms() == FRAMES);
+    for(int i = 0; i < FRAMES * CHANNELS; i++) buffer[i] = 0;
+    assert(mixer.mix(buffer, FRAMES * CHANNELS) == FRAMES * CHANNELS);
+    for(int i = 0; i < FRAMES * CHANNELS; i++) assert(buffer[i] == 0.5);
+
+    // A full input can not be written to until the mixer has read from it
+    while(first->getWriteRegions(FRAMES, &data1, &frames1, &data2, &frames2) > 0)
+        first->commitWrite(frames1 + frames2);
+    assert(first->getWriteAvailable() == 0);
+    mixer.mix(buffer, FRAMES * CHANNELS);
+    assert(first->getWriteAvailable() == FRAMES * CHANNELS);
+
+    // Mixed audio counts as remaining until the output has played it
+    mixer.setLatency(1000);
+    mixer.mix(buffer, FRAMES * CHANNELS);
+    assert(first->getRemainingms() > 900);
+    assert(second->getRemainingms() == 0);
+    assert(mixer.getRemainingms() > 900);
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Narrator.h>
+#include <OggStream.h>
+#include <ChannelConverter.h>
+#include <Filter.h>
+#include <MemorySink.h>
+#include "setup_logging.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+#define FRAMES 1024
+#define CHANNELS 2
+
+using namespace std;
+
+// Plays a file the way the playback thread does, converted to stereo and through
+// the filter, which resamples it to the rate of the sink. Rate 0 keeps the rate of the file
+void playLive(const string &path, long rate, MemorySink &sink)
+{
+    OggStream stream;
+    assert(stream.open(path));
+    if (rate == 0) rate = stream.getRate();
+
+    ChannelConverter converter;
+    assert(converter.open(stream.getChannels(), CHANNELS));
+    Filter filter;
+    filter.setOutputRate(rate);
+    assert(filter.open(stream.getRate(), CHANNELS));
+    assert(sink.open(rate, CHANNELS));
+
+    float buffer[FRAMES * CHANNELS];
+    long frames;
+    do {
+        frames = stream.read(buffer, FRAMES);
+        if (frames > 0) filter.write(converter.convert(buffer, frames), frames);
+        else filter.flush();
+
+        unsigned int samples;
+        while ((samples = filter.read(buffer, FRAMES)) > 0) sink.write(buffer, samples);
+    } while (frames > 0);
+    stream.close();
+}
+
+// Renders the files one after another
+void render(Narrator *speaker, const string &first, const string &second, vector<float> &samples, long &rate)
+{
+    int channels;
+    assert(speaker->beginRender());
+    assert(speaker->playFile(first) != 0);
+    if (second != "") assert(speaker->playFile(second) != 0);
+    assert(speaker->endRender(samples, rate, channels));
+    assert(channels == CHANNELS);
+}
+
+// Sizes differ at most by the tail the filter flushes
+bool sameSize(size_t a, size_t b)
+{
+    size_t slack = max(a, b) / 100 + 64 * CHANNELS;
+    return a + slack >= b && b + slack >= a;
+}
+
+// The rendered samples from offset match the live ones, up to the flushed tail
+void compare(const vector<float> &rendered, size_t offset, const vector<float> &live)
+{
+    assert(rendered.size() > offset);
+    size_t overlap = min(rendered.size() - offset, live.size());
+    overlap -= min(overlap, live.size() / 100 + 64 * CHANNELS);
+    assert(overlap > 0);
+
+    double error = 0;
+    for (size_t i = 0; i < overlap; i++) error += fabs(rendered[offset + i] - live[i]);
+    assert(error / overlap < 0.01);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "run this test with e.g. " << argv[0] << " /path/to/file /path/to/file_at_other_rate" << std::endl;
+        return 1;
+    }
+
+    setup_logging();
+
+    Narrator *speaker = Narrator::Instance();
+    speaker->setLanguage("sv");
+
+    // a prompt renders as it plays
+    MemorySink first;
+    playLive(argv[1], 0, first);
+    vector<float> samples;
+    long rate;
+    render(speaker, argv[1], "", samples, rate);
+    assert(rate == first.getRate());
+    assert(sameSize(samples.size(), first.getSamples().size()));
+    compare(samples, 0, first.getSamples());
+    size_t firstSize = samples.size();
+
+    // a prompt at another rate is resampled to the rate of the first one
+    MemorySink second;
+    playLive(argv[2], first.getRate(), second);
+    assert(second.getRate() == first.getRate());
+    render(speaker, argv[1], argv[2], samples, rate);
+    assert(rate == first.getRate());
+    assert(sameSize(samples.size(), first.getSamples().size() + second.getSamples().size()));
+    compare(samples, 0, first.getSamples());
+    compare(samples, firstSize, second.getSamples());
+
+    // stop thread and delete instance before exiting
+    delete speaker;
+
+    return 0;
+}
@@ -23,20 +23,134 @@ along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include <cassert>
 #include <cstdlib>
+#include <pthread.h>
+#include <sys/time.h>
 
 using namespace std;
 
 #define BUFFER_SIZE 10
 
+// Concurrent test, elements are numbered modulo 2^24 so they are exact as floats
+#define TORTURE_BUFFER_SIZE 4096
+#define TORTURE_ELEMENTS (1 << 25)
+#define TORTURE_MAXCHUNK 1500
+#define TORTURE_MODULO (1 << 24)
+
 int getRand(){
     return rand() % BUFFER_SIZE + 1;
 }
 
+struct TortureArgs {
+    RingBuffer *ringbuf;
+    long errors;
+};
+
+void *torture_writer(void *arg)
+{
+    TortureArgs *args = (TortureArgs*)arg;
+    float chunk[TORTURE_MAXCHUNK];
+    unsigned int seed = 1;
+    long written = 0;
+
+    while(written < TORTURE_ELEMENTS) {
+        size_t elements = rand_r(&seed) % TORTURE_MAXCHUNK + 1;
+        if(elements > (size_t)(TORTURE_ELEMENTS - written)) elements = TORTURE_ELEMENTS - written;
+        for(size_t i = 0; i < elements; i++)
+            chunk[i] = (float)((written + i) % TORTURE_MODULO);
+
+        // Every other chunk is written directly into the buffer regions
+        size_t count;
+        if(written & 1) {
+            float *data1, *data2;
+            size_t size1, size2;
+            count = args->ringbuf->getWriteRegions(elements, &data1, &size1, &data2, &size2);
+            assert(size1 + size2 == count);
+            for(size_t i = 0; i < size1; i++) data1[i] = chunk[i];
+            for(size_t i = 0; i < size2; i++) data2[i] = chunk[size1 + i];
+            args->ringbuf->commitWrite(count);
+        }
+        else count = args->ringbuf->writeElements(chunk, elements);
+        assert(count <= elements);
+        written += count;
+        if(count == 0) sched_yield();
+    }
+    return NULL;
+}
+
+void *torture_reader(void *arg)
+{
+    TortureArgs *args = (TortureArgs*)arg;
+    float chunk[TORTURE_MAXCHUNK];
+    unsigned int seed = 2;
+    long read = 0;
+
+    while(read < TORTURE_ELEMENTS) {
+        size_t elements = rand_r(&seed) % TORTURE_MAXCHUNK + 1;
+        size_t available = args->ringbuf->getReadAvailable();
+        assert(available <= args->ringbuf->getSize());
+
+        // Every other chunk is read directly from the buffer regions
+        size_t count;
+        if(read & 1) {
+            float *data1, *data2;
+            size_t size1, size2;
+            count = args->ringbuf->getReadRegions(elements, &data1, &size1, &data2, &size2);
+            assert(size1 + size2 == count);
+            for(size_t i = 0; i < size1; i++) chunk[i] = data1[i];
+            for(size_t i = 0; i < size2; i++) chunk[size1 + i] = data2[i];
+            args->ringbuf->commitRead(count);
+        }
+        else count = args->ringbuf->readElements(chunk, elements);
+        assert(count <= elements);
+        for(size_t i = 0; i < count; i++) {
+            if(chunk[i] != (float)((read + i) % TORTURE_MODULO)) args->errors++;
+        }
+        read += count;
+        if(count == 0) sched_yield();
+    }
+    return NULL;
+}
+
+// Writes and reads from two threads and verifies that every element arrives in order
+void torture()
+{
+    RingBuffer ringbuf(TORTURE_BUFFER_SIZE);
+    assert(ringbuf.getSize() == TORTURE_BUFFER_SIZE);
+
+    TortureArgs args;
+    args.ringbuf = &ringbuf;
+    args.errors = 0;
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    pthread_t writer, reader;
+    assert(pthread_create(&writer, NULL, torture_writer, &args) == 0);
+    assert(pthread_create(&reader, NULL, torture_reader, &args) == 0);
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+
+    gettimeofday(&end, NULL);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    cout << "torture: " << TORTURE_ELEMENTS << " elements in " << seconds << " s, "
+        << (TORTURE_ELEMENTS / seconds / 1000000.0) << " M elements/s, "
+        << args.errors << " errors" << endl;
+
+    assert(args.errors == 0);
+    assert(ringbuf.getReadAvailable() == 0);
+    assert(ringbuf.getWriteAvailable() == TORTURE_BUFFER_SIZE);
+}
+
 int main(int argc, char **argv)
 {
     setup_logging();
 
+    // Sizes are rounded up to a power of two
     RingBuffer ringbuf(BUFFER_SIZE);
+    assert(ringbuf.getSize() == 16);
+    assert(ringbuf.getWriteAvailable() == 16);
+    assert(ringbuf.getReadAvailable() == 0);
 
     int count;
     float elements[] = {1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18};
@@ -143,5 +257,32 @@ int main(int argc, char **argv)
 
     }
 
+    // Flush discards everything
+    ringbuf.writeElements(elements, 5);
+    ringbuf.flush();
+    assert(ringbuf.getReadAvailable() == 0);
+    assert(ringbuf.getWriteAvailable() == ringbuf.getSize());
+
+    // Regions are split where the buffer wraps around
+    RingBuffer regions(16);
+    float *data1, *data2;
+    size_t size1, size2;
+    regions.writeElements(elements, 12);
+    regions.readElements(elements, 12);
+    assert(regions.getWriteRegions(10, &data1, &size1, &data2, &size2) == 10);
+    assert(size1 == 4 && size2 == 6 && data2 < data1);
+    for(int i = 0; i < 10; i++) (i < 4 ? data1[i] : data2[i - 4]) = i;
+    regions.commitWrite(10);
+    assert(regions.getReadAvailable() == 10);
+    assert(regions.getReadRegions(100, &data1, &size1, &data2, &size2) == 10);
+    assert(size1 == 4 && size2 == 6);
+    assert(data1[3] == 3 && data2[0] == 4 && data2[5] == 9);
+    regions.commitRead(10);
+    assert(regions.getReadAvailable() == 0);
+    assert(regions.getReadRegions(100, &data1, &size1, &data2, &size2) == 0);
+    assert(size1 == 0 && size2 == 0);
+
+    torture();
+
     return 0;
 }
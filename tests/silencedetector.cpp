@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2012 Kolibre
+
+This file is part of kolibre-narrator.
+
+Kolibre-narrator is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 2.1 of the License, or
+(at your option) any later version.
+
+Kolibre-narrator is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with kolibre-narrator. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <SilenceDetector.h>
+#include "setup_logging.h"
+#include <iostream>
+#include <cassert>
+
+using namespace std;
+
+#define RATE 1000
+#define FRAMES 1000
+
+int main(int argc, char **argv)
+{
+    setup_logging();
+
+    SilenceDetector detector;
+    float buffer[FRAMES * 2] = {0};
+    long start, end;
+    long padding = RATE * SILENCE_PADDING_MS / 1000;
+
+    // Nothing scanned gives no range
+    detector.reset(RATE, 2);
+    assert(!detector.getRange(start, end));
+
+    // A silent clip is kept as it is
+    detector.process(buffer, FRAMES);
+    assert(detector.getRange(start, end));
+    assert(start == 0 && end == FRAMES);
+
+    // Audio between frame 300 and 600 in the right channel only
+    for(int i = 300; i <= 600; i++) buffer[i * 2 + 1] = 0.5;
+    detector.reset(RATE, 2);
+    detector.process(buffer, FRAMES);
+    assert(detector.getRange(start, end));
+    assert(start == 300 - padding);
+    assert(end == 601 + padding);
+
+    // Same audio passed in several blocks
+    detector.reset(RATE, 2);
+    detector.process(buffer, 250);
+    detector.process(buffer + 250 * 2, 500);
+    detector.process(buffer + 750 * 2, 250);
+    assert(detector.getRange(start, end));
+    assert(start == 300 - padding);
+    assert(end == 601 + padding);
+
+    // Padding never extends outside the clip
+    buffer[1] = 0.5;
+    buffer[FRAMES * 2 - 1] = 0.5;
+    detector.reset(RATE, 2);
+    detector.process(buffer, FRAMES);
+    assert(detector.getRange(start, end));
+    assert(start == 0 && end == FRAMES);
+
+    return 0;
+}
@@ -102,7 +102,8 @@ class Audio:
 		if not self.exists(cursor, translationId):
 			text = unicode(self.text,'utf-8)').encode('utf-8')
 			t = (translationId, self.tagid, text, self.size, self.length, self.encoding, self.data, self.md5)
-			cursor.execute('INSERT INTO messageaudio VALUES (?, ?, ?, ?, ?, ?, ?, ?)', t)
+			# trimstart and trimend are left empty, the narrator finds the silence when the audio is first played
+			cursor.execute('INSERT INTO messageaudio (translation_id, tagid, text, size, length, encoding, data, md5) VALUES (?, ?, ?, ?, ?, ?, ?, ?)', t)
 			self.id = cursor.lastrowid
 		return True
 